@@ -1,8 +1,8 @@
 section .multiboot
 align 4
     dd 0x1BADB002              ; Multiboot magic number
-    dd 0x0                     ; No flags
-    dd -(0x1BADB002 + 0x0)     ; Checksum
+    dd 0x3                     ; Page-align modules, provide memory info
+    dd -(0x1BADB002 + 0x3)     ; Checksum
 
 section .text
 global start
@@ -10,12 +10,17 @@ extern gdt_load
 extern kernel_main
 
 start:
-    ; Load our GDT (sets up flat code/data segments)
-    call gdt_load
-
     ; Initialize stack
     mov esp, stack_top
 
+    ; Keep the multiboot info pointer (ebx) and magic (eax) for kernel_main;
+    ; gdt_load clobbers ax.
+    push ebx
+    push eax
+
+    ; Load our GDT (sets up flat code/data segments)
+    call gdt_load
+
     ; Enter kernel
     call kernel_main
 
@@ -5,6 +5,7 @@ BUILD_DIR=build
 ISO_DIR=iso
 EMBED_INSTALL_ISO="${EMBED_INSTALL_ISO:-0}"
 CC="i686-elf-gcc"
+HOST_CC="${HOST_CC:-gcc}"
 LD="i686-elf-ld"
 
 CFLAGS_BASE="-ffreestanding -m32 -Os -ffunction-sections -fdata-sections -fno-asynchronous-unwind-tables -fno-unwind-tables"
@@ -25,6 +26,8 @@ nasm -f elf32 boot.s -o "${BUILD_DIR}/boot.o"
 nasm -f elf32 gdt.s -o "${BUILD_DIR}/gdt.o"
 nasm -f elf32 irq1_wrapper.s -o "${BUILD_DIR}/irq1_wrapper.o"
 nasm -f elf32 irq12_wrapper.s -o "${BUILD_DIR}/irq12_wrapper.o"
+nasm -f elf32 irq14_wrapper.s -o "${BUILD_DIR}/irq14_wrapper.o"
+nasm -f elf32 irq15_wrapper.s -o "${BUILD_DIR}/irq15_wrapper.o"
 nasm -f elf32 idt_load.s -o "${BUILD_DIR}/idt_load.o"
 nasm -f elf32 isr32_stub.s -o "${BUILD_DIR}/isr32_stub.o"
 nasm -f elf32 drivers/storage/bios_int13.s -o "${BUILD_DIR}/bios_int13.o"
@@ -45,6 +48,10 @@ compile_c \
 
 compile_c -I. -Idrivers/io -c lib/string.c -o "${BUILD_DIR}/string.o"
 compile_c -I. -Idrivers/io -c lib/memory.c -o "${BUILD_DIR}/memory.o"
+compile_c -I. -c lib/crc32c.c -o "${BUILD_DIR}/crc32c.o"
+compile_c -I. -c lib/sha256.c -o "${BUILD_DIR}/sha256.o"
+compile_c -I. -c lib/lz.c -o "${BUILD_DIR}/lz.o"
+compile_c -I. -c lib/lzimage.c -o "${BUILD_DIR}/lzimage.o"
 compile_c -I. -Idrivers/io -c drivers/keyboard/keyboard.c -o "${BUILD_DIR}/keyboard.o"
 compile_c -I. -Idrivers/io -c drivers/mouse/mouse.c -o "${BUILD_DIR}/mouse.o"
 compile_c -I. -Idrivers/io -c drivers/timer/timer.c -o "${BUILD_DIR}/timer.o"
@@ -57,8 +64,24 @@ compile_c -I. -Idrivers/io -Idrivers/pci -c drivers/usb/host/host.c -o "${BUILD_
 compile_c -I. -Idrivers/io -Idrivers/usb -c drivers/usb/core/enumeration.c -o "${BUILD_DIR}/usb_enum.o"
 compile_c -I. -Idrivers/io -Idrivers/usb -c drivers/usb/usb.c -o "${BUILD_DIR}/usb.o"
 compile_c -I. -Idrivers/io -c fs/filesystem.c -o "${BUILD_DIR}/filesystem.o"
+compile_c -I. -Idrivers/io -c fs/fat32.c -o "${BUILD_DIR}/fat32.o"
+compile_c -I. -Idrivers/io -c fs/iso9660.c -o "${BUILD_DIR}/iso9660.o"
+compile_c -I. -Idrivers/io -c fs/ext2.c -o "${BUILD_DIR}/ext2.o"
+compile_c -I. -Idrivers/io -c fs/blockstore.c -o "${BUILD_DIR}/blockstore.o"
+compile_c -I. -Idrivers/io -c fs/compress.c -o "${BUILD_DIR}/fs_compress.o"
+compile_c -I. -Idrivers/io -c fs/initrd.c -o "${BUILD_DIR}/initrd.o"
+compile_c -I. -Idrivers/io -c fs/snapshot.c -o "${BUILD_DIR}/snapshot.o"
+compile_c -I. -Idrivers/io -c fs/procfs.c -o "${BUILD_DIR}/procfs.o"
 compile_c -I. -Idrivers/io -Itaskmgr -c shell/shell.c -o "${BUILD_DIR}/shell.o"
 compile_c -I. -Idrivers/io -c drivers/storage/bios_disk.c -o "${BUILD_DIR}/bios_disk.o"
+compile_c -I. -Idrivers/io -c drivers/storage/ata.c -o "${BUILD_DIR}/ata.o"
+compile_c -I. -Idrivers/io -c drivers/storage/atapi.c -o "${BUILD_DIR}/atapi.o"
+compile_c -I. -c drivers/storage/ahci.c -o "${BUILD_DIR}/ahci.o"
+compile_c -I. -c drivers/storage/virtio_blk.c -o "${BUILD_DIR}/virtio_blk.o"
+compile_c -I. -c drivers/storage/blkdev.c -o "${BUILD_DIR}/blkdev.o"
+compile_c -I. -c drivers/storage/bcache.c -o "${BUILD_DIR}/bcache.o"
+compile_c -I. -c drivers/storage/ioring.c -o "${BUILD_DIR}/ioring.o"
+compile_c -I. -c drivers/storage/partition.c -o "${BUILD_DIR}/partition.o"
 compile_c -I. -Idrivers/io -c games/snake.c -o "${BUILD_DIR}/snake.o"
 compile_c -I. -Idrivers/io -c games/cubeDip.c -o "${BUILD_DIR}/cubeDip.o"
 compile_c -I. -Idrivers/io -c games/pong.c -o "${BUILD_DIR}/pong.o"
@@ -68,13 +91,19 @@ compile_c -I. -Idrivers/io -Itaskmgr -c taskmgr/process.c -o "${BUILD_DIR}/proce
 compile_c -I. -Idrivers/io -Idrivers/video -Idrivers/mouse -Idrivers/keyboard -Ilib -c gui/window.c -o "${BUILD_DIR}/window.o"
 compile_c -I. -Idrivers/io -Idrivers/video -Idrivers/timer -Ifs -c editor/editor.c -o "${BUILD_DIR}/editor.o"
 
+# Host checksum tool and benchmark (cksum -b), built from the kernel's sources
+${HOST_CC} -O2 -o "${BUILD_DIR}/cksum" tools/cksum.c lib/crc32c.c lib/sha256.c
+
 rm -f "${BUILD_DIR}/osimage.o"
 if [ "${EMBED_INSTALL_ISO}" = "1" ]; then
   if [ ! -f GooberOSx86.iso ]; then
     echo "[-] GooberOSx86.iso not found for embedding."
     exit 1
   fi
-  ${LD} -r -b binary GooberOSx86.iso -o "${BUILD_DIR}/osimage.o"
+  # Embed the ISO frame-compressed; install unpacks it a frame at a time.
+  ${HOST_CC} -O2 -o "${BUILD_DIR}/lzpack" tools/lzpack.c lib/lz.c lib/lzimage.c
+  "${BUILD_DIR}/lzpack" GooberOSx86.iso "${BUILD_DIR}/GooberOSx86.iso.lz"
+  (cd "${BUILD_DIR}" && ${LD} -r -b binary GooberOSx86.iso.lz -o osimage.o)
 fi
 
 OSIMAGE_OBJ=""
@@ -88,6 +117,8 @@ ${LD} -m elf_i386 -T linker.ld --gc-sections -o "${BUILD_DIR}/kernel.bin" \
   "${BUILD_DIR}/gdt.o" \
   "${BUILD_DIR}/irq1_wrapper.o" \
   "${BUILD_DIR}/irq12_wrapper.o" \
+  "${BUILD_DIR}/irq14_wrapper.o" \
+  "${BUILD_DIR}/irq15_wrapper.o" \
   "${BUILD_DIR}/idt_load.o" \
   "${BUILD_DIR}/isr32_stub.o" \
   "${BUILD_DIR}/bios_int13.o" \
@@ -103,8 +134,24 @@ ${LD} -m elf_i386 -T linker.ld --gc-sections -o "${BUILD_DIR}/kernel.bin" \
   "${BUILD_DIR}/usb_enum.o" \
   "${BUILD_DIR}/usb.o" \
   "${BUILD_DIR}/filesystem.o" \
+  "${BUILD_DIR}/fat32.o" \
+  "${BUILD_DIR}/iso9660.o" \
+  "${BUILD_DIR}/ext2.o" \
+  "${BUILD_DIR}/blockstore.o" \
+  "${BUILD_DIR}/fs_compress.o" \
+  "${BUILD_DIR}/initrd.o" \
+  "${BUILD_DIR}/snapshot.o" \
+  "${BUILD_DIR}/procfs.o" \
   "${BUILD_DIR}/shell.o" \
   "${BUILD_DIR}/bios_disk.o" \
+  "${BUILD_DIR}/ata.o" \
+  "${BUILD_DIR}/atapi.o" \
+  "${BUILD_DIR}/ahci.o" \
+  "${BUILD_DIR}/virtio_blk.o" \
+  "${BUILD_DIR}/blkdev.o" \
+  "${BUILD_DIR}/bcache.o" \
+  "${BUILD_DIR}/ioring.o" \
+  "${BUILD_DIR}/partition.o" \
   "${BUILD_DIR}/snake.o" \
   "${BUILD_DIR}/cubeDip.o" \
   "${BUILD_DIR}/pong.o" \
@@ -115,6 +162,10 @@ ${LD} -m elf_i386 -T linker.ld --gc-sections -o "${BUILD_DIR}/kernel.bin" \
   "${BUILD_DIR}/window.o" \
   ${OSIMAGE_OBJ} \
   "${BUILD_DIR}/memory.o" \
+  "${BUILD_DIR}/crc32c.o" \
+  "${BUILD_DIR}/sha256.o" \
+  "${BUILD_DIR}/lz.o" \
+  "${BUILD_DIR}/lzimage.o" \
   "${BUILD_DIR}/string.o" \
   "${BUILD_DIR}/kernel.o"
 
@@ -125,6 +176,16 @@ mkdir -p "${ISO_DIR}/boot/grub"
 cp "${BUILD_DIR}/kernel.bin" "${ISO_DIR}/boot/"
 cp grub/grub.cfg "${ISO_DIR}/boot/grub/"
 
+# Pack initrd/ as a ustar archive; GRUB loads it as a multiboot module
+tar --format=ustar --owner=0 --group=0 -cf "${ISO_DIR}/boot/initrd.tar" -C initrd .
+echo "[+] initrd packed: ${ISO_DIR}/boot/initrd.tar"
+
+# Files under assets/ stay on the CD and are read at run time from /cdrom
+if [ -d assets ]; then
+  rm -rf "${ISO_DIR}/assets"
+  cp -r assets "${ISO_DIR}/assets"
+fi
+
 # Create ISO image
 grub-mkrescue -o GooberOSx86.iso "${ISO_DIR}/" --modules="biosdisk part_msdos" --directory=/usr/lib/grub/i386-pc/
 echo "[+] ISO created: GooberOSx86.iso"
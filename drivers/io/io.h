@@ -33,4 +33,12 @@ static inline uint32_t inl(uint16_t port) {
     return ret;
 }
 
+static inline void insw(uint16_t port, void* buf, uint32_t count) {
+    __asm__ volatile ("cld; rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* buf, uint32_t count) {
+    __asm__ volatile ("cld; rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
 #endif
@@ -71,6 +71,34 @@ int pci_find_usb_controllers(usb_pci_controller_t* out, int max_out) {
     return found;
 }
 
+// Lists every present function on every bus. Returns the total found, which
+// may exceed `max_out`.
+int pci_enumerate(pci_device_t* out, int max_out) {
+    int found = 0;
+
+    for (uint16_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            for (uint8_t func = 0; func < 8; func++) {
+                uint32_t id = pci_read_config_dword(bus, slot, func, 0);
+                if ((id & 0xFFFF) == 0xFFFF) continue;
+                if (out && found < max_out) {
+                    uint32_t class_code = pci_read_config_dword(bus, slot, func, 0x08);
+                    out[found].bus = bus;
+                    out[found].slot = slot;
+                    out[found].func = func;
+                    out[found].base_class = (class_code >> 24) & 0xFF;
+                    out[found].sub_class = (class_code >> 16) & 0xFF;
+                    out[found].prog_if = (class_code >> 8) & 0xFF;
+                    out[found].vendor_id = (uint16_t)(id & 0xFFFF);
+                    out[found].device_id = (uint16_t)((id >> 16) & 0xFFFF);
+                }
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
 static void pci_check_usb(void) {
     usb_pci_controller_t controllers[8];
     int found = pci_find_usb_controllers(controllers, 8);
@@ -0,0 +1,435 @@
+#include "ahci.h"
+#include "../pci/pci.h"
+#include "../timer/timer.h"
+
+// AHCI SATA driver. Each disk gets its own command list, received-FIS area
+// and a command table per slot. With NCQ a large request is cut into
+// AHCI_MAX_PER_CMD-sector pieces and up to `depth` of them are queued at
+// once as READ/WRITE FPDMA QUEUED; drives without NCQ get one READ/WRITE
+// DMA EXT at a time. Completion is polled from the port registers: the
+// blocking calls spin on them, while a transfer begun with ahci_start is
+// advanced by ahci_poll, which only looks at the command-issue bits and
+// returns at once.
+
+#define HBA_CAP        0x00
+#define HBA_GHC        0x04
+#define HBA_PI         0x0C
+#define HBA_CAP_SNCQ   (1u << 30)
+#define HBA_GHC_AE     (1u << 31)
+
+#define PORT_BASE(p)   (0x100 + (p) * 0x80)
+#define PORT_CLB       0x00
+#define PORT_CLBU      0x04
+#define PORT_FB        0x08
+#define PORT_FBU       0x0C
+#define PORT_IS        0x10
+#define PORT_IE        0x14
+#define PORT_CMD       0x18
+#define PORT_TFD       0x20
+#define PORT_SIG       0x24
+#define PORT_SSTS      0x28
+#define PORT_SERR      0x30
+#define PORT_SACT      0x34
+#define PORT_CI        0x38
+
+#define PORT_CMD_ST    (1u << 0)
+#define PORT_CMD_FRE   (1u << 4)
+#define PORT_CMD_FR    (1u << 14)
+#define PORT_CMD_CR    (1u << 15)
+#define PORT_IS_TFES   (1u << 30)
+#define PORT_TFD_ERR   0x01
+#define PORT_TFD_BUSY  0x88    // BSY | DRQ
+
+#define SATA_SIG_ATA   0x00000101u
+#define SSTS_DET_OK    3
+
+#define FIS_TYPE_REG_H2D 0x27
+
+#define ATA_CMD_READ_DMA_EXT     0x25
+#define ATA_CMD_WRITE_DMA_EXT    0x35
+#define ATA_CMD_READ_FPDMA       0x60
+#define ATA_CMD_WRITE_FPDMA      0x61
+#define ATA_CMD_FLUSH_CACHE_EXT  0xEA
+#define ATA_CMD_IDENTIFY         0xEC
+
+#define AHCI_SLOTS        32
+#define AHCI_MAX_PER_CMD  128   // sectors per command: 64K, one PRD entry
+#define AHCI_TIMEOUT      10000000
+#define AHCI_ASYNC_TIMEOUT_TICKS 500    // 5 s at 100 Hz
+
+typedef struct {
+    uint32_t flags;     // CFL in dwords, W, PRDTL in the top half
+    uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} ahci_cmd_header_t;
+
+typedef struct {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;       // byte count - 1, bit 31 = interrupt on completion
+} ahci_prd_t;
+
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[1];
+    uint8_t pad[112];   // keeps every table 128-byte aligned
+} ahci_cmd_table_t;
+
+typedef struct {
+    ahci_cmd_header_t headers[AHCI_SLOTS];
+} ahci_cmd_list_t;
+
+static ahci_cmd_list_t cmd_lists[AHCI_MAX_DEVICES] __attribute__((aligned(1024)));
+static uint8_t fis_areas[AHCI_MAX_DEVICES][256] __attribute__((aligned(256)));
+static ahci_cmd_table_t cmd_tables[AHCI_MAX_DEVICES][AHCI_SLOTS] __attribute__((aligned(128)));
+static uint16_t identify_buf[256] __attribute__((aligned(2)));
+
+// A transfer being worked through batch by batch. `mask` holds the slots
+// of the batch in flight.
+typedef struct {
+    uint64_t lba;
+    uint32_t remaining;
+    uint8_t* buf;
+    int write;
+    uint32_t mask;
+} ahci_job_t;
+
+// Background transfer on a device, see ahci_start.
+typedef struct {
+    int busy;
+    ahci_job_t job;
+    uint32_t issued_at;
+    bios_disk_done_t done;
+    void* ctx;
+} ahci_async_t;
+
+static ahci_device_t devices[AHCI_MAX_DEVICES];
+static ahci_async_t async_req[AHCI_MAX_DEVICES];
+static int device_count = 0;
+static int probed = 0;
+static volatile uint8_t* abar = 0;
+static uint32_t hba_slots = 1;
+
+static uint32_t hba_read(uint32_t reg) {
+    return *(volatile uint32_t*)(abar + reg);
+}
+
+static void hba_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(abar + reg) = value;
+}
+
+static uint32_t port_read(int port, uint32_t reg) {
+    return hba_read(PORT_BASE(port) + reg);
+}
+
+static void port_write(int port, uint32_t reg, uint32_t value) {
+    hba_write(PORT_BASE(port) + reg, value);
+}
+
+static int port_wait_clear(int port, uint32_t reg, uint32_t bits) {
+    for (uint32_t i = 0; i < AHCI_TIMEOUT; i++) {
+        if (!(port_read(port, reg) & bits)) return 0;
+    }
+    return -1;
+}
+
+static int port_stop(int port) {
+    port_write(port, PORT_CMD, port_read(port, PORT_CMD) & ~PORT_CMD_ST);
+    if (port_wait_clear(port, PORT_CMD, PORT_CMD_CR) != 0) return -1;
+    port_write(port, PORT_CMD, port_read(port, PORT_CMD) & ~PORT_CMD_FRE);
+    return port_wait_clear(port, PORT_CMD, PORT_CMD_FR);
+}
+
+static int port_start(int port) {
+    if (port_wait_clear(port, PORT_CMD, PORT_CMD_CR) != 0) return -1;
+    port_write(port, PORT_CMD, port_read(port, PORT_CMD) | PORT_CMD_FRE);
+    port_write(port, PORT_CMD, port_read(port, PORT_CMD) | PORT_CMD_ST);
+    return 0;
+}
+
+static int port_setup(int index, int port) {
+    if (port_stop(port) != 0) return -1;
+    port_write(port, PORT_CLB, (uint32_t)(uintptr_t)&cmd_lists[index]);
+    port_write(port, PORT_CLBU, 0);
+    port_write(port, PORT_FB, (uint32_t)(uintptr_t)fis_areas[index]);
+    port_write(port, PORT_FBU, 0);
+    for (int s = 0; s < AHCI_SLOTS; s++) {
+        ahci_cmd_header_t* h = &cmd_lists[index].headers[s];
+        h->flags = 0;
+        h->prdbc = 0;
+        h->ctba = (uint32_t)(uintptr_t)&cmd_tables[index][s];
+        h->ctbau = 0;
+    }
+    port_write(port, PORT_SERR, 0xFFFFFFFFu);
+    port_write(port, PORT_IS, 0xFFFFFFFFu);
+    port_write(port, PORT_IE, 0);
+    return port_start(port);
+}
+
+// Fills slot `slot` with a host-to-device register FIS and, when `buf` is
+// set, one PRD entry covering `bytes`.
+static void build_command(int index, int slot, uint8_t cmd, uint64_t lba, uint32_t count,
+                          void* buf, uint32_t bytes, int write, int ncq) {
+    ahci_cmd_table_t* t = &cmd_tables[index][slot];
+    ahci_cmd_header_t* h = &cmd_lists[index].headers[slot];
+    uint8_t* fis = t->cfis;
+    for (int i = 0; i < 20; i++) fis[i] = 0;
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = 0x80;  // command, not control
+    fis[2] = cmd;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = 0x40;  // LBA mode
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+    if (ncq) {
+        // FPDMA commands carry the sector count in FEATURES and the tag in COUNT.
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)(slot << 3);
+    } else {
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+    }
+    uint32_t prdtl = 0;
+    if (buf && bytes) {
+        t->prdt[0].dba = (uint32_t)(uintptr_t)buf;
+        t->prdt[0].dbau = 0;
+        t->prdt[0].reserved = 0;
+        t->prdt[0].dbc = bytes - 1;
+        prdtl = 1;
+    }
+    h->flags = 5 | (write ? (1u << 6) : 0) | (prdtl << 16);
+    h->prdbc = 0;
+}
+
+// Checks, without waiting, whether every slot in `mask` has completed.
+// Returns 1 while any is still running, 0 once all are done, or -1 on a
+// task file error, after which the port is restarted so later commands
+// work.
+static int check_slots(int index, uint32_t mask, int ncq) {
+    int port = devices[index].port;
+    uint32_t busy = port_read(port, PORT_CI) | (ncq ? port_read(port, PORT_SACT) : 0);
+    if (port_read(port, PORT_IS) & PORT_IS_TFES) {
+        port_setup(index, port);
+        return -1;
+    }
+    if (busy & mask) return 1;
+    port_write(port, PORT_IS, port_read(port, PORT_IS));
+    return (port_read(port, PORT_TFD) & PORT_TFD_ERR) ? -1 : 0;
+}
+
+// Waits until every slot in `mask` has completed.
+static int wait_slots(int index, uint32_t mask, int ncq) {
+    for (uint32_t i = 0; i < AHCI_TIMEOUT; i++) {
+        int rc = check_slots(index, mask, ncq);
+        if (rc != 1) return rc;
+    }
+    port_setup(index, devices[index].port);
+    return -1;
+}
+
+static int run_single(int index, uint8_t cmd, uint64_t lba, uint32_t count, void* buf, uint32_t bytes, int write) {
+    int port = devices[index].port;
+    if (port_wait_clear(port, PORT_TFD, PORT_TFD_BUSY) != 0) return -1;
+    build_command(index, 0, cmd, lba, count, buf, bytes, write, 0);
+    port_write(port, PORT_CI, 1);
+    return wait_slots(index, 1, 0);
+}
+
+static void copy_model(ahci_device_t* d, const uint16_t* id) {
+    int len = 0;
+    for (int w = 27; w <= 46; w++) {
+        d->model[len++] = (char)(id[w] >> 8);
+        d->model[len++] = (char)(id[w] & 0xFF);
+    }
+    while (len > 0 && d->model[len - 1] == ' ') len--;
+    d->model[len] = '\0';
+}
+
+// Finds the first HBA (class 01h/06h), enables memory decoding and bus
+// mastering and returns its ABAR (BAR5), or 0.
+static uint32_t find_hba(void) {
+    pci_device_t pci[32];
+    int found = pci_enumerate(pci, 32);
+    for (int i = 0; i < found && i < 32; i++) {
+        const pci_device_t* p = &pci[i];
+        if (p->base_class != 0x01 || p->sub_class != 0x06) continue;
+        uint32_t bar5 = pci_read_config_dword(p->bus, p->slot, p->func, 0x24);
+        if (bar5 & 1) continue;
+        uint32_t cmd = pci_read_config_dword(p->bus, p->slot, p->func, 0x04);
+        pci_write_config_dword(p->bus, p->slot, p->func, 0x04, (cmd & 0xFFFF) | 0x06);
+        return bar5 & 0xFFFFFFF0u;
+    }
+    return 0;
+}
+
+int ahci_init(void) {
+    if (probed) return device_count;
+    probed = 1;
+    uint32_t base = find_hba();
+    if (!base) return 0;
+    abar = (volatile uint8_t*)(uintptr_t)base;
+    hba_write(HBA_GHC, hba_read(HBA_GHC) | HBA_GHC_AE);
+    uint32_t cap = hba_read(HBA_CAP);
+    hba_slots = ((cap >> 8) & 0x1F) + 1;
+    uint32_t implemented = hba_read(HBA_PI);
+
+    for (int port = 0; port < 32 && device_count < AHCI_MAX_DEVICES; port++) {
+        if (!(implemented & (1u << port))) continue;
+        if ((port_read(port, PORT_SSTS) & 0x0F) != SSTS_DET_OK) continue;
+        if (port_read(port, PORT_SIG) != SATA_SIG_ATA) continue;
+
+        int index = device_count;
+        ahci_device_t* d = &devices[index];
+        d->port = port;
+        if (port_setup(index, port) != 0) continue;
+        if (run_single(index, ATA_CMD_IDENTIFY, 0, 0, identify_buf, sizeof(identify_buf), 0) != 0) continue;
+        const uint16_t* id = identify_buf;
+        d->present = 1;
+        d->sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                     ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+        if (d->sectors == 0) d->sectors = (uint64_t)id[60] | ((uint64_t)id[61] << 16);
+        // Word 76 bit 8: NCQ supported; word 75 holds the queue depth - 1.
+        d->ncq = (cap & HBA_CAP_SNCQ) && (id[76] & (1 << 8));
+        d->depth = d->ncq ? (uint32_t)(id[75] & 0x1F) + 1 : 1;
+        if (d->depth > hba_slots) d->depth = hba_slots;
+        copy_model(d, id);
+        device_count++;
+    }
+    return device_count;
+}
+
+int ahci_device_count(void) {
+    return device_count;
+}
+
+const ahci_device_t* ahci_get_device(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return &devices[index];
+}
+
+// Issues the next batch of `job`: up to `depth` FPDMA commands with NCQ,
+// else one READ/WRITE DMA EXT. Returns -1 if the drive stays busy.
+static int issue_batch(int index, ahci_job_t* job) {
+    const ahci_device_t* d = &devices[index];
+    uint32_t slots = d->ncq ? d->depth : 1;
+    uint32_t mask = 0;
+    for (uint32_t slot = 0; slot < slots && job->remaining > 0; slot++) {
+        uint32_t n = job->remaining < AHCI_MAX_PER_CMD ? job->remaining : AHCI_MAX_PER_CMD;
+        uint8_t cmd = d->ncq ? (job->write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA)
+                             : (job->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+        build_command(index, (int)slot, cmd, job->lba, n, job->buf, n * AHCI_SECTOR_SIZE, job->write, d->ncq);
+        mask |= 1u << slot;
+        job->buf += n * AHCI_SECTOR_SIZE;
+        job->lba += n;
+        job->remaining -= n;
+    }
+    if (port_wait_clear(d->port, PORT_TFD, PORT_TFD_BUSY) != 0) return -1;
+    if (d->ncq) port_write(d->port, PORT_SACT, mask);
+    port_write(d->port, PORT_CI, mask);
+    job->mask = mask;
+    return 0;
+}
+
+static int check_range(int index, uint64_t lba, uint32_t count, const void* buf) {
+    const ahci_device_t* d = ahci_get_device(index);
+    if (!d || !d->present || count == 0 || !buf) return -1;
+    if (lba >= d->sectors || count > d->sectors - lba) return -1;
+    return 0;
+}
+
+static void async_finish(int index, int status) {
+    ahci_async_t* r = &async_req[index];
+    r->busy = 0;
+    r->done(r->ctx, status);
+}
+
+// Advances the background transfer on drive `index`: reaps the batch in
+// flight once its command-issue bits clear and issues the next. Never
+// waits. Returns 1 while the transfer is still running.
+int ahci_poll(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    ahci_async_t* r = &async_req[index];
+    if (!r->busy) return 0;
+    int rc = check_slots(index, r->job.mask, devices[index].ncq);
+    if (rc == 1 && timer_ticks() - r->issued_at >= AHCI_ASYNC_TIMEOUT_TICKS) {
+        port_setup(index, devices[index].port);
+        rc = -1;
+    }
+    if (rc == 1) return 1;
+    if (rc != 0) {
+        async_finish(index, -1);
+        return 0;
+    }
+    if (r->job.remaining == 0) {
+        async_finish(index, 0);
+        return 0;
+    }
+    if (issue_batch(index, &r->job) != 0) {
+        async_finish(index, -1);
+        return 0;
+    }
+    r->issued_at = timer_ticks();
+    return 1;
+}
+
+// Blocking calls must not touch the port while a background transfer
+// owns it; they drive it to completion first.
+static void wait_idle(int index) {
+    while (ahci_poll(index)) {
+    }
+}
+
+static int transfer(int index, uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (check_range(index, lba, count, buf) != 0) return -1;
+    wait_idle(index);
+    ahci_job_t job = { lba, count, buf, write, 0 };
+    while (job.remaining > 0) {
+        if (issue_batch(index, &job) != 0) return -1;
+        if (wait_slots(index, job.mask, devices[index].ncq) != 0) return -1;
+    }
+    return 0;
+}
+
+int ahci_read(int index, uint64_t lba, uint32_t count, void* out) {
+    return transfer(index, lba, count, (uint8_t*)out, 0);
+}
+
+int ahci_write(int index, uint64_t lba, uint32_t count, const void* in) {
+    if (transfer(index, lba, count, (uint8_t*)in, 1) != 0) return -1;
+    return ahci_flush(index);
+}
+
+// Begins a transfer that ahci_poll carries on; `done` runs from ahci_poll
+// (or from a blocking call on the same drive) once it ends. Writes are not
+// flushed; see ahci_flush. Returns -1 when the drive already has one.
+int ahci_start(int index, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx) {
+    if (check_range(index, lba, count, buf) != 0 || !done) return -1;
+    ahci_async_t* r = &async_req[index];
+    if (r->busy) return -1;
+    r->job.lba = lba;
+    r->job.remaining = count;
+    r->job.buf = (uint8_t*)buf;
+    r->job.write = write;
+    if (issue_batch(index, &r->job) != 0) return -1;
+    r->busy = 1;
+    r->issued_at = timer_ticks();
+    r->done = done;
+    r->ctx = ctx;
+    return 0;
+}
+
+int ahci_flush(int index) {
+    const ahci_device_t* d = ahci_get_device(index);
+    if (!d || !d->present) return -1;
+    wait_idle(index);
+    return run_single(index, ATA_CMD_FLUSH_CACHE_EXT, 0, 0, 0, 0, 0);
+}
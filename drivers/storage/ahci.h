@@ -0,0 +1,28 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include "bios_disk.h"
+
+#define AHCI_MAX_DEVICES 4
+#define AHCI_SECTOR_SIZE 512
+
+typedef struct {
+    int present;
+    int port;
+    uint64_t sectors;
+    int ncq;            // READ/WRITE FPDMA QUEUED usable
+    uint32_t depth;     // commands kept in flight (NCQ depth and HBA slots)
+    char model[41];
+} ahci_device_t;
+
+int ahci_init(void);
+int ahci_device_count(void);
+const ahci_device_t* ahci_get_device(int index);
+int ahci_read(int index, uint64_t lba, uint32_t count, void* out);
+int ahci_write(int index, uint64_t lba, uint32_t count, const void* in);
+int ahci_start(int index, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx);
+int ahci_poll(int index);
+int ahci_flush(int index);
+
+#endif
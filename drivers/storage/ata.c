@@ -0,0 +1,528 @@
+#include "ata.h"
+#include "../io/io.h"
+#include "../pci/pci.h"
+#include "../timer/timer.h"
+
+// Driver for the two legacy IDE channels. When the IDE controller can bus
+// master, transfers go by DMA through a PRD table and finish with a single
+// completion interrupt. Otherwise (or after a DMA error) they fall back to
+// polled PIO with interrupts masked through nIEN. ata_start runs a DMA
+// request in the background instead: each command is started from the
+// completion interrupt of the one before, and the caller's callback runs
+// from the last.
+
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DEVICE   6
+#define ATA_REG_STATUS   7
+#define ATA_REG_COMMAND  7
+
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_DF   0x20
+#define ATA_SR_BSY  0x80
+
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_CMD_READ_SECTORS      0x20
+#define ATA_CMD_READ_SECTORS_EXT  0x24
+#define ATA_CMD_READ_DMA_EXT      0x25
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_SECTORS     0x30
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT     0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE     0xC4
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_SET_MULTIPLE      0xC6
+#define ATA_CMD_READ_DMA          0xC8
+#define ATA_CMD_WRITE_DMA         0xCA
+#define ATA_CMD_FLUSH_CACHE       0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT   0xEA
+#define ATA_CMD_IDENTIFY          0xEC
+
+#define ATA_LBA28_LIMIT   0x10000000u
+#define ATA_MAX_PER_CMD   256
+#define ATA_MAX_MULTIPLE  16
+#define ATA_TIMEOUT       1000000
+// How long a sleeping DMA wait lasts, in timer ticks (5 s at 100 Hz).
+#define ATA_DMA_TIMEOUT_TICKS 500
+
+// Bus-master IDE registers, relative to each channel's block in BAR4.
+#define BM_REG_COMMAND 0
+#define BM_REG_STATUS  2
+#define BM_REG_PRDT    4
+#define BM_CMD_START   0x01
+#define BM_CMD_TO_MEM  0x08
+#define BM_SR_ACTIVE   0x01
+#define BM_SR_ERROR    0x02
+#define BM_SR_IRQ      0x04
+
+#define PRD_EOT        0x8000
+#define PRD_MAX        8
+#define DMA_BOUNDARY   0x10000u
+
+// DMA setup result for a buffer the PRD table cannot describe. The
+// request goes by PIO; the device itself is fine.
+#define ATA_DMA_UNSUITABLE (-2)
+
+// One physical region: the controller requires each to stay within a 64K
+// boundary, and the table itself must not cross one either, which the
+// 256-byte alignment guarantees.
+typedef struct {
+    uint32_t addr;
+    uint16_t bytes;   // 0 means 64K
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+static ata_prd_t prd_table[2][PRD_MAX] __attribute__((aligned(256)));
+
+// Background request in progress on a channel, see ata_start.
+typedef struct {
+    ata_device_t* dev;
+    uint64_t lba;
+    uint32_t remaining;
+    uint32_t chunk;     // sectors in the command now running
+    uint8_t* buf;
+    int to_mem;
+    bios_disk_done_t done;
+    void* ctx;
+} ata_async_t;
+
+static ata_async_t async_req[2];
+static volatile int channel_busy[2];
+
+static ata_device_t devices[ATA_MAX_DEVICES];
+static int device_count = 0;
+static int probed = 0;
+
+static const uint16_t channel_io[2] = { 0x1F0, 0x170 };
+static const uint16_t channel_ctrl[2] = { 0x3F6, 0x376 };
+
+// Reading the alternate status register four times gives the drive the
+// 400ns it needs after a select or command.
+static void ata_delay(const ata_device_t* d) {
+    for (int i = 0; i < 4; i++) (void)inb(d->ctrl_base);
+}
+
+static int ata_wait(const ata_device_t* d, int need_drq) {
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++) {
+        uint8_t status = inb(d->io_base + ATA_REG_STATUS);
+        if (status & ATA_SR_BSY) continue;
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+        if (!need_drq || (status & ATA_SR_DRQ)) return 0;
+    }
+    return -1;
+}
+
+static void ata_select(const ata_device_t* d, uint8_t bits) {
+    outb(d->io_base + ATA_REG_DEVICE, (uint8_t)(bits | (d->slave << 4)));
+    ata_delay(d);
+}
+
+static void ata_copy_model(ata_device_t* d, const uint16_t* id) {
+    int len = 0;
+    for (int w = 27; w <= 46; w++) {
+        d->model[len++] = (char)(id[w] >> 8);
+        d->model[len++] = (char)(id[w] & 0xFF);
+    }
+    while (len > 0 && d->model[len - 1] == ' ') len--;
+    d->model[len] = '\0';
+}
+
+// Issues IDENTIFY DEVICE. Returns -1 for an empty position and for packet
+// (ATAPI) or SATA devices, which report a signature instead of data; packet
+// devices are picked up by atapi.c.
+static int ata_identify(ata_device_t* d, uint16_t* id) {
+    ata_select(d, 0xA0);
+    outb(d->io_base + ATA_REG_COUNT, 0);
+    outb(d->io_base + ATA_REG_LBA0, 0);
+    outb(d->io_base + ATA_REG_LBA1, 0);
+    outb(d->io_base + ATA_REG_LBA2, 0);
+    outb(d->io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(d);
+    if (inb(d->io_base + ATA_REG_STATUS) == 0) return -1;
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++) {
+        if (!(inb(d->io_base + ATA_REG_STATUS) & ATA_SR_BSY)) break;
+    }
+    if (inb(d->io_base + ATA_REG_LBA1) != 0 || inb(d->io_base + ATA_REG_LBA2) != 0) return -1;
+    if (ata_wait(d, 1) != 0) return -1;
+    insw(d->io_base + ATA_REG_DATA, id, 256);
+    return 0;
+}
+
+// Picks the largest power of two the drive allows (up to ATA_MAX_MULTIPLE)
+// for READ/WRITE MULTIPLE.
+static void ata_set_multiple(ata_device_t* d, const uint16_t* id) {
+    uint16_t max = id[47] & 0xFF;
+    uint16_t n = 1;
+    d->multiple = 0;
+    if (max < 2) return;
+    while (n * 2 <= max && n * 2 <= ATA_MAX_MULTIPLE) n *= 2;
+    ata_select(d, 0xA0);
+    outb(d->io_base + ATA_REG_COUNT, (uint8_t)n);
+    outb(d->io_base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_delay(d);
+    if (ata_wait(d, 0) == 0) d->multiple = n;
+}
+
+// Finds a bus-mastering IDE controller (class 01h/01h, prog-if bit 7) and
+// enables bus mastering on it. Returns the BAR4 I/O base or 0.
+static uint16_t ata_find_bus_master(void) {
+    pci_device_t pci[32];
+    int found = pci_enumerate(pci, 32);
+    for (int i = 0; i < found && i < 32; i++) {
+        const pci_device_t* p = &pci[i];
+        if (p->base_class != 0x01 || p->sub_class != 0x01 || !(p->prog_if & 0x80)) continue;
+        uint32_t bar4 = pci_read_config_dword(p->bus, p->slot, p->func, 0x20);
+        if (!(bar4 & 1)) continue;
+        uint32_t cmd = pci_read_config_dword(p->bus, p->slot, p->func, 0x04);
+        pci_write_config_dword(p->bus, p->slot, p->func, 0x04, (cmd & 0xFFFF) | 0x05);
+        return (uint16_t)(bar4 & 0xFFFC);
+    }
+    return 0;
+}
+
+static int ata_channel(const ata_device_t* d) {
+    return d->io_base == channel_io[0] ? 0 : 1;
+}
+
+int ata_init(void) {
+    static uint16_t id[256];
+    if (probed) return device_count;
+    probed = 1;
+    device_count = 0;
+    for (int ch = 0; ch < 2; ch++) {
+        // A floating bus reads back 0xFF: no controller on this channel.
+        if (inb(channel_io[ch] + ATA_REG_STATUS) == 0xFF) continue;
+        outb(channel_ctrl[ch], ATA_CTRL_NIEN);
+        for (uint8_t slave = 0; slave < 2; slave++) {
+            ata_device_t* d = &devices[device_count];
+            d->io_base = channel_io[ch];
+            d->ctrl_base = channel_ctrl[ch];
+            d->slave = slave;
+            if (ata_identify(d, id) != 0) continue;
+            d->present = 1;
+            d->lba48 = (id[83] & (1 << 10)) != 0;
+            if (d->lba48) {
+                d->sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                             ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+            } else {
+                d->sectors = (uint64_t)id[60] | ((uint64_t)id[61] << 16);
+            }
+            ata_copy_model(d, id);
+            ata_set_multiple(d, id);
+            // Word 49 bit 8: the drive supports DMA.
+            d->dma = (id[49] & (1 << 8)) != 0;
+            device_count++;
+        }
+    }
+    uint16_t bm = device_count > 0 ? ata_find_bus_master() : 0;
+    for (int i = 0; i < device_count; i++) {
+        ata_device_t* d = &devices[i];
+        d->bm_base = bm ? (uint16_t)(bm + (ata_channel(d) ? 8 : 0)) : 0;
+        d->dma = d->dma && d->bm_base != 0;
+    }
+    return device_count;
+}
+
+int ata_device_count(void) {
+    return device_count;
+}
+
+const ata_device_t* ata_get_device(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return &devices[index];
+}
+
+static void ata_issue(const ata_device_t* d, uint64_t lba, uint32_t count, uint8_t cmd28, uint8_t cmd48) {
+    int use48 = d->lba48 && (lba + count > ATA_LBA28_LIMIT);
+    if (use48) {
+        ata_select(d, 0x40);
+        outb(d->io_base + ATA_REG_COUNT, (uint8_t)(count >> 8));
+        outb(d->io_base + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(d->io_base + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(d->io_base + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+    } else {
+        ata_select(d, (uint8_t)(0xE0 | ((lba >> 24) & 0x0F)));
+    }
+    outb(d->io_base + ATA_REG_COUNT, (uint8_t)count);
+    outb(d->io_base + ATA_REG_LBA0, (uint8_t)lba);
+    outb(d->io_base + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(d->io_base + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+    outb(d->io_base + ATA_REG_COMMAND, use48 ? cmd48 : cmd28);
+    ata_delay(d);
+}
+
+
+// Describes `bytes` at `buf` (identity mapped, word aligned) as PRD
+// entries, splitting wherever a region would cross a 64K boundary.
+static int ata_build_prd(int channel, const void* buf, uint32_t bytes) {
+    uint32_t addr = (uint32_t)(uintptr_t)buf;
+    int n = 0;
+    if (addr & 1) return ATA_DMA_UNSUITABLE;
+    while (bytes > 0) {
+        if (n == PRD_MAX) return ATA_DMA_UNSUITABLE;
+        uint32_t room = DMA_BOUNDARY - (addr & (DMA_BOUNDARY - 1));
+        uint32_t len = bytes < room ? bytes : room;
+        prd_table[channel][n].addr = addr;
+        prd_table[channel][n].bytes = (uint16_t)(len & 0xFFFF);
+        prd_table[channel][n].flags = 0;
+        addr += len;
+        bytes -= len;
+        n++;
+    }
+    prd_table[channel][n - 1].flags = PRD_EOT;
+    return 0;
+}
+
+static int interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+// Programs and starts one DMA command of `count` sectors (at most
+// ATA_MAX_PER_CMD).
+static int ata_dma_begin(const ata_device_t* d, uint64_t lba, uint32_t count, const void* buf, int to_mem) {
+    int ch = ata_channel(d);
+    uint16_t bm = d->bm_base;
+    int rc = ata_build_prd(ch, buf, count * ATA_SECTOR_SIZE);
+    if (rc != 0) return rc;
+
+    outb(bm + BM_REG_COMMAND, 0);
+    outl(bm + BM_REG_PRDT, (uint32_t)(uintptr_t)prd_table[ch]);
+    outb(bm + BM_REG_STATUS, BM_SR_ERROR | BM_SR_IRQ);
+    outb(bm + BM_REG_COMMAND, to_mem ? BM_CMD_TO_MEM : 0);
+    outb(d->ctrl_base, 0);
+    if (to_mem) ata_issue(d, lba, count, ATA_CMD_READ_DMA, ATA_CMD_READ_DMA_EXT);
+    else ata_issue(d, lba, count, ATA_CMD_WRITE_DMA, ATA_CMD_WRITE_DMA_EXT);
+    outb(bm + BM_REG_COMMAND, (to_mem ? BM_CMD_TO_MEM : 0) | BM_CMD_START);
+    return 0;
+}
+
+// Stops the engine after a command and reports how it ended, given the
+// bus-master status that signalled completion.
+static int ata_dma_end(const ata_device_t* d, uint8_t status) {
+    uint16_t bm = d->bm_base;
+    outb(bm + BM_REG_COMMAND, 0);
+    outb(bm + BM_REG_STATUS, BM_SR_ERROR | BM_SR_IRQ);
+    outb(d->ctrl_base, ATA_CTRL_NIEN);
+    uint8_t drive_status = inb(d->io_base + ATA_REG_STATUS);
+    if (!(status & BM_SR_IRQ) || (status & BM_SR_ERROR)) return -1;
+    if (drive_status & (ATA_SR_ERR | ATA_SR_DF | ATA_SR_BSY)) return -1;
+    return 0;
+}
+
+// Runs one DMA command and waits for it. The completion interrupt sets
+// BM_SR_IRQ. When interrupts are on, the flag is checked with them masked
+// and `sti; hlt` sleeps, so the interrupt cannot slip in between the check
+// and the halt; the wait is bounded in timer ticks. During early boot,
+// with interrupts off, the status is polled instead.
+static int ata_dma(const ata_device_t* d, uint64_t lba, uint32_t count, const void* buf, int to_mem) {
+    int rc = ata_dma_begin(d, lba, count, buf, to_mem);
+    if (rc != 0) return rc;
+    uint8_t status = 0;
+    if (!interrupts_enabled()) {
+        for (uint32_t i = 0; i < ATA_TIMEOUT; i++) {
+            status = inb(d->bm_base + BM_REG_STATUS);
+            if (status & (BM_SR_IRQ | BM_SR_ERROR)) break;
+        }
+        return ata_dma_end(d, status);
+    }
+    uint32_t start = timer_ticks();
+    for (;;) {
+        __asm__ volatile ("cli");
+        status = inb(d->bm_base + BM_REG_STATUS);
+        if (status & (BM_SR_IRQ | BM_SR_ERROR)) break;
+        if (timer_ticks() - start >= ATA_DMA_TIMEOUT_TICKS) break;
+        __asm__ volatile ("sti; hlt");
+    }
+    __asm__ volatile ("sti");
+    return ata_dma_end(d, status);
+}
+
+// Synchronous commands must not touch a channel while a background
+// request owns it.
+static void ata_wait_idle(const ata_device_t* d) {
+    int ch = ata_channel(d);
+    if (!interrupts_enabled()) return;
+    while (channel_busy[ch]) __asm__ volatile ("hlt");
+}
+
+// The same for other drivers sharing the channel (ATAPI).
+void ata_wait_channel(uint16_t io_base) {
+    int ch = io_base == channel_io[0] ? 0 : 1;
+    if (!interrupts_enabled()) return;
+    while (channel_busy[ch]) __asm__ volatile ("hlt");
+}
+
+static void ata_async_next(int ch) {
+    ata_async_t* r = &async_req[ch];
+    r->chunk = r->remaining < ATA_MAX_PER_CMD ? r->remaining : ATA_MAX_PER_CMD;
+    if (ata_dma_begin(r->dev, r->lba, r->chunk, r->buf, r->to_mem) != 0) {
+        channel_busy[ch] = 0;
+        r->done(r->ctx, -1);
+    }
+}
+
+int ata_start(int index, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx) {
+    ata_device_t* d = (index >= 0 && index < device_count) ? &devices[index] : 0;
+    if (!d || !d->present || !d->dma || !buf || !done) return -1;
+    if (lba >= d->sectors || count == 0 || count > d->sectors - lba) return -1;
+    if (!d->lba48 && lba + count > ATA_LBA28_LIMIT) return -1;
+    // The bus master needs word-aligned memory; such buffers go the
+    // synchronous way, which falls back to PIO.
+    if ((uintptr_t)buf & 1) return -1;
+    // Completion needs the interrupt; without it the caller does the work
+    // synchronously instead.
+    if (!interrupts_enabled()) return -1;
+    int ch = ata_channel(d);
+    __asm__ volatile ("cli");
+    if (channel_busy[ch]) {
+        __asm__ volatile ("sti");
+        return -1;
+    }
+    channel_busy[ch] = 1;
+    ata_async_t* r = &async_req[ch];
+    r->dev = d;
+    r->lba = lba;
+    r->remaining = count;
+    r->buf = (uint8_t*)buf;
+    r->to_mem = !write;
+    r->done = done;
+    r->ctx = ctx;
+    ata_async_next(ch);
+    __asm__ volatile ("sti");
+    return 0;
+}
+
+void ata_irq(int channel) {
+    if (channel < 0 || channel > 1) return;
+    ata_async_t* r = &async_req[channel];
+    if (!channel_busy[channel]) {
+        // Reading status acknowledges the drive's interrupt.
+        (void)inb(channel_io[channel] + ATA_REG_STATUS);
+        return;
+    }
+    uint8_t status = inb(r->dev->bm_base + BM_REG_STATUS);
+    if (!(status & (BM_SR_IRQ | BM_SR_ERROR))) {
+        (void)inb(channel_io[channel] + ATA_REG_STATUS);
+        return;
+    }
+    if (ata_dma_end(r->dev, status) != 0) {
+        channel_busy[channel] = 0;
+        r->done(r->ctx, -1);
+        return;
+    }
+    r->buf += r->chunk * ATA_SECTOR_SIZE;
+    r->lba += r->chunk;
+    r->remaining -= r->chunk;
+    if (r->remaining > 0) {
+        ata_async_next(channel);
+        return;
+    }
+    channel_busy[channel] = 0;
+    r->done(r->ctx, 0);
+}
+
+// Moves a whole request by DMA. On failure the caller redoes the request
+// with PIO. Only an error from the device or controller switches DMA off
+// for the device; a buffer DMA cannot reach just sends this request by PIO.
+static int ata_dma_transfer(ata_device_t* d, uint64_t lba, uint32_t count, const uint8_t* buf, int to_mem) {
+    while (count > 0) {
+        uint32_t n = count < ATA_MAX_PER_CMD ? count : ATA_MAX_PER_CMD;
+        int rc = ata_dma(d, lba, n, buf, to_mem);
+        if (rc != 0) {
+            if (rc != ATA_DMA_UNSUITABLE) d->dma = 0;
+            return -1;
+        }
+        buf += n * ATA_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static int ata_check_range(const ata_device_t* d, uint64_t lba, uint32_t count) {
+    if (!d || !d->present || count == 0) return -1;
+    if (lba >= d->sectors || count > d->sectors - lba) return -1;
+    if (!d->lba48 && lba + count > ATA_LBA28_LIMIT) return -1;
+    return 0;
+}
+
+static void ata_flush(const ata_device_t* d, int lba48) {
+    ata_select(d, 0xE0);
+    outb(d->io_base + ATA_REG_COMMAND, lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+    ata_delay(d);
+    (void)ata_wait(d, 0);
+}
+
+// In PIO mode each command moves up to ATA_MAX_PER_CMD sectors; with
+// multiple mode on, the drive raises DRQ once per `multiple` sectors
+// instead of once each.
+int ata_read(int index, uint64_t lba, uint32_t count, void* out) {
+    ata_device_t* d = (index >= 0 && index < device_count) ? &devices[index] : 0;
+    uint16_t* buf = (uint16_t*)out;
+    if (ata_check_range(d, lba, count) != 0 || !out) return -1;
+    ata_wait_idle(d);
+    if (d->dma && ata_dma_transfer(d, lba, count, (const uint8_t*)out, 1) == 0) return 0;
+    uint32_t per_drq = d->multiple ? d->multiple : 1;
+    while (count > 0) {
+        uint32_t n = count < ATA_MAX_PER_CMD ? count : ATA_MAX_PER_CMD;
+        if (d->multiple) ata_issue(d, lba, n, ATA_CMD_READ_MULTIPLE, ATA_CMD_READ_MULTIPLE_EXT);
+        else ata_issue(d, lba, n, ATA_CMD_READ_SECTORS, ATA_CMD_READ_SECTORS_EXT);
+        for (uint32_t left = n; left > 0;) {
+            uint32_t block = left < per_drq ? left : per_drq;
+            if (ata_wait(d, 1) != 0) return -1;
+            insw(d->io_base + ATA_REG_DATA, buf, block * (ATA_SECTOR_SIZE / 2));
+            buf += block * (ATA_SECTOR_SIZE / 2);
+            left -= block;
+        }
+        lba += n;
+        count -= n;
+    }
+    return ata_wait(d, 0);
+}
+
+int ata_write(int index, uint64_t lba, uint32_t count, const void* in) {
+    ata_device_t* d = (index >= 0 && index < device_count) ? &devices[index] : 0;
+    const uint16_t* buf = (const uint16_t*)in;
+    if (ata_check_range(d, lba, count) != 0 || !in) return -1;
+    ata_wait_idle(d);
+    int lba48 = d->lba48 && lba + count > ATA_LBA28_LIMIT;
+    if (d->dma && ata_dma_transfer(d, lba, count, (const uint8_t*)in, 0) == 0) {
+        ata_flush(d, lba48);
+        return 0;
+    }
+    uint32_t per_drq = d->multiple ? d->multiple : 1;
+    while (count > 0) {
+        uint32_t n = count < ATA_MAX_PER_CMD ? count : ATA_MAX_PER_CMD;
+        if (d->multiple) ata_issue(d, lba, n, ATA_CMD_WRITE_MULTIPLE, ATA_CMD_WRITE_MULTIPLE_EXT);
+        else ata_issue(d, lba, n, ATA_CMD_WRITE_SECTORS, ATA_CMD_WRITE_SECTORS_EXT);
+        for (uint32_t left = n; left > 0;) {
+            uint32_t block = left < per_drq ? left : per_drq;
+            if (ata_wait(d, 1) != 0) return -1;
+            outsw(d->io_base + ATA_REG_DATA, buf, block * (ATA_SECTOR_SIZE / 2));
+            buf += block * (ATA_SECTOR_SIZE / 2);
+            left -= block;
+        }
+        if (ata_wait(d, 0) != 0) return -1;
+        lba += n;
+        count -= n;
+    }
+    ata_flush(d, lba48);
+    return 0;
+}
+
+int ata_flush_cache(int index) {
+    ata_device_t* d = (index >= 0 && index < device_count) ? &devices[index] : 0;
+    if (!d || !d->present) return -1;
+    ata_wait_idle(d);
+    ata_flush(d, d->lba48);
+    return 0;
+}
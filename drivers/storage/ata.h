@@ -0,0 +1,33 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+#include "bios_disk.h"
+
+#define ATA_MAX_DEVICES 4
+#define ATA_SECTOR_SIZE 512
+
+typedef struct {
+    int present;
+    uint16_t io_base;
+    uint16_t ctrl_base;
+    uint8_t slave;
+    int lba48;
+    uint64_t sectors;
+    uint16_t multiple;  // sectors per DRQ block once SET MULTIPLE succeeded, else 0
+    uint16_t bm_base;   // bus-master register block for this channel, 0 without DMA
+    int dma;
+    char model[41];
+} ata_device_t;
+
+int ata_init(void);
+int ata_device_count(void);
+const ata_device_t* ata_get_device(int index);
+int ata_read(int index, uint64_t lba, uint32_t count, void* out);
+int ata_write(int index, uint64_t lba, uint32_t count, const void* in);
+int ata_start(int index, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx);
+int ata_flush_cache(int index);
+void ata_wait_channel(uint16_t io_base);
+void ata_irq(int channel);
+
+#endif
@@ -0,0 +1,244 @@
+#include "atapi.h"
+#include "ata.h"
+#include "../io/io.h"
+
+// Packet (ATAPI) devices on the legacy IDE channels, i.e. CD/DVD drives.
+// Commands go out as 12-byte SCSI packets with PACKET and data moves by
+// polled PIO, one DRQ block of up to ATAPI_BYTE_LIMIT bytes at a time. Only
+// READ CAPACITY and READ(10) are used. To the rest of the kernel each drive
+// looks like a read-only disk with 512-byte sectors: requests are mapped
+// onto 2048-byte blocks, with partial blocks at either end read through a
+// bounce buffer.
+
+#define ATA_REG_DATA     0
+#define ATA_REG_FEATURES 1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DEVICE   6
+#define ATA_REG_STATUS   7
+#define ATA_REG_COMMAND  7
+
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_DF   0x20
+#define ATA_SR_BSY  0x80
+
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_CMD_PACKET          0xA0
+#define ATA_CMD_IDENTIFY_PACKET 0xA1
+#define ATA_CMD_IDENTIFY        0xEC
+
+#define SCSI_READ_CAPACITY 0x25
+#define SCSI_READ_10       0x28
+
+#define ATAPI_SIG_LBA1 0x14
+#define ATAPI_SIG_LBA2 0xEB
+
+#define ATAPI_BYTE_LIMIT  0xF800    // largest multiple of 2048 below 64K
+#define ATAPI_MAX_PER_CMD 32        // blocks per READ(10): 64 KB
+#define ATAPI_TIMEOUT     4000000
+#define ATAPI_RETRIES     2
+
+#define SECTORS_PER_BLOCK (ATAPI_BLOCK_SIZE / ATAPI_SECTOR_SIZE)
+
+static atapi_device_t devices[ATAPI_MAX_DEVICES];
+static int device_count = 0;
+static int probed = 0;
+static uint8_t bounce[ATAPI_BLOCK_SIZE];
+
+static const uint16_t channel_io[2] = { 0x1F0, 0x170 };
+static const uint16_t channel_ctrl[2] = { 0x3F6, 0x376 };
+
+static void atapi_delay(const atapi_device_t* d) {
+    for (int i = 0; i < 4; i++) (void)inb(d->ctrl_base);
+}
+
+static int atapi_wait(const atapi_device_t* d, int need_drq) {
+    for (uint32_t i = 0; i < ATAPI_TIMEOUT; i++) {
+        uint8_t status = inb(d->io_base + ATA_REG_STATUS);
+        if (status & ATA_SR_BSY) continue;
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+        if (!need_drq || (status & ATA_SR_DRQ)) return 0;
+    }
+    return -1;
+}
+
+static void atapi_select(const atapi_device_t* d) {
+    outb(d->io_base + ATA_REG_DEVICE, (uint8_t)(0xA0 | (d->slave << 4)));
+    atapi_delay(d);
+}
+
+// A packet device aborts IDENTIFY DEVICE and leaves its signature in the
+// LBA registers; it then answers IDENTIFY PACKET DEVICE instead.
+static int atapi_identify(atapi_device_t* d, uint16_t* id) {
+    atapi_select(d);
+    outb(d->io_base + ATA_REG_LBA1, 0);
+    outb(d->io_base + ATA_REG_LBA2, 0);
+    outb(d->io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    atapi_delay(d);
+    if (inb(d->io_base + ATA_REG_STATUS) == 0) return -1;
+    for (uint32_t i = 0; i < ATAPI_TIMEOUT; i++) {
+        if (!(inb(d->io_base + ATA_REG_STATUS) & ATA_SR_BSY)) break;
+    }
+    if (inb(d->io_base + ATA_REG_LBA1) != ATAPI_SIG_LBA1 || inb(d->io_base + ATA_REG_LBA2) != ATAPI_SIG_LBA2) {
+        return -1;
+    }
+    outb(d->io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
+    atapi_delay(d);
+    if (atapi_wait(d, 1) != 0) return -1;
+    insw(d->io_base + ATA_REG_DATA, id, 256);
+    return 0;
+}
+
+// Sends one packet command and reads up to `bytes` of data into `out`.
+static int atapi_packet(const atapi_device_t* d, const uint8_t packet[12], void* out, uint32_t bytes) {
+    uint8_t* p = (uint8_t*)out;
+    ata_wait_channel(d->io_base);
+    outb(d->ctrl_base, ATA_CTRL_NIEN);
+    atapi_select(d);
+    if (atapi_wait(d, 0) != 0) return -1;
+    outb(d->io_base + ATA_REG_FEATURES, 0);     // PIO, not DMA
+    outb(d->io_base + ATA_REG_LBA1, (uint8_t)(ATAPI_BYTE_LIMIT & 0xFF));
+    outb(d->io_base + ATA_REG_LBA2, (uint8_t)(ATAPI_BYTE_LIMIT >> 8));
+    outb(d->io_base + ATA_REG_COMMAND, ATA_CMD_PACKET);
+    atapi_delay(d);
+    if (atapi_wait(d, 1) != 0) return -1;
+    outsw(d->io_base + ATA_REG_DATA, packet, 6);
+    atapi_delay(d);
+    for (;;) {
+        if (atapi_wait(d, 0) != 0) return -1;
+        if (!(inb(d->io_base + ATA_REG_STATUS) & ATA_SR_DRQ)) break;
+        uint32_t n = inb(d->io_base + ATA_REG_LBA1) | ((uint32_t)inb(d->io_base + ATA_REG_LBA2) << 8);
+        if (n == 0 || n > bytes || (n & 1)) return -1;
+        insw(d->io_base + ATA_REG_DATA, p, n / 2);
+        p += n;
+        bytes -= n;
+        atapi_delay(d);
+    }
+    return bytes == 0 ? 0 : -1;
+}
+
+// Refreshes the capacity; fails (leaving 0 blocks) when no disc is in.
+static int atapi_read_capacity(atapi_device_t* d) {
+    uint8_t packet[12] = { SCSI_READ_CAPACITY };
+    uint8_t reply[8];
+    d->blocks = 0;
+    // The first command after a disc change reports UNIT ATTENTION.
+    for (int attempt = 0; attempt < ATAPI_RETRIES; attempt++) {
+        if (atapi_packet(d, packet, reply, sizeof(reply)) != 0) continue;
+        uint32_t last = ((uint32_t)reply[0] << 24) | ((uint32_t)reply[1] << 16) | ((uint32_t)reply[2] << 8) | reply[3];
+        uint32_t size = ((uint32_t)reply[4] << 24) | ((uint32_t)reply[5] << 16) | ((uint32_t)reply[6] << 8) | reply[7];
+        if (size != ATAPI_BLOCK_SIZE) return -1;
+        d->blocks = last + 1;
+        return 0;
+    }
+    return -1;
+}
+
+static void atapi_copy_model(atapi_device_t* d, const uint16_t* id) {
+    int len = 0;
+    for (int w = 27; w <= 46; w++) {
+        d->model[len++] = (char)(id[w] >> 8);
+        d->model[len++] = (char)(id[w] & 0xFF);
+    }
+    while (len > 0 && d->model[len - 1] == ' ') len--;
+    d->model[len] = '\0';
+}
+
+// Devices are found once; the capacity is read again on every call so a
+// disc inserted later shows up at the next scan.
+int atapi_init(void) {
+    static uint16_t id[256];
+    if (!probed) {
+        probed = 1;
+        for (int ch = 0; ch < 2; ch++) {
+            if (inb(channel_io[ch] + ATA_REG_STATUS) == 0xFF) continue;
+            for (uint8_t slave = 0; slave < 2 && device_count < ATAPI_MAX_DEVICES; slave++) {
+                atapi_device_t* d = &devices[device_count];
+                d->io_base = channel_io[ch];
+                d->ctrl_base = channel_ctrl[ch];
+                d->slave = slave;
+                ata_wait_channel(d->io_base);
+                outb(d->ctrl_base, ATA_CTRL_NIEN);
+                if (atapi_identify(d, id) != 0) continue;
+                // Word 0 bits 15:14 = 10b for a packet device.
+                if ((id[0] & 0xC000) != 0x8000) continue;
+                d->present = 1;
+                atapi_copy_model(d, id);
+                device_count++;
+            }
+        }
+    }
+    for (int i = 0; i < device_count; i++) atapi_read_capacity(&devices[i]);
+    return device_count;
+}
+
+const atapi_device_t* atapi_get_device(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return &devices[index];
+}
+
+int atapi_read_blocks(int index, uint32_t lba, uint32_t count, void* out) {
+    const atapi_device_t* d = atapi_get_device(index);
+    uint8_t* p = (uint8_t*)out;
+    if (!d || !out || count == 0 || lba >= d->blocks || count > d->blocks - lba) return -1;
+    while (count > 0) {
+        uint32_t n = count < ATAPI_MAX_PER_CMD ? count : ATAPI_MAX_PER_CMD;
+        uint8_t packet[12] = {
+            SCSI_READ_10, 0,
+            (uint8_t)(lba >> 24), (uint8_t)(lba >> 16), (uint8_t)(lba >> 8), (uint8_t)lba,
+            0, (uint8_t)(n >> 8), (uint8_t)n, 0, 0, 0
+        };
+        int rc = -1;
+        for (int attempt = 0; attempt < ATAPI_RETRIES && rc != 0; attempt++) {
+            rc = atapi_packet(d, packet, p, n * ATAPI_BLOCK_SIZE);
+        }
+        if (rc != 0) return -1;
+        p += n * ATAPI_BLOCK_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return 0;
+}
+
+// bios_disk entry point: `lba` and `count` are in 512-byte sectors.
+int atapi_read(int index, uint64_t lba, uint32_t count, void* out) {
+    const atapi_device_t* d = atapi_get_device(index);
+    uint8_t* p = (uint8_t*)out;
+    if (!d || !out || count == 0) return -1;
+    if (lba >= (uint64_t)d->blocks * SECTORS_PER_BLOCK || count > (uint64_t)d->blocks * SECTORS_PER_BLOCK - lba) {
+        return -1;
+    }
+    uint32_t block = (uint32_t)(lba / SECTORS_PER_BLOCK);
+    uint32_t skip = (uint32_t)(lba % SECTORS_PER_BLOCK);
+    while (count > 0) {
+        if (skip == 0 && count >= SECTORS_PER_BLOCK) {
+            uint32_t blocks = count / SECTORS_PER_BLOCK;
+            if (atapi_read_blocks(index, block, blocks, p) != 0) return -1;
+            p += blocks * ATAPI_BLOCK_SIZE;
+            block += blocks;
+            count -= blocks * SECTORS_PER_BLOCK;
+            continue;
+        }
+        uint32_t n = SECTORS_PER_BLOCK - skip;
+        if (n > count) n = count;
+        if (atapi_read_blocks(index, block, 1, bounce) != 0) return -1;
+        for (uint32_t i = 0; i < n * ATAPI_SECTOR_SIZE; i++) p[i] = bounce[skip * ATAPI_SECTOR_SIZE + i];
+        p += n * ATAPI_SECTOR_SIZE;
+        block++;
+        skip = 0;
+        count -= n;
+    }
+    return 0;
+}
+
+int atapi_write(int index, uint64_t lba, uint32_t count, const void* in) {
+    (void)index;
+    (void)lba;
+    (void)count;
+    (void)in;
+    return -1;
+}
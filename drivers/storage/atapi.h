@@ -0,0 +1,25 @@
+#ifndef ATAPI_H
+#define ATAPI_H
+
+#include <stdint.h>
+
+#define ATAPI_MAX_DEVICES 4
+#define ATAPI_BLOCK_SIZE 2048
+#define ATAPI_SECTOR_SIZE 512   // what the drive looks like to bios_disk
+
+typedef struct {
+    int present;
+    uint16_t io_base;
+    uint16_t ctrl_base;
+    uint8_t slave;
+    uint32_t blocks;    // 0 while no medium is loaded
+    char model[41];
+} atapi_device_t;
+
+int atapi_init(void);
+const atapi_device_t* atapi_get_device(int index);
+int atapi_read_blocks(int index, uint32_t lba, uint32_t count, void* out);
+int atapi_read(int index, uint64_t lba, uint32_t count, void* out);
+int atapi_write(int index, uint64_t lba, uint32_t count, const void* in);
+
+#endif
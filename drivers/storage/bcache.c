@@ -0,0 +1,426 @@
+#include "bcache.h"
+#include "blkdev.h"
+#include "bios_disk.h"
+#include "../timer/timer.h"
+#include "../../lib/string.h"
+
+// Buffers are found through a hash of (drive, LBA) and kept on one LRU list,
+// most recently used first. Misses are filled in batches: every sector the
+// request needs, plus the read-ahead window when the drive is being read
+// sequentially, is queued on the block layer before a single run, so runs
+// of adjacent sectors reach the driver as one command. The window doubles
+// on each sequential miss up to BCACHE_READAHEAD_MAX and closes on a seek.
+// A partition's sectors are cached under its whole disk, so a sector read
+// through both has a single copy.
+
+#define BCACHE_HASH_BUCKETS 128
+#define BCACHE_BATCH 32
+#define BCACHE_READAHEAD_MIN 8
+#define BCACHE_READAHEAD_MAX 64
+#define BCACHE_WRITEBACK_TICKS 300  // 3 s at 100 Hz
+#define BCACHE_EVICT_BATCH 64       // LRU-tail buffers written with a dirty victim
+
+// How a buffer's contents arrived, for the hit/miss accounting.
+#define FILL_NONE       0
+#define FILL_DEMAND     1   // read for the request that missed
+#define FILL_READAHEAD  2   // read ahead of a sequential reader
+
+typedef struct bcache_buf {
+    uint8_t drive;
+    int valid;
+    int dirty;
+    int writing;
+    int fill;
+    uint64_t lba;
+    uint32_t dirty_since;
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;
+    struct bcache_buf* lru_next;
+    uint8_t data[BCACHE_SECTOR_SIZE];
+} bcache_buf_t;
+
+typedef struct {
+    uint64_t next_lba;  // where a sequential reader would continue
+    uint32_t window;
+} readahead_state_t;
+
+static bcache_buf_t buffers[BCACHE_BUFFERS];
+static bcache_buf_t* hash[BCACHE_HASH_BUCKETS];
+static bcache_buf_t* lru_head = 0;
+static bcache_buf_t* lru_tail = 0;
+static readahead_state_t readahead[BIOS_MAX_DRIVES];
+static bcache_stats_t stats;
+static uint32_t dirty_count = 0;
+static int ready = 0;
+
+static uint32_t hash_of(uint8_t drive, uint64_t lba) {
+    uint32_t h = (uint32_t)lba ^ (uint32_t)(lba >> 32) ^ ((uint32_t)drive << 24);
+    h ^= h >> 7;
+    return h & (BCACHE_HASH_BUCKETS - 1);
+}
+
+static void lru_unlink(bcache_buf_t* b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+}
+
+static void lru_push_front(bcache_buf_t* b) {
+    b->lru_prev = 0;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    else lru_tail = b;
+    lru_head = b;
+}
+
+static void lru_push_back(bcache_buf_t* b) {
+    b->lru_next = 0;
+    b->lru_prev = lru_tail;
+    if (lru_tail) lru_tail->lru_next = b;
+    else lru_head = b;
+    lru_tail = b;
+}
+
+static void touch(bcache_buf_t* b) {
+    if (lru_head == b) return;
+    lru_unlink(b);
+    lru_push_front(b);
+}
+
+static void cache_init(void) {
+    if (ready) return;
+    ready = 1;
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        buffers[i].valid = 0;
+        buffers[i].dirty = 0;
+        lru_push_front(&buffers[i]);
+    }
+}
+
+static bcache_buf_t* lookup(uint8_t drive, uint64_t lba) {
+    for (bcache_buf_t* b = hash[hash_of(drive, lba)]; b; b = b->hash_next) {
+        if (b->drive == drive && b->lba == lba) return b;
+    }
+    return 0;
+}
+
+static void hash_remove(bcache_buf_t* b) {
+    bcache_buf_t** link = &hash[hash_of(b->drive, b->lba)];
+    while (*link && *link != b) link = &(*link)->hash_next;
+    if (*link) *link = b->hash_next;
+    b->valid = 0;
+    stats.cached--;
+    // An empty buffer is the first one worth reusing.
+    lru_unlink(b);
+    lru_push_back(b);
+}
+
+static void mark_clean(bcache_buf_t* b) {
+    if (!b->dirty) return;
+    b->dirty = 0;
+    dirty_count--;
+}
+
+static const bios_drive_info_t* drive_info(uint8_t drive) {
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present && d->drive == drive) return d;
+    }
+    return 0;
+}
+
+// Queues dirty buffer `b` for writing and notes its drive in `*queued`.
+// A buffer of a drive that has gone is dropped, as nothing can take it.
+static int queue_write(bcache_buf_t* b, uint32_t* queued) {
+    if (!drive_info(b->drive)) {
+        mark_clean(b);
+        hash_remove(b);
+        stats.errors++;
+        return -1;
+    }
+    if (blkdev_submit(b->drive, b->lba, 1, b->data, 1) != 0) {
+        stats.errors++;
+        return -1;
+    }
+    b->writing = 1;
+    *queued |= 1u << (b->drive - 0x80);
+    return 0;
+}
+
+// Runs the queue of each drive in `queued` on its own, so the elevator
+// sees each drive's sectors together. A drive whose run succeeds has all
+// its queued buffers marked clean; after a failed run they are retried one
+// by one, so only the sectors that really cannot be written stay dirty.
+static int finish_writes(uint32_t queued) {
+    int rc = 0;
+    for (int d = 0; d < BIOS_MAX_DRIVES; d++) {
+        if (!(queued & (1u << d))) continue;
+        uint8_t id = (uint8_t)(0x80 + d);
+        int ok = blkdev_run(id) == 0;
+        for (int i = 0; i < BCACHE_BUFFERS; i++) {
+            bcache_buf_t* b = &buffers[i];
+            if (!b->writing || b->drive != id) continue;
+            b->writing = 0;
+            if (!ok && blkdev_write(id, b->lba, 1, b->data) != 0) {
+                stats.errors++;
+                rc = -1;
+                continue;
+            }
+            mark_clean(b);
+            stats.writebacks++;
+        }
+    }
+    return rc;
+}
+
+// Writes the dirty buffers among the BCACHE_EVICT_BATCH least recently
+// used in one go, so evicting through a long write costs a few merged
+// commands rather than one per sector.
+static void write_tail(void) {
+    uint32_t queued = 0;
+    bcache_buf_t* b = lru_tail;
+    for (int n = 0; b && n < BCACHE_EVICT_BATCH; n++) {
+        bcache_buf_t* prev = b->lru_prev;
+        if (b->valid && b->dirty) queue_write(b, &queued);
+        b = prev;
+    }
+    finish_writes(queued);
+}
+
+// Reuses the least recently used buffer for (drive, lba). A dirty victim is
+// written out first; if that fails the victim keeps its data and 0 is
+// returned.
+static bcache_buf_t* claim(uint8_t drive, uint64_t lba) {
+    bcache_buf_t* b = lru_tail;
+    if (b->valid && b->dirty) {
+        write_tail();
+        // Dropping buffers of a drive that has gone moves them to the
+        // tail, so look at it again.
+        b = lru_tail;
+        if (b->valid && b->dirty) {
+            touch(b);
+            return 0;
+        }
+    }
+    if (b->valid) {
+        hash_remove(b);
+        stats.evictions++;
+    }
+    b->drive = drive;
+    b->lba = lba;
+    b->valid = 1;
+    b->fill = FILL_NONE;
+    b->writing = 0;
+    uint32_t h = hash_of(drive, lba);
+    b->hash_next = hash[h];
+    hash[h] = b;
+    stats.cached++;
+    touch(b);
+    return b;
+}
+
+static uint64_t drive_sectors(uint8_t drive) {
+    const bios_drive_info_t* d = drive_info(drive);
+    return d ? d->sectors : 0;
+}
+
+// Turns [*lba, *lba + count) on a partition into the same sectors on its
+// whole disk. Fails when the range runs past the drive's end.
+static int resolve(uint8_t* drive, uint64_t* lba, uint32_t count) {
+    const bios_drive_info_t* d = drive_info(*drive);
+    if (!d) return -1;
+    if (*lba >= d->sectors || count > d->sectors - *lba) return -1;
+    if (!d->parent) return 0;
+    *drive = d->parent;
+    *lba += d->start_lba;
+    return 0;
+}
+
+// Reads [lba, lba + count) with count <= BCACHE_BATCH into `out`.
+static int read_batch(uint8_t drive, uint64_t lba, uint32_t count, uint8_t* out) {
+    readahead_state_t* ra = &readahead[drive - 0x80];
+    int sequential = lba == ra->next_lba;
+    ra->next_lba = lba + count;
+
+    int missed = 0;
+    for (uint32_t i = 0; i < count && !missed; i++) {
+        if (!lookup(drive, lba + i)) missed = 1;
+    }
+    uint32_t ahead = 0;
+    if (missed) {
+        if (!sequential) ra->window = 0;
+        else if (ra->window == 0) ra->window = BCACHE_READAHEAD_MIN;
+        else if (ra->window < BCACHE_READAHEAD_MAX) ra->window *= 2;
+        ahead = ra->window;
+        uint64_t end = drive_sectors(drive);
+        if (lba + count >= end) ahead = 0;
+        else if (ahead > end - (lba + count)) ahead = (uint32_t)(end - (lba + count));
+
+        bcache_buf_t* batch[BCACHE_BATCH + BCACHE_READAHEAD_MAX];
+        uint32_t queued = 0;
+        int failed = 0;
+        for (uint32_t i = 0; i < count + ahead; i++) {
+            // Sectors already cached move to the front so the claims below
+            // cannot evict them before they are copied out.
+            bcache_buf_t* b = lookup(drive, lba + i);
+            if (b) {
+                touch(b);
+                continue;
+            }
+            b = claim(drive, lba + i);
+            if (!b) {
+                failed = 1;
+                break;
+            }
+            b->fill = i >= count ? FILL_READAHEAD : FILL_DEMAND;
+            batch[queued++] = b;
+            if (blkdev_submit(drive, lba + i, 1, b->data, 0) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+        if (blkdev_run(drive) != 0) failed = 1;
+        if (failed) {
+            for (uint32_t i = 0; i < queued; i++) hash_remove(batch[i]);
+            stats.errors++;
+            return -1;
+        }
+        for (uint32_t i = 0; i < queued; i++) {
+            if (batch[i]->fill == FILL_READAHEAD) stats.readahead++;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_buf_t* b = lookup(drive, lba + i);
+        if (!b) return -1;
+        if (b->fill == FILL_DEMAND) {
+            stats.misses++;
+        } else {
+            if (b->fill == FILL_READAHEAD) stats.readahead_hits++;
+            stats.hits++;
+        }
+        b->fill = FILL_NONE;
+        memcpy(out + i * BCACHE_SECTOR_SIZE, b->data, BCACHE_SECTOR_SIZE);
+        touch(b);
+    }
+    return 0;
+}
+
+int bcache_read(uint8_t drive, uint64_t lba, uint32_t count, void* out) {
+    if (drive < 0x80 || drive - 0x80 >= BIOS_MAX_DRIVES || !out || count == 0) return -1;
+    if (resolve(&drive, &lba, count) != 0) return -1;
+    cache_init();
+    uint8_t* p = (uint8_t*)out;
+    while (count > 0) {
+        uint32_t n = count < BCACHE_BATCH ? count : BCACHE_BATCH;
+        if (read_batch(drive, lba, n, p) != 0) return -1;
+        p += n * BCACHE_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int bcache_write(uint8_t drive, uint64_t lba, uint32_t count, const void* in) {
+    if (drive < 0x80 || drive - 0x80 >= BIOS_MAX_DRIVES || !in || count == 0) return -1;
+    if (resolve(&drive, &lba, count) != 0) return -1;
+    cache_init();
+    const uint8_t* p = (const uint8_t*)in;
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_buf_t* b = lookup(drive, lba + i);
+        if (!b) b = claim(drive, lba + i);
+        if (!b) return -1;
+        memcpy(b->data, p + i * BCACHE_SECTOR_SIZE, BCACHE_SECTOR_SIZE);
+        b->fill = FILL_NONE;
+        if (!b->dirty) {
+            b->dirty = 1;
+            b->dirty_since = timer_ticks();
+            dirty_count++;
+        }
+        touch(b);
+    }
+    return 0;
+}
+
+// Queues dirty buffers of `drive` (every drive when 0) that have been dirty
+// for at least `min_age` ticks, then writes them.
+static int write_back(uint8_t drive, uint32_t min_age) {
+    if (!ready || dirty_count == 0) return 0;
+    uint32_t now = timer_ticks();
+    uint32_t queued = 0;
+    int rc = 0;
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_buf_t* b = &buffers[i];
+        if (!b->valid || !b->dirty) continue;
+        if (drive && b->drive != drive) continue;
+        if (now - b->dirty_since < min_age) continue;
+        if (queue_write(b, &queued) != 0) rc = -1;
+    }
+    if (finish_writes(queued) != 0) rc = -1;
+    return rc;
+}
+
+// Syncing a partition writes back its whole disk.
+int bcache_sync(uint8_t drive) {
+    const bios_drive_info_t* d = drive_info(drive);
+    if (d && d->parent) drive = d->parent;
+    return write_back(drive, 0);
+}
+
+int bcache_sync_all(void) {
+    return write_back(0, 0);
+}
+
+// Drops cached copies of [lba, lba + count) on a whole disk, dirty or not.
+static void drop_range(uint8_t drive, uint64_t lba, uint64_t count) {
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_buf_t* b = &buffers[i];
+        if (!b->valid || b->drive != drive) continue;
+        if (b->lba < lba || b->lba - lba >= count) continue;
+        mark_clean(b);
+        hash_remove(b);
+    }
+}
+
+void bcache_invalidate(uint8_t drive) {
+    if (!ready) return;
+    const bios_drive_info_t* d = drive_info(drive);
+    if (d && d->parent) {
+        drop_range(d->parent, d->start_lba, d->sectors);
+        return;
+    }
+    drop_range(drive, 0, (uint64_t)-1);
+    if (drive >= 0x80 && drive - 0x80 < BIOS_MAX_DRIVES) readahead[drive - 0x80].window = 0;
+}
+
+// Drops cached copies of [lba, lba + count), dirty or not, for callers
+// about to overwrite those sectors behind the cache.
+void bcache_invalidate_range(uint8_t drive, uint64_t lba, uint32_t count) {
+    if (!ready) return;
+    const bios_drive_info_t* d = drive_info(drive);
+    if (d && d->parent) {
+        drive = d->parent;
+        lba += d->start_lba;
+    }
+    drop_range(drive, lba, count);
+}
+
+// Called from the kernel main loop: writes back anything dirty for longer
+// than BCACHE_WRITEBACK_TICKS.
+void bcache_poll(void) {
+    write_back(0, BCACHE_WRITEBACK_TICKS);
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    if (!out) return;
+    *out = stats;
+    out->dirty = dirty_count;
+}
+
+uint32_t bcache_hit_percent(void) {
+    uint32_t total = stats.hits + stats.misses;
+    if (total == 0) return 0;
+    if (total > 0x01000000) return stats.hits / (total / 100);
+    return stats.hits * 100 / total;
+}
@@ -0,0 +1,36 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+
+// Sector buffer cache on top of the block layer. Reads are served from
+// memory when possible, writes stay dirty in the cache until bcache_sync,
+// eviction or the periodic write-back in bcache_poll. Code that writes a
+// drive without going through the cache must call bcache_invalidate.
+
+#define BCACHE_BUFFERS 256
+#define BCACHE_SECTOR_SIZE 512
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;         // sectors fetched ahead of a sequential reader
+    uint32_t readahead_hits;    // of those, sectors later read
+    uint32_t writebacks;        // dirty sectors written to disk
+    uint32_t evictions;
+    uint32_t errors;
+    uint32_t cached;            // buffers currently holding a sector
+    uint32_t dirty;
+} bcache_stats_t;
+
+int bcache_read(uint8_t drive, uint64_t lba, uint32_t count, void* out);
+int bcache_write(uint8_t drive, uint64_t lba, uint32_t count, const void* in);
+int bcache_sync(uint8_t drive);
+int bcache_sync_all(void);
+void bcache_invalidate(uint8_t drive);
+void bcache_invalidate_range(uint8_t drive, uint64_t lba, uint32_t count);
+void bcache_poll(void);
+void bcache_get_stats(bcache_stats_t* out);
+uint32_t bcache_hit_percent(void);
+
+#endif
@@ -1,24 +1,153 @@
 #include "bios_disk.h"
+#include "ata.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+#include "atapi.h"
+#include "partition.h"
+
+// Drives keep their BIOS numbering (0x80, 0x81, ...) so callers need not
+// care which native driver actually moves the sectors. Each driver found
+// at scan time registers its disks in order: legacy IDE first, then AHCI,
+// then virtio-blk, then CD drives holding a disc (read-only and never
+// scanned for partitions). Partitions found on the disks follow as further
+// drives, each translating its LBAs onto the disk through the parent's
+// driver, which is resolved once here rather than per request.
+//
+// Numbers stay put across rescans, since mounted volumes hold on to them.
+// A drive seen before (the same driver unit, or a partition at the same
+// start on the same disk) gets its old number back; a new one takes a
+// number never handed out. A drive that has gone leaves its number
+// behind, not present, so nothing else is ever reached through it.
 
 static bios_drive_info_t drives[BIOS_MAX_DRIVES];
-static int drive_count = 0;
+static int drive_count = 0;     // numbers handed out since boot
 
-void bios_disk_scan(void) {
-    drive_count = 0;
-    for (int i = 0; i < BIOS_MAX_DRIVES; i++) {
-        drives[i].drive = 0;
-        drives[i].sectors = 0;
-        drives[i].sector_size = 512;
-        drives[i].present = 0;
+static const bios_disk_ops_t ata_ops = { "ata", ata_read, ata_write, ata_start, ata_flush_cache, 0 };
+static const bios_disk_ops_t ahci_ops = { "ahci", ahci_read, ahci_write, ahci_start, ahci_flush, ahci_poll };
+static const bios_disk_ops_t virtio_ops = { "virtio", virtio_blk_read, virtio_blk_write, virtio_blk_start, virtio_blk_flush, virtio_blk_poll };
+static const bios_disk_ops_t atapi_ops = { "atapi", atapi_read, atapi_write, 0, 0, 0 };
+
+typedef struct {
+    const bios_disk_ops_t* ops;     // the whole disk's driver
+    int unit;
+    uint64_t start;
+    uint64_t sectors;
+} part_map_t;
+
+static part_map_t part_maps[BIOS_MAX_DRIVES];
+
+static const part_map_t* part_map(int unit, uint64_t lba, uint32_t count) {
+    const part_map_t* m = &part_maps[unit];
+    if (lba >= m->sectors || count > m->sectors - lba) return 0;
+    return m;
+}
+
+static int part_read(int unit, uint64_t lba, uint32_t count, void* out) {
+    const part_map_t* m = part_map(unit, lba, count);
+    return m ? m->ops->read(m->unit, m->start + lba, count, out) : -1;
+}
+
+static int part_write(int unit, uint64_t lba, uint32_t count, const void* in) {
+    const part_map_t* m = part_map(unit, lba, count);
+    return m ? m->ops->write(m->unit, m->start + lba, count, in) : -1;
+}
+
+static int part_start(int unit, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx) {
+    const part_map_t* m = part_map(unit, lba, count);
+    if (!m || !m->ops->start) return -1;
+    return m->ops->start(m->unit, m->start + lba, count, buf, write, done, ctx);
+}
+
+static int part_flush(int unit) {
+    const part_map_t* m = &part_maps[unit];
+    return m->ops->flush ? m->ops->flush(m->unit) : 0;
+}
+
+static const bios_disk_ops_t part_ops = { "part", part_read, part_write, part_start, part_flush, 0 };
+
+// The slot of the drive with this identity from an earlier scan, or a
+// fresh one; NULL when the table is full.
+static bios_drive_info_t* claim_slot(const bios_disk_ops_t* ops, int unit, uint8_t parent, uint64_t start) {
+    for (int i = 0; i < drive_count; i++) {
+        bios_drive_info_t* d = &drives[i];
+        if (d->present || d->ops != ops || d->parent != parent) continue;
+        if (parent ? d->start_lba == start : d->unit == unit) return d;
+    }
+    if (drive_count >= BIOS_MAX_DRIVES) return 0;
+    bios_drive_info_t* d = &drives[drive_count];
+    d->drive = (uint8_t)(0x80 + drive_count);
+    drive_count++;
+    return d;
+}
+
+static bios_drive_info_t* add_drive(const bios_disk_ops_t* ops, int unit, uint8_t parent, uint64_t start,
+                                    uint64_t sectors, uint32_t sector_size) {
+    bios_drive_info_t* d = claim_slot(ops, unit, parent, start);
+    if (!d) return 0;
+    d->sectors = sectors;
+    d->sector_size = sector_size;
+    d->present = 1;
+    d->ops = ops;
+    d->unit = unit;
+    d->parent = parent;
+    d->part_type = 0;
+    d->part_number = 0;
+    d->start_lba = start;
+    return d;
+}
+
+int bios_disk_register(const bios_disk_ops_t* ops, int unit, uint64_t sectors, uint32_t sector_size) {
+    if (!ops) return -1;
+    bios_drive_info_t* d = add_drive(ops, unit, 0, 0, sectors, sector_size);
+    return d ? d->drive : -1;
+}
+
+static void register_partitions(const bios_drive_info_t* disk) {
+    partition_t parts[PARTITION_MAX];
+    int found = partition_parse(disk, parts, PARTITION_MAX);
+    for (int i = 0; i < found; i++) {
+        bios_drive_info_t* d = add_drive(&part_ops, 0, disk->drive, parts[i].start, parts[i].sectors, disk->sector_size);
+        if (!d) break;
+        int slot = d->drive - 0x80;
+        part_maps[slot].ops = disk->ops;
+        part_maps[slot].unit = disk->unit;
+        part_maps[slot].start = parts[i].start;
+        part_maps[slot].sectors = parts[i].sectors;
+        d->unit = slot;
+        d->part_type = parts[i].type;
+        d->part_number = parts[i].number;
     }
+}
+
+void bios_disk_scan(void) {
+    for (int i = 0; i < drive_count; i++) drives[i].present = 0;
 
-    // Placeholder: assume primary BIOS drive exists at 0x80.
-    // Real INT 13h enumeration requires a real-mode thunk.
-    drives[0].drive = 0x80;
-    drives[0].sectors = 0;
-    drives[0].sector_size = 512;
-    drives[0].present = 1;
-    drive_count = 1;
+    int found = ata_init();
+    for (int i = 0; i < found; i++) {
+        const ata_device_t* dev = ata_get_device(i);
+        if (dev) bios_disk_register(&ata_ops, i, dev->sectors, ATA_SECTOR_SIZE);
+    }
+    found = ahci_init();
+    for (int i = 0; i < found; i++) {
+        const ahci_device_t* dev = ahci_get_device(i);
+        if (dev) bios_disk_register(&ahci_ops, i, dev->sectors, AHCI_SECTOR_SIZE);
+    }
+    found = virtio_blk_init();
+    for (int i = 0; i < found; i++) {
+        const virtio_blk_device_t* dev = virtio_blk_get_device(i);
+        if (dev) bios_disk_register(&virtio_ops, i, dev->sectors, VIRTIO_BLK_SECTOR_SIZE);
+    }
+    found = atapi_init();
+    for (int i = 0; i < found; i++) {
+        const atapi_device_t* dev = atapi_get_device(i);
+        if (dev && dev->blocks) {
+            bios_disk_register(&atapi_ops, i, (uint64_t)dev->blocks * (ATAPI_BLOCK_SIZE / ATAPI_SECTOR_SIZE), ATAPI_SECTOR_SIZE);
+        }
+    }
+    for (int i = 0; i < drive_count; i++) {
+        const bios_drive_info_t* d = &drives[i];
+        if (d->present && !d->parent && d->ops != &atapi_ops) register_partitions(d);
+    }
 }
 
 int bios_disk_count(void) {
@@ -30,12 +159,44 @@ const bios_drive_info_t* bios_disk_get(int index) {
     return &drives[index];
 }
 
+static const bios_drive_info_t* find_drive(uint8_t drive) {
+    if (drive < 0x80 || drive - 0x80 >= drive_count) return 0;
+    return &drives[drive - 0x80];
+}
+
 int bios_read_lba(uint8_t drive, uint64_t lba, uint16_t count, void* out) {
-    (void)drive; (void)lba; (void)count; (void)out;
-    return -1;
+    const bios_drive_info_t* d = find_drive(drive);
+    if (!d || !d->present) return -1;
+    return d->ops->read(d->unit, lba, count, out);
 }
 
 int bios_write_lba(uint8_t drive, uint64_t lba, uint16_t count, const void* in) {
-    (void)drive; (void)lba; (void)count; (void)in;
-    return -1;
+    const bios_drive_info_t* d = find_drive(drive);
+    if (!d || !d->present) return -1;
+    return d->ops->write(d->unit, lba, count, in);
+}
+
+int bios_start_lba(uint8_t drive, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx) {
+    const bios_drive_info_t* d = find_drive(drive);
+    if (!d || !d->present || !d->ops->start) return -1;
+    return d->ops->start(d->unit, lba, count, buf, write, done, ctx);
+}
+
+// Drivers without a flush hook already commit their cache on every write.
+int bios_flush(uint8_t drive) {
+    const bios_drive_info_t* d = find_drive(drive);
+    if (!d || !d->present) return -1;
+    return d->ops->flush ? d->ops->flush(d->unit) : 0;
+}
+
+// Advances background transfers of drivers that poll for completion; a
+// partition's transfer runs on its disk's driver, which is polled there.
+// Returns how many drives still have one running.
+int bios_disk_poll(void) {
+    int running = 0;
+    for (int i = 0; i < drive_count; i++) {
+        const bios_drive_info_t* d = &drives[i];
+        if (d->present && d->ops->poll && d->ops->poll(d->unit)) running++;
+    }
+    return running;
 }
@@ -6,17 +6,51 @@
 
 #define BIOS_MAX_DRIVES 16
 
+// Completion callback for a background transfer; `status` is 0 or -1. It
+// runs from the driver's interrupt handler, or from the start call itself
+// when the request fails before reaching the hardware.
+typedef void (*bios_disk_done_t)(void* ctx, int status);
+
+// A storage driver backing one or more drives. `unit` is the driver's own
+// index for the drive it registered. `start`, `flush` and `poll` are
+// optional: `start` begins a transfer that completes through its callback,
+// or returns -1 when it cannot run one right now; `flush` commits the
+// drive's write cache after writes made through `start`. Drivers that
+// learn of completions by polling rather than by interrupt provide `poll`,
+// which advances a started transfer without waiting and returns 1 while
+// one is still running.
+typedef struct {
+    const char* name;
+    int (*read)(int unit, uint64_t lba, uint32_t count, void* out);
+    int (*write)(int unit, uint64_t lba, uint32_t count, const void* in);
+    int (*start)(int unit, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx);
+    int (*flush)(int unit);
+    int (*poll)(int unit);
+} bios_disk_ops_t;
+
 typedef struct {
     uint8_t drive;
     uint64_t sectors;
     uint32_t sector_size;
     int present;
+    const bios_disk_ops_t* ops;
+    int unit;
+    // Partitions are drives of their own; `parent` is then the whole disk's
+    // drive number (0 for a whole disk) and `start_lba` their offset on it.
+    uint8_t parent;
+    uint8_t part_type;
+    int part_number;
+    uint64_t start_lba;
 } bios_drive_info_t;
 
 void bios_disk_scan(void);
+int bios_disk_register(const bios_disk_ops_t* ops, int unit, uint64_t sectors, uint32_t sector_size);
 int bios_disk_count(void);
 const bios_drive_info_t* bios_disk_get(int index);
 int bios_read_lba(uint8_t drive, uint64_t lba, uint16_t count, void* out);
 int bios_write_lba(uint8_t drive, uint64_t lba, uint16_t count, const void* in);
+int bios_start_lba(uint8_t drive, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx);
+int bios_flush(uint8_t drive);
+int bios_disk_poll(void);
 
 #endif
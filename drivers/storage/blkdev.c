@@ -0,0 +1,244 @@
+#include "blkdev.h"
+#include "bios_disk.h"
+#include "../../lib/string.h"
+
+// Each drive's queue is a singly linked list kept sorted by LBA. Running a
+// queue is one C-LOOK sweep: starting at the first request at or above the
+// last dispatched position it walks upwards, then wraps to the lowest LBA.
+// At dispatch a run of requests with the same direction and consecutive
+// LBAs is issued as one command, straight from the caller's buffer when the
+// run is contiguous in memory and through a bounce buffer otherwise.
+
+typedef struct blk_request {
+    uint64_t lba;
+    uint32_t count;
+    uint8_t* buf;
+    int write;
+    struct blk_request* next;
+} blk_request_t;
+
+typedef struct {
+    uint8_t drive;
+    blk_request_t* head;
+    uint64_t position;  // LBA just past the last dispatched command
+    int error;
+} blk_queue_t;
+
+static blk_request_t pool[BLKDEV_MAX_REQUESTS];
+static blk_request_t* free_list = 0;
+static int pool_ready = 0;
+static blk_queue_t queues[BIOS_MAX_DRIVES];
+static blkdev_stats_t stats;
+static uint8_t bounce[BLKDEV_MAX_SECTORS * BLKDEV_SECTOR_SIZE];
+
+static void pool_init(void) {
+    if (pool_ready) return;
+    pool_ready = 1;
+    for (int i = 0; i < BLKDEV_MAX_REQUESTS; i++) {
+        pool[i].next = free_list;
+        free_list = &pool[i];
+    }
+    for (int i = 0; i < BIOS_MAX_DRIVES; i++) {
+        queues[i].drive = (uint8_t)(0x80 + i);
+        queues[i].head = 0;
+        queues[i].position = 0;
+        queues[i].error = 0;
+    }
+}
+
+static blk_queue_t* queue_for(uint8_t drive) {
+    if (drive < 0x80 || drive - 0x80 >= BIOS_MAX_DRIVES) return 0;
+    pool_init();
+    return &queues[drive - 0x80];
+}
+
+static uint8_t* request_end(const blk_request_t* r) {
+    return r->buf + r->count * BLKDEV_SECTOR_SIZE;
+}
+
+// Gathers the run starting at `first` into one command and issues it.
+// Returns the first request after the run.
+static blk_request_t* dispatch_run(blk_queue_t* q, blk_request_t* first) {
+    blk_request_t* last = first;
+    uint32_t total = first->count;
+    int contiguous = 1;
+    while (last->next && last->next->write == first->write &&
+           last->next->lba == last->lba + last->count &&
+           total + last->next->count <= BLKDEV_MAX_SECTORS) {
+        if (last->next->buf != request_end(last)) contiguous = 0;
+        total += last->next->count;
+        last = last->next;
+    }
+    blk_request_t* after = last->next;
+
+    uint8_t* io = contiguous ? first->buf : bounce;
+    if (!contiguous && first->write) {
+        uint8_t* p = bounce;
+        for (blk_request_t* r = first; r != after; r = r->next) {
+            memcpy(p, r->buf, r->count * BLKDEV_SECTOR_SIZE);
+            p += r->count * BLKDEV_SECTOR_SIZE;
+        }
+    }
+    int rc = first->write ? bios_write_lba(q->drive, first->lba, (uint16_t)total, io)
+                          : bios_read_lba(q->drive, first->lba, (uint16_t)total, io);
+    if (!contiguous && !first->write && rc == 0) {
+        uint8_t* p = bounce;
+        for (blk_request_t* r = first; r != after; r = r->next) {
+            memcpy(r->buf, p, r->count * BLKDEV_SECTOR_SIZE);
+            p += r->count * BLKDEV_SECTOR_SIZE;
+        }
+    }
+    stats.dispatched++;
+    stats.sectors += total;
+    if (rc != 0) {
+        q->error = 1;
+        stats.errors++;
+    }
+    q->position = first->lba + total;
+    return after;
+}
+
+static void release_list(blk_request_t* r, blk_request_t* stop) {
+    while (r != stop) {
+        blk_request_t* next = r->next;
+        r->next = free_list;
+        free_list = r;
+        r = next;
+    }
+}
+
+// Dispatches everything queued. Errors stay latched in `q->error` until
+// run_queue reports them to the queue's owner.
+static void drain_queue(blk_queue_t* q) {
+    blk_request_t* head = q->head;
+    q->head = 0;
+    if (head) {
+        // Upward pass from the current position, then wrap to the start.
+        blk_request_t* start = head;
+        blk_request_t* before = 0;
+        while (start && start->lba < q->position) {
+            before = start;
+            start = start->next;
+        }
+        if (before) before->next = 0;
+        blk_request_t* r = start;
+        while (r) r = dispatch_run(q, r);
+        if (before) {
+            r = head;
+            while (r) r = dispatch_run(q, r);
+        }
+        release_list(start, 0);
+        if (before) release_list(head, 0);
+    }
+}
+
+static int run_queue(blk_queue_t* q) {
+    drain_queue(q);
+    int rc = q->error ? -1 : 0;
+    q->error = 0;
+    return rc;
+}
+
+static int overlaps(const blk_request_t* r, uint64_t lba, uint32_t count) {
+    return lba < r->lba + r->count && r->lba < lba + count;
+}
+
+// Inserts one request of at most BLKDEV_MAX_SECTORS, merging it into a
+// queued neighbour when both the LBAs and the buffers line up.
+static int queue_one(blk_queue_t* q, uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    for (blk_request_t* r = q->head; r; r = r->next) {
+        // Reads may overlap reads; anything involving a write must not be
+        // reordered, so drain what is queued first.
+        if (overlaps(r, lba, count) && (write || r->write)) {
+            if (run_queue(q) != 0) return -1;
+            break;
+        }
+    }
+    if (!free_list) {
+        // The pool is shared, so other drives' queues may hold every
+        // request. Their errors wait for their own blkdev_run.
+        for (int i = 0; i < BIOS_MAX_DRIVES; i++) drain_queue(&queues[i]);
+        if (!free_list) return -1;
+    }
+    stats.submitted++;
+
+    blk_request_t* prev = 0;
+    blk_request_t* r = q->head;
+    while (r && r->lba < lba) {
+        prev = r;
+        r = r->next;
+    }
+    if (prev && prev->write == write && prev->lba + prev->count == lba &&
+        request_end(prev) == buf && prev->count + count <= BLKDEV_MAX_SECTORS) {
+        prev->count += count;
+        stats.merged++;
+        return 0;
+    }
+    if (r && r->write == write && lba + count == r->lba &&
+        buf + count * BLKDEV_SECTOR_SIZE == r->buf && r->count + count <= BLKDEV_MAX_SECTORS) {
+        r->lba = lba;
+        r->buf = buf;
+        r->count += count;
+        stats.merged++;
+        return 0;
+    }
+
+    blk_request_t* n = free_list;
+    free_list = n->next;
+    n->lba = lba;
+    n->count = count;
+    n->buf = buf;
+    n->write = write;
+    n->next = r;
+    if (prev) prev->next = n;
+    else q->head = n;
+    return 0;
+}
+
+int blkdev_submit(uint8_t drive, uint64_t lba, uint32_t count, void* buf, int write) {
+    blk_queue_t* q = queue_for(drive);
+    if (!q || !buf || count == 0) return -1;
+    uint8_t* p = (uint8_t*)buf;
+    while (count > 0) {
+        uint32_t n = count < BLKDEV_MAX_SECTORS ? count : BLKDEV_MAX_SECTORS;
+        if (queue_one(q, lba, n, p, write != 0) != 0) return -1;
+        p += n * BLKDEV_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int blkdev_run(uint8_t drive) {
+    blk_queue_t* q = queue_for(drive);
+    if (!q) return -1;
+    return run_queue(q);
+}
+
+int blkdev_run_all(void) {
+    int rc = 0;
+    for (int i = 0; i < BIOS_MAX_DRIVES; i++) {
+        if (blkdev_run((uint8_t)(0x80 + i)) != 0) rc = -1;
+    }
+    return rc;
+}
+
+int blkdev_read(uint8_t drive, uint64_t lba, uint32_t count, void* out) {
+    if (blkdev_submit(drive, lba, count, out, 0) != 0) {
+        blkdev_run(drive);
+        return -1;
+    }
+    return blkdev_run(drive);
+}
+
+int blkdev_write(uint8_t drive, uint64_t lba, uint32_t count, const void* in) {
+    if (blkdev_submit(drive, lba, count, (void*)in, 1) != 0) {
+        blkdev_run(drive);
+        return -1;
+    }
+    return blkdev_run(drive);
+}
+
+void blkdev_get_stats(blkdev_stats_t* out) {
+    if (out) *out = stats;
+}
@@ -0,0 +1,36 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+// Generic block layer between callers and the bios_disk drivers. Requests
+// are queued per drive and only reach the hardware when the queue is run,
+// at which point adjacent requests are merged into transfers of up to
+// BLKDEV_MAX_SECTORS and issued in elevator (ascending LBA) order.
+//
+// A queued request keeps pointing at the caller's buffer: write data must
+// stay unchanged and read buffers must not be used until blkdev_run
+// returns. Requests overlapping a queued one in a way that could reorder
+// their effects run the queue first, so queued I/O never observes a later
+// request.
+
+#define BLKDEV_SECTOR_SIZE 512
+#define BLKDEV_MAX_SECTORS 128
+#define BLKDEV_MAX_REQUESTS 64
+
+typedef struct {
+    uint32_t submitted;     // requests handed to blkdev_submit
+    uint32_t merged;        // requests folded into a neighbour while queued
+    uint32_t dispatched;    // commands issued to drivers
+    uint32_t sectors;       // sectors moved by those commands
+    uint32_t errors;
+} blkdev_stats_t;
+
+int blkdev_submit(uint8_t drive, uint64_t lba, uint32_t count, void* buf, int write);
+int blkdev_run(uint8_t drive);
+int blkdev_run_all(void);
+int blkdev_read(uint8_t drive, uint64_t lba, uint32_t count, void* out);
+int blkdev_write(uint8_t drive, uint64_t lba, uint32_t count, const void* in);
+void blkdev_get_stats(blkdev_stats_t* out);
+
+#endif
@@ -0,0 +1,190 @@
+#include "ioring.h"
+#include "bios_disk.h"
+#include "bcache.h"
+
+// The engine walks every registered ring from ioring_poll (the kernel main
+// loop and the GUI loop call it) and starts each ring's next entry. Drivers
+// with a background `start` hook complete the entry through a callback that
+// posts the completion directly: IDE from its interrupt handler, AHCI and
+// virtio-blk from their `poll` hooks, which ioring_poll runs first and which
+// only reap what the hardware has finished. A long transfer thus costs the
+// caller nothing until it is reaped. Other drivers are driven
+// synchronously, IORING_SYNC_CHUNK sectors per poll, so they still only
+// block for short stretches at a time.
+//
+// Ring transfers bypass the buffer cache: dirty cached sectors are written
+// back before a ring read and dropped before a ring write. A cached read of
+// sectors an in-flight ring write covers may see either version.
+
+#define IORING_SYNC_CHUNK 64
+
+#define RING_IDLE   0
+#define RING_ASYNC  1   // waiting for the driver's completion callback
+#define RING_SYNC   2   // being moved by ioring_poll
+
+static io_ring_t* rings = 0;
+
+static void post(io_ring_t* ring, int32_t result) {
+    io_cqe_t* cqe = &ring->cq[ring->cq_tail & (IORING_ENTRIES - 1)];
+    cqe->user_data = ring->cur.user_data;
+    cqe->result = result;
+    ring->cq_tail++;
+    ring->state = RING_IDLE;
+}
+
+// May run in interrupt context.
+static void async_done(void* ctx, int status) {
+    io_ring_t* ring = (io_ring_t*)ctx;
+    post(ring, status == 0 ? (int32_t)ring->cur.count : -1);
+}
+
+static void start_next(io_ring_t* ring) {
+    if (ring->sq_head == ring->sq_submitted) return;
+    // One entry runs at a time, so one free completion slot is enough.
+    if (ring->cq_tail - ring->cq_head >= IORING_ENTRIES) return;
+    ring->cur = ring->sq[ring->sq_head & (IORING_ENTRIES - 1)];
+    ring->sq_head++;
+    io_sqe_t* e = &ring->cur;
+
+    switch (e->opcode) {
+    case IORING_OP_NOP:
+        post(ring, 0);
+        return;
+    case IORING_OP_FLUSH:
+        post(ring, bios_flush(e->drive) == 0 ? 0 : -1);
+        return;
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+        break;
+    default:
+        post(ring, -1);
+        return;
+    }
+    if (!e->buf || e->count == 0) {
+        post(ring, -1);
+        return;
+    }
+    int write = e->opcode == IORING_OP_WRITE;
+    if (write) bcache_invalidate_range(e->drive, e->lba, e->count);
+    else if (bcache_sync(e->drive) != 0) {
+        post(ring, -1);
+        return;
+    }
+    ring->state = RING_ASYNC;
+    if (bios_start_lba(e->drive, e->lba, e->count, e->buf, write, async_done, ring) == 0) return;
+    ring->state = RING_SYNC;
+    ring->progress = 0;
+}
+
+static void sync_step(io_ring_t* ring) {
+    io_sqe_t* e = &ring->cur;
+    uint32_t n = e->count - ring->progress;
+    if (n > IORING_SYNC_CHUNK) n = IORING_SYNC_CHUNK;
+    uint8_t* p = (uint8_t*)e->buf + ring->progress * 512;
+    uint64_t lba = e->lba + ring->progress;
+    int rc = e->opcode == IORING_OP_WRITE ? bios_write_lba(e->drive, lba, (uint16_t)n, p)
+                                          : bios_read_lba(e->drive, lba, (uint16_t)n, p);
+    if (rc != 0) {
+        post(ring, -1);
+        return;
+    }
+    ring->progress += n;
+    if (ring->progress == e->count) post(ring, (int32_t)e->count);
+}
+
+static void ring_poll(io_ring_t* ring) {
+    if (ring->state == RING_IDLE) start_next(ring);
+    if (ring->state == RING_SYNC) sync_step(ring);
+}
+
+void ioring_poll(void) {
+    bios_disk_poll();
+    for (io_ring_t* r = rings; r; r = r->next) ring_poll(r);
+}
+
+static int interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+// Waits a little for `ring`'s entry to make progress. Polled drivers are
+// advanced right away; with only interrupt-driven transfers left the CPU
+// sleeps until the next interrupt. The state is re-checked with
+// interrupts masked and `sti; hlt` sleeps, so a completion cannot land
+// between the check and the halt.
+static void ring_wait(io_ring_t* ring) {
+    int polled = bios_disk_poll();
+    ring_poll(ring);
+    if (polled || !interrupts_enabled()) return;
+    __asm__ volatile ("cli");
+    if (ring->state == RING_ASYNC) __asm__ volatile ("sti; hlt");
+    else __asm__ volatile ("sti");
+}
+
+void ioring_init(io_ring_t* ring) {
+    ring->sq_tail = 0;
+    ring->sq_submitted = 0;
+    ring->sq_head = 0;
+    ring->cq_head = 0;
+    ring->cq_tail = 0;
+    ring->state = RING_IDLE;
+    ring->progress = 0;
+    ring->next = rings;
+    rings = ring;
+}
+
+// Lets submitted entries finish, then unregisters the ring. Completions
+// stay queued for ioring_peek_cqe; an entry that finds the completion ring
+// full is never started. Returns how many entries were left unrun that way.
+int ioring_exit(io_ring_t* ring) {
+    while (ring->state != RING_IDLE ||
+           (ring->sq_head != ring->sq_submitted && ring->cq_tail - ring->cq_head < IORING_ENTRIES)) {
+        ring_wait(ring);
+    }
+    io_ring_t** link = &rings;
+    while (*link && *link != ring) link = &(*link)->next;
+    if (*link) *link = ring->next;
+    return (int)(ring->sq_submitted - ring->sq_head);
+}
+
+io_sqe_t* ioring_get_sqe(io_ring_t* ring) {
+    if (ring->sq_tail - ring->sq_head >= IORING_ENTRIES) return 0;
+    io_sqe_t* e = &ring->sq[ring->sq_tail & (IORING_ENTRIES - 1)];
+    ring->sq_tail++;
+    e->opcode = IORING_OP_NOP;
+    e->drive = 0;
+    e->reserved = 0;
+    e->count = 0;
+    e->lba = 0;
+    e->buf = 0;
+    e->user_data = 0;
+    return e;
+}
+
+// Publishes every entry taken since the last call and starts the first
+// one if the ring is idle. Returns how many were published.
+int ioring_submit(io_ring_t* ring) {
+    int published = (int)(ring->sq_tail - ring->sq_submitted);
+    ring->sq_submitted = ring->sq_tail;
+    if (ring->state == RING_IDLE) start_next(ring);
+    return published;
+}
+
+int ioring_peek_cqe(io_ring_t* ring, io_cqe_t* out) {
+    if (ring->cq_head == ring->cq_tail) return 0;
+    if (out) *out = ring->cq[ring->cq_head & (IORING_ENTRIES - 1)];
+    ring->cq_head++;
+    // A free completion slot may let the next entry start.
+    if (ring->state == RING_IDLE) start_next(ring);
+    return 1;
+}
+
+// Returns 1 with a completion, or 0 when nothing is submitted or running.
+int ioring_wait_cqe(io_ring_t* ring, io_cqe_t* out) {
+    for (;;) {
+        if (ioring_peek_cqe(ring, out)) return 1;
+        if (ring->state == RING_IDLE && ring->sq_head == ring->sq_submitted) return 0;
+        ring_wait(ring);
+    }
+}
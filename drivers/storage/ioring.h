@@ -0,0 +1,60 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <stdint.h>
+
+// Asynchronous block I/O through a pair of rings owned by the caller. Fill
+// entries from ioring_get_sqe, publish them with ioring_submit and reap
+// results with ioring_peek_cqe or ioring_wait_cqe; the buffers named by an
+// entry belong to the request until its completion is reaped. Entries of
+// one ring run one at a time in submission order.
+
+#define IORING_ENTRIES 32   // power of two
+
+enum {
+    IORING_OP_NOP = 0,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_FLUSH
+};
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t drive;
+    uint16_t reserved;
+    uint32_t count;         // sectors
+    uint64_t lba;
+    void* buf;
+    uint32_t user_data;     // copied to the completion
+} io_sqe_t;
+
+typedef struct {
+    uint32_t user_data;
+    int32_t result;         // sectors moved, 0 for NOP/FLUSH, or -1
+} io_cqe_t;
+
+typedef struct io_ring {
+    io_sqe_t sq[IORING_ENTRIES];
+    io_cqe_t cq[IORING_ENTRIES];
+    uint32_t sq_tail;           // next entry the owner fills
+    uint32_t sq_submitted;      // end of what ioring_submit published
+    uint32_t sq_head;           // next entry the engine takes
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+
+    // Engine state for the entry being executed.
+    io_sqe_t cur;
+    volatile int state;
+    uint32_t progress;
+    struct io_ring* next;
+} io_ring_t;
+
+void ioring_init(io_ring_t* ring);
+int ioring_exit(io_ring_t* ring);
+io_sqe_t* ioring_get_sqe(io_ring_t* ring);
+int ioring_submit(io_ring_t* ring);
+int ioring_peek_cqe(io_ring_t* ring, io_cqe_t* out);
+int ioring_wait_cqe(io_ring_t* ring, io_cqe_t* out);
+void ioring_poll(void);
+
+#endif
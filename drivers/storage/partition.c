@@ -0,0 +1,125 @@
+#include "partition.h"
+#include "../../lib/string.h"
+
+// Reads the partition table of a whole disk through its driver. A
+// protective MBR (a type 0xEE entry) means the disk is GPT; otherwise the
+// four primary entries are used and extended partitions are followed down
+// their chain of EBRs. Entries that do not fit on the disk are ignored.
+
+#define MBR_TABLE_OFFSET 446
+#define MBR_SIGNATURE_OFFSET 510
+#define MBR_TYPE_EXTENDED_CHS 0x05
+#define MBR_TYPE_EXTENDED_LBA 0x0F
+#define MBR_TYPE_EXTENDED_LINUX 0x85
+#define MBR_MAX_LOGICAL 12
+
+#define GPT_HEADER_LBA 1
+#define GPT_SIGNATURE "EFI PART"
+#define GPT_MAX_ENTRIES 128
+
+// PARTITION_TYPE_SNAPSHOT's type GUID as stored on disk.
+static const uint8_t gpt_snapshot_type[16] = {
+    0x47, 0x62, 0x6F, 0x4F, 0x65, 0x72, 0x4F, 0x53,
+    0x53, 0x6E, 0x61, 0x70, 0x73, 0x68, 0x6F, 0x74
+};
+
+static uint8_t sector[512];
+
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64(const uint8_t* p) {
+    return (uint64_t)read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+static int read_sector(const bios_drive_info_t* disk, uint64_t lba) {
+    if (lba >= disk->sectors) return -1;
+    return disk->ops->read(disk->unit, lba, 1, sector);
+}
+
+static int add(const bios_drive_info_t* disk, partition_t* out, int n, int max,
+               int number, uint8_t type, uint64_t start, uint64_t sectors) {
+    if (n >= max || sectors == 0 || start == 0) return n;
+    if (start >= disk->sectors || sectors > disk->sectors - start) return n;
+    out[n].number = number;
+    out[n].type = type;
+    out[n].start = start;
+    out[n].sectors = sectors;
+    return n + 1;
+}
+
+static int is_extended(uint8_t type) {
+    return type == MBR_TYPE_EXTENDED_CHS || type == MBR_TYPE_EXTENDED_LBA || type == MBR_TYPE_EXTENDED_LINUX;
+}
+
+static int parse_gpt(const bios_drive_info_t* disk, partition_t* out, int max) {
+    if (read_sector(disk, GPT_HEADER_LBA) != 0) return 0;
+    if (memcmp(sector, GPT_SIGNATURE, 8) != 0) return 0;
+    uint64_t entry_lba = read_u64(sector + 72);
+    uint32_t entries = read_u32(sector + 80);
+    uint32_t entry_size = read_u32(sector + 84);
+    if (entry_size < 128 || entry_size > 512 || (512 % entry_size) != 0) return 0;
+    if (entries > GPT_MAX_ENTRIES) entries = GPT_MAX_ENTRIES;
+
+    uint32_t per_sector = 512 / entry_size;
+    int n = 0;
+    for (uint32_t i = 0; i < entries && n < max; i++) {
+        if (i % per_sector == 0 && read_sector(disk, entry_lba + i / per_sector) != 0) break;
+        const uint8_t* e = sector + (i % per_sector) * entry_size;
+        int used = 0;
+        for (int b = 0; b < 16; b++) used |= e[b];
+        if (!used) continue;
+        uint64_t first = read_u64(e + 32);
+        uint64_t last = read_u64(e + 40);
+        if (last < first) continue;
+        uint8_t type = memcmp(e, gpt_snapshot_type, 16) == 0 ? PARTITION_TYPE_SNAPSHOT : PARTITION_TYPE_GPT;
+        n = add(disk, out, n, max, (int)i + 1, type, first, last - first + 1);
+    }
+    return n;
+}
+
+// Walks the EBR chain of an extended partition starting at `base`. Each EBR
+// describes one logical partition relative to itself and links to the next
+// EBR relative to `base`.
+static int parse_logical(const bios_drive_info_t* disk, uint64_t base, partition_t* out, int n, int max) {
+    uint64_t ebr = base;
+    for (int number = 5; number < 5 + MBR_MAX_LOGICAL && n < max; number++) {
+        if (read_sector(disk, ebr) != 0) break;
+        if (sector[MBR_SIGNATURE_OFFSET] != 0x55 || sector[MBR_SIGNATURE_OFFSET + 1] != 0xAA) break;
+        const uint8_t* e0 = sector + MBR_TABLE_OFFSET;
+        const uint8_t* e1 = e0 + 16;
+        uint64_t next = read_u32(e1 + 8);
+        n = add(disk, out, n, max, number, e0[4], ebr + read_u32(e0 + 8), read_u32(e0 + 12));
+        if (!is_extended(e1[4]) || next == 0) break;
+        ebr = base + next;
+    }
+    return n;
+}
+
+int partition_parse(const bios_drive_info_t* disk, partition_t* out, int max) {
+    if (!disk || !disk->present || !disk->ops || disk->sector_size != 512) return 0;
+    if (read_sector(disk, 0) != 0) return 0;
+    if (sector[MBR_SIGNATURE_OFFSET] != 0x55 || sector[MBR_SIGNATURE_OFFSET + 1] != 0xAA) return 0;
+
+    uint8_t types[4];
+    uint32_t starts[4];
+    uint32_t counts[4];
+    for (int i = 0; i < 4; i++) {
+        const uint8_t* e = sector + MBR_TABLE_OFFSET + i * 16;
+        types[i] = e[4];
+        starts[i] = read_u32(e + 8);
+        counts[i] = read_u32(e + 12);
+    }
+    for (int i = 0; i < 4; i++) {
+        if (types[i] == PARTITION_TYPE_GPT) return parse_gpt(disk, out, max);
+    }
+
+    int n = 0;
+    for (int i = 0; i < 4; i++) {
+        if (types[i] == 0) continue;
+        if (is_extended(types[i])) n = parse_logical(disk, starts[i], out, n, max);
+        else n = add(disk, out, n, max, i + 1, types[i], starts[i], counts[i]);
+    }
+    return n;
+}
@@ -0,0 +1,22 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdint.h>
+#include "bios_disk.h"
+
+#define PARTITION_MAX 16
+#define PARTITION_TYPE_GPT 0xEE    // reported for GPT entries of other types
+// Filesystem snapshot partitions: MBR system ID 0x7F, or on GPT the type
+// GUID 4f6f6247-7265-534f-536e-617073686f74.
+#define PARTITION_TYPE_SNAPSHOT 0x7F
+
+typedef struct {
+    int number;         // 1-4 primary, 5+ logical (MBR); table order (GPT)
+    uint8_t type;       // MBR system ID, or PARTITION_TYPE_GPT
+    uint64_t start;
+    uint64_t sectors;
+} partition_t;
+
+int partition_parse(const bios_drive_info_t* disk, partition_t* out, int max);
+
+#endif
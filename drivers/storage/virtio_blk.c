@@ -0,0 +1,473 @@
+#include "virtio_blk.h"
+#include "../io/io.h"
+#include "../pci/pci.h"
+#include "../timer/timer.h"
+
+// Legacy (transitional) virtio-blk over the PCI I/O BAR with one split
+// virtqueue. A transfer is cut into requests of up to VIRTIO_REQ_SECTORS,
+// each a descriptor chain of header, data segments and status byte. As many
+// requests as fit in the ring are published before a single notify, and the
+// device is asked not to interrupt: completions are reaped from the used
+// ring in bursts until the whole transfer is done. The blocking calls wait
+// for each burst; a transfer begun with virtio_blk_start is advanced by
+// virtio_blk_poll, which only reaps what the used ring already holds.
+
+#define VIRTIO_PCI_VENDOR      0x1AF4
+#define VIRTIO_PCI_BLK_LEGACY  0x1001
+
+#define VIRTIO_REG_HOST_FEATURES  0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_PFN      0x08
+#define VIRTIO_REG_QUEUE_SIZE     0x0C
+#define VIRTIO_REG_QUEUE_SELECT   0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY   0x10
+#define VIRTIO_REG_STATUS         0x12
+#define VIRTIO_REG_CONFIG         0x14
+
+#define VIRTIO_STATUS_ACK       0x01
+#define VIRTIO_STATUS_DRIVER    0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED    0x80
+
+#define VIRTIO_BLK_F_SIZE_MAX  (1u << 1)
+#define VIRTIO_BLK_F_SEG_MAX   (1u << 2)
+#define VIRTIO_BLK_F_FLUSH     (1u << 9)
+
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_T_FLUSH  4
+#define VIRTIO_BLK_S_OK     0
+
+#define VRING_DESC_F_NEXT        1
+#define VRING_DESC_F_WRITE       2
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY   1
+
+#define VIRTIO_MAX_QUEUE     256
+#define VIRTIO_QUEUE_BYTES   12288  // desc + avail, page aligned used ring, for 256 entries
+#define VIRTIO_MAX_REQS      32
+#define VIRTIO_REQ_SECTORS   256
+#define VIRTIO_MAX_SEGS      8
+#define VIRTIO_TIMEOUT       10000000
+#define VIRTIO_ASYNC_TIMEOUT_TICKS 500  // 5 s at 100 Hz
+
+typedef struct {
+    uint32_t addr;
+    uint32_t addr_hi;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_header_t;
+
+typedef struct {
+    virtio_blk_header_t header;
+    volatile uint8_t status;
+    int busy;
+    uint16_t head;
+} virtio_request_t;
+
+typedef struct {
+    vring_desc_t* desc;
+    volatile vring_avail_t* avail;
+    volatile vring_used_t* used;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t avail_idx;
+    uint16_t last_used;
+    virtio_request_t reqs[VIRTIO_MAX_REQS];
+} virtio_queue_t;
+
+// A transfer being cut into requests. `pending` stays set until its last
+// request is queued (a flush is one request with no data).
+typedef struct {
+    uint32_t type;
+    uint64_t lba;
+    uint32_t count;
+    uint8_t* buf;
+    int pending;
+    int inflight;
+    int failed;
+} virtio_job_t;
+
+// Background transfer on a device, see virtio_blk_start.
+typedef struct {
+    int busy;
+    virtio_job_t job;
+    uint32_t progress_at;   // tick of the last completion
+    bios_disk_done_t done;
+    void* ctx;
+} virtio_async_t;
+
+static uint8_t queue_memory[VIRTIO_BLK_MAX_DEVICES][VIRTIO_QUEUE_BYTES] __attribute__((aligned(4096)));
+static virtio_queue_t queues[VIRTIO_BLK_MAX_DEVICES];
+static virtio_blk_device_t devices[VIRTIO_BLK_MAX_DEVICES];
+static virtio_async_t async_req[VIRTIO_BLK_MAX_DEVICES];
+static int device_count = 0;
+static int probed = 0;
+
+static void barrier(void) {
+    __asm__ volatile ("" : : : "memory");
+}
+
+static uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static int setup_queue(int index) {
+    virtio_blk_device_t* d = &devices[index];
+    virtio_queue_t* q = &queues[index];
+    outw(d->io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+    uint16_t size = inw(d->io_base + VIRTIO_REG_QUEUE_SIZE);
+    if (size < 3 || size > VIRTIO_MAX_QUEUE) return -1;
+
+    uint8_t* mem = queue_memory[index];
+    for (uint32_t i = 0; i < VIRTIO_QUEUE_BYTES; i++) mem[i] = 0;
+    uint32_t avail_off = 16u * size;
+    uint32_t used_off = align_up(avail_off + 6u + 2u * size, 4096);
+    q->desc = (vring_desc_t*)mem;
+    q->avail = (volatile vring_avail_t*)(mem + avail_off);
+    q->used = (volatile vring_used_t*)(mem + used_off);
+    for (uint16_t i = 0; i < size; i++) q->desc[i].next = (uint16_t)(i + 1);
+    q->free_head = 0;
+    q->num_free = size;
+    q->avail_idx = 0;
+    q->last_used = 0;
+    for (int i = 0; i < VIRTIO_MAX_REQS; i++) q->reqs[i].busy = 0;
+    // Completions are polled, so ask the device not to interrupt.
+    q->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    d->queue_size = size;
+    outl(d->io_base + VIRTIO_REG_QUEUE_PFN, (uint32_t)(uintptr_t)mem >> 12);
+    return 0;
+}
+
+static int probe_device(const pci_device_t* p) {
+    if (device_count >= VIRTIO_BLK_MAX_DEVICES) return -1;
+    uint32_t bar0 = pci_read_config_dword(p->bus, p->slot, p->func, 0x10);
+    if (!(bar0 & 1)) return -1;
+    // I/O space and bus mastering on, INTx off: nothing here waits on an IRQ.
+    uint32_t cmd = pci_read_config_dword(p->bus, p->slot, p->func, 0x04);
+    pci_write_config_dword(p->bus, p->slot, p->func, 0x04, (cmd & 0xFFFF) | 0x0405);
+
+    int index = device_count;
+    virtio_blk_device_t* d = &devices[index];
+    d->io_base = (uint16_t)(bar0 & 0xFFFC);
+    outb(d->io_base + VIRTIO_REG_STATUS, 0);
+    outb(d->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK);
+    outb(d->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inl(d->io_base + VIRTIO_REG_HOST_FEATURES);
+    features &= VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_FLUSH;
+    outl(d->io_base + VIRTIO_REG_GUEST_FEATURES, features);
+
+    uint16_t cfg = d->io_base + VIRTIO_REG_CONFIG;
+    d->sectors = (uint64_t)inl(cfg) | ((uint64_t)inl(cfg + 4) << 32);
+    d->seg_bytes = 65536;
+    if (features & VIRTIO_BLK_F_SIZE_MAX) {
+        uint32_t size_max = inl(cfg + 8);
+        if (size_max >= VIRTIO_BLK_SECTOR_SIZE && size_max < d->seg_bytes) {
+            d->seg_bytes = size_max & ~(uint32_t)(VIRTIO_BLK_SECTOR_SIZE - 1);
+        }
+    }
+    d->seg_max = VIRTIO_MAX_SEGS;
+    if (features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t seg_max = inl(cfg + 12);
+        if (seg_max > 0 && seg_max < d->seg_max) d->seg_max = seg_max;
+    }
+    d->flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+
+    if (setup_queue(index) != 0) {
+        outb(d->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    // Every request needs a header and a status descriptor besides its data.
+    if (d->seg_max > (uint32_t)d->queue_size - 2) d->seg_max = d->queue_size - 2;
+    outb(d->io_base + VIRTIO_REG_STATUS,
+         VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    d->present = 1;
+    device_count++;
+    return 0;
+}
+
+int virtio_blk_init(void) {
+    if (probed) return device_count;
+    probed = 1;
+    pci_device_t pci[32];
+    int found = pci_enumerate(pci, 32);
+    for (int i = 0; i < found && i < 32; i++) {
+        if (pci[i].vendor_id != VIRTIO_PCI_VENDOR || pci[i].device_id != VIRTIO_PCI_BLK_LEGACY) continue;
+        probe_device(&pci[i]);
+    }
+    return device_count;
+}
+
+int virtio_blk_device_count(void) {
+    return device_count;
+}
+
+const virtio_blk_device_t* virtio_blk_get_device(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return &devices[index];
+}
+
+static uint16_t alloc_desc(virtio_queue_t* q) {
+    uint16_t i = q->free_head;
+    q->free_head = q->desc[i].next;
+    q->num_free--;
+    return i;
+}
+
+static void free_chain(virtio_queue_t* q, uint16_t head) {
+    uint16_t i = head;
+    for (;;) {
+        uint16_t flags = q->desc[i].flags;
+        uint16_t next = q->desc[i].next;
+        q->desc[i].next = q->free_head;
+        q->free_head = i;
+        q->num_free++;
+        if (!(flags & VRING_DESC_F_NEXT)) break;
+        i = next;
+    }
+}
+
+static uint16_t add_desc(virtio_queue_t* q, uint16_t prev, int first, const void* addr, uint32_t len, uint16_t flags) {
+    uint16_t i = alloc_desc(q);
+    q->desc[i].addr = (uint32_t)(uintptr_t)addr;
+    q->desc[i].addr_hi = 0;
+    q->desc[i].len = len;
+    q->desc[i].flags = flags;
+    if (!first) {
+        q->desc[prev].flags |= VRING_DESC_F_NEXT;
+        q->desc[prev].next = i;
+    }
+    return i;
+}
+
+// Builds one request chain and places it on the avail ring without
+// publishing it. Returns 0, or -1 when no request slot or descriptors are
+// free.
+static int queue_request(int index, uint32_t type, uint64_t lba, uint8_t* buf, uint32_t sectors) {
+    const virtio_blk_device_t* d = &devices[index];
+    virtio_queue_t* q = &queues[index];
+    uint32_t bytes = sectors * VIRTIO_BLK_SECTOR_SIZE;
+    uint32_t segs = bytes ? (bytes + d->seg_bytes - 1) / d->seg_bytes : 0;
+    if (q->num_free < segs + 2) return -1;
+    virtio_request_t* r = 0;
+    for (int i = 0; i < VIRTIO_MAX_REQS; i++) {
+        if (!q->reqs[i].busy) {
+            r = &q->reqs[i];
+            break;
+        }
+    }
+    if (!r) return -1;
+
+    r->busy = 1;
+    r->status = 0xFF;
+    r->header.type = type;
+    r->header.reserved = 0;
+    r->header.sector = lba;
+    uint16_t data_flags = type == VIRTIO_BLK_T_IN ? VRING_DESC_F_WRITE : 0;
+    uint16_t last = add_desc(q, 0, 1, &r->header, sizeof(r->header), 0);
+    r->head = last;
+    while (bytes > 0) {
+        uint32_t n = bytes < d->seg_bytes ? bytes : d->seg_bytes;
+        last = add_desc(q, last, 0, buf, n, data_flags);
+        buf += n;
+        bytes -= n;
+    }
+    add_desc(q, last, 0, (const void*)&r->status, 1, VRING_DESC_F_WRITE);
+    q->avail->ring[q->avail_idx % d->queue_size] = r->head;
+    q->avail_idx++;
+    return 0;
+}
+
+static void publish(int index) {
+    virtio_queue_t* q = &queues[index];
+    barrier();
+    q->avail->idx = q->avail_idx;
+    barrier();
+    if (!(q->used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(devices[index].io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+    }
+}
+
+// Reaps every entry already on the used ring without waiting. Returns the
+// number reaped; `*failed` is set when any reaped request did not complete
+// with VIRTIO_BLK_S_OK.
+static int reap_ready(int index, int* failed) {
+    virtio_queue_t* q = &queues[index];
+    barrier();
+    int reaped = 0;
+    while (q->last_used != q->used->idx) {
+        uint16_t head = (uint16_t)q->used->ring[q->last_used % devices[index].queue_size].id;
+        q->last_used++;
+        for (int i = 0; i < VIRTIO_MAX_REQS; i++) {
+            virtio_request_t* r = &q->reqs[i];
+            if (!r->busy || r->head != head) continue;
+            if (r->status != VIRTIO_BLK_S_OK) *failed = 1;
+            r->busy = 0;
+            break;
+        }
+        free_chain(q, head);
+        reaped++;
+    }
+    return reaped;
+}
+
+// Waits for at least one completion, then reaps like reap_ready. Returns
+// -1 on timeout.
+static int reap(int index, int* failed) {
+    virtio_queue_t* q = &queues[index];
+    uint32_t spins = 0;
+    while (q->used->idx == q->last_used) {
+        if (++spins >= VIRTIO_TIMEOUT) return -1;
+    }
+    return reap_ready(index, failed);
+}
+
+// Queues as many of the job's requests as fit and publishes them.
+static void job_fill(int index, virtio_job_t* job) {
+    const virtio_blk_device_t* d = &devices[index];
+    uint32_t per_req = d->seg_max * (d->seg_bytes / VIRTIO_BLK_SECTOR_SIZE);
+    if (per_req > VIRTIO_REQ_SECTORS) per_req = VIRTIO_REQ_SECTORS;
+    int added = 0;
+    while (job->pending) {
+        uint32_t n = job->count < per_req ? job->count : per_req;
+        if (queue_request(index, job->type, job->lba, job->buf, n) != 0) break;
+        added++;
+        job->buf += n * VIRTIO_BLK_SECTOR_SIZE;
+        job->lba += n;
+        job->count -= n;
+        job->pending = job->count > 0;
+    }
+    if (added) {
+        publish(index);
+        job->inflight += added;
+    }
+}
+
+// The device stopped answering and still owns the descriptors; take it
+// out of service rather than reuse them.
+static void fail_device(int index) {
+    devices[index].present = 0;
+    outb(devices[index].io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+}
+
+static int check_request(int index, uint32_t type, uint64_t lba, uint32_t count, const void* buf) {
+    const virtio_blk_device_t* d = virtio_blk_get_device(index);
+    if (!d || !d->present) return -1;
+    if (type != VIRTIO_BLK_T_FLUSH) {
+        if (count == 0 || !buf) return -1;
+        if (lba >= d->sectors || count > d->sectors - lba) return -1;
+    }
+    return 0;
+}
+
+static void async_finish(int index, int status) {
+    virtio_async_t* r = &async_req[index];
+    r->busy = 0;
+    r->done(r->ctx, status);
+}
+
+// Advances the background transfer on drive `index`: reaps whatever the
+// used ring holds and queues the requests that now fit. Never waits.
+// Returns 1 while the transfer is still running.
+int virtio_blk_poll(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    virtio_async_t* r = &async_req[index];
+    if (!r->busy) return 0;
+    int reaped = reap_ready(index, &r->job.failed);
+    if (reaped) {
+        r->job.inflight -= reaped;
+        r->progress_at = timer_ticks();
+    } else if (timer_ticks() - r->progress_at >= VIRTIO_ASYNC_TIMEOUT_TICKS) {
+        fail_device(index);
+        async_finish(index, -1);
+        return 0;
+    }
+    job_fill(index, &r->job);
+    if (r->job.pending || r->job.inflight > 0) return 1;
+    async_finish(index, r->job.failed ? -1 : 0);
+    return 0;
+}
+
+// Blocking calls share the queue with a background transfer; they drive
+// it to completion first.
+static void wait_idle(int index) {
+    while (virtio_blk_poll(index)) {
+    }
+}
+
+static int transfer(int index, uint32_t type, uint64_t lba, uint32_t count, uint8_t* buf) {
+    if (check_request(index, type, lba, count, buf) != 0) return -1;
+    wait_idle(index);
+    if (!devices[index].present) return -1;
+    virtio_job_t job = { type, lba, count, buf, 1, 0, 0 };
+    while (job.pending || job.inflight > 0) {
+        job_fill(index, &job);
+        int reaped = reap(index, &job.failed);
+        if (reaped < 0) {
+            fail_device(index);
+            return -1;
+        }
+        job.inflight -= reaped;
+    }
+    return job.failed ? -1 : 0;
+}
+
+int virtio_blk_read(int index, uint64_t lba, uint32_t count, void* out) {
+    return transfer(index, VIRTIO_BLK_T_IN, lba, count, (uint8_t*)out);
+}
+
+int virtio_blk_write(int index, uint64_t lba, uint32_t count, const void* in) {
+    if (transfer(index, VIRTIO_BLK_T_OUT, lba, count, (uint8_t*)in) != 0) return -1;
+    return virtio_blk_flush(index);
+}
+
+// Begins a transfer that virtio_blk_poll carries on; `done` runs from
+// virtio_blk_poll (or from a blocking call on the same drive) once it ends.
+// Writes are not flushed; see virtio_blk_flush. Returns -1 when the drive
+// already has one.
+int virtio_blk_start(int index, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx) {
+    uint32_t type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    if (check_request(index, type, lba, count, buf) != 0 || !done) return -1;
+    virtio_async_t* r = &async_req[index];
+    if (r->busy) return -1;
+    virtio_job_t job = { type, lba, count, (uint8_t*)buf, 1, 0, 0 };
+    r->job = job;
+    r->busy = 1;
+    r->progress_at = timer_ticks();
+    r->done = done;
+    r->ctx = ctx;
+    job_fill(index, &r->job);
+    return 0;
+}
+
+int virtio_blk_flush(int index) {
+    const virtio_blk_device_t* d = virtio_blk_get_device(index);
+    if (!d || !d->present) return -1;
+    if (!d->flush) return 0;
+    return transfer(index, VIRTIO_BLK_T_FLUSH, 0, 0, 0);
+}
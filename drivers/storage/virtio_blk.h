@@ -0,0 +1,29 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include "bios_disk.h"
+
+#define VIRTIO_BLK_MAX_DEVICES 4
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+typedef struct {
+    int present;
+    uint16_t io_base;
+    uint64_t sectors;
+    uint16_t queue_size;
+    uint32_t seg_bytes;     // largest data segment the device accepts
+    uint32_t seg_max;       // data segments per request
+    int flush;
+} virtio_blk_device_t;
+
+int virtio_blk_init(void);
+int virtio_blk_device_count(void);
+const virtio_blk_device_t* virtio_blk_get_device(int index);
+int virtio_blk_read(int index, uint64_t lba, uint32_t count, void* out);
+int virtio_blk_write(int index, uint64_t lba, uint32_t count, const void* in);
+int virtio_blk_start(int index, uint64_t lba, uint32_t count, void* buf, int write, bios_disk_done_t done, void* ctx);
+int virtio_blk_poll(int index);
+int virtio_blk_flush(int index);
+
+#endif
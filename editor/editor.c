@@ -191,13 +191,12 @@ static void load_file(void) {
     buf_len = 0;
     cursor = 0;
     view_line = 0;
-    FileHandle* fh = fs_open(edit_filename);
+    fs_handle_t fh = fs_open(edit_filename);
     if (!fh) return;
-    size_t n;
-    uint8_t tmp[128];
-    while ((n = fs_read(fh, tmp, sizeof(tmp))) > 0) {
-        for (size_t i = 0; i < n && buf_len < EDITOR_MAX_SIZE - 1; i++) {
-            editor_buf[buf_len++] = (char)tmp[i];
+    FsSpan span;
+    while (fs_view(fh, &span) > 0) {
+        for (size_t i = 0; i < span.len && buf_len < EDITOR_MAX_SIZE - 1; i++) {
+            editor_buf[buf_len++] = (char)span.data[i];
         }
         if (buf_len >= EDITOR_MAX_SIZE - 1) break;
     }
@@ -0,0 +1,91 @@
+#include "blockstore.h"
+#include "../lib/crc32c.h"
+#include "../lib/memory.h"
+#include "../lib/string.h"
+
+#define BLOCK_HASH_BUCKETS 256
+
+static fs_block_t* buckets[BLOCK_HASH_BUCKETS];
+static fs_block_stats_t stats;
+
+static void index_remove(fs_block_t* block) {
+    fs_block_t** link = &buckets[block->hash % BLOCK_HASH_BUCKETS];
+    while (*link) {
+        if (*link == block) {
+            *link = block->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    block->hash_next = NULL;
+    block->sealed = 0;
+    stats.sealed_blocks--;
+}
+
+fs_block_t* fs_block_alloc(void) {
+    fs_block_t* block = (fs_block_t*)kmalloc(sizeof(fs_block_t));
+    if (!block) return NULL;
+    memset(block, 0, sizeof(fs_block_t));
+    block->refcount = 1;
+    stats.physical_blocks++;
+    stats.block_refs++;
+    return block;
+}
+
+void fs_block_get(fs_block_t* block) {
+    if (!block) return;
+    block->refcount++;
+    stats.block_refs++;
+}
+
+void fs_block_put(fs_block_t* block) {
+    if (!block || block->refcount == 0) return;
+    stats.block_refs--;
+    if (--block->refcount > 0) return;
+    if (block->sealed) index_remove(block);
+    stats.physical_blocks--;
+    kfree(block);
+}
+
+// Hashes `block` and looks for an identical sealed block. On a match the
+// caller's reference moves to the existing block and `block` is dropped;
+// otherwise `block` itself is sealed. Either way the returned block must not
+// be written in place.
+fs_block_t* fs_block_seal(fs_block_t* block) {
+    if (!block || block->sealed) return block;
+    uint32_t hash = crc32c(0, block->data, FS_CHUNK_SIZE);
+    fs_block_t** bucket = &buckets[hash % BLOCK_HASH_BUCKETS];
+    for (fs_block_t* it = *bucket; it; it = it->hash_next) {
+        if (it->hash == hash && memcmp(it->data, block->data, FS_CHUNK_SIZE) == 0) {
+            fs_block_get(it);
+            fs_block_put(block);
+            stats.dedup_hits++;
+            return it;
+        }
+    }
+    block->hash = hash;
+    block->sealed = 1;
+    block->hash_next = *bucket;
+    *bucket = block;
+    stats.sealed_blocks++;
+    return block;
+}
+
+// Returns a block the caller may modify: a sealed block that only the caller
+// references leaves the index, a shared one is copied.
+fs_block_t* fs_block_make_private(fs_block_t* block) {
+    if (!block || !block->sealed) return block;
+    if (block->refcount == 1) {
+        index_remove(block);
+        return block;
+    }
+    fs_block_t* copy = fs_block_alloc();
+    if (!copy) return NULL;
+    memcpy(copy->data, block->data, FS_CHUNK_SIZE);
+    fs_block_put(block);
+    return copy;
+}
+
+void fs_block_get_stats(fs_block_stats_t* out) {
+    if (out) *out = stats;
+}
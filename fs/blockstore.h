@@ -0,0 +1,34 @@
+#ifndef BLOCKSTORE_H
+#define BLOCKSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "filesystem.h"
+
+// File data blocks. A block is either private to one file and freely
+// writable, or sealed: hashed, entered in the content index and shared by
+// every file whose block has the same bytes. Sealed blocks are never
+// written in place; writers go through fs_block_make_private first.
+struct fs_block {
+    uint8_t data[FS_CHUNK_SIZE];
+    uint32_t hash;
+    uint32_t refcount;
+    int sealed;
+    fs_block_t* hash_next;
+};
+
+typedef struct {
+    uint32_t physical_blocks;
+    uint32_t block_refs;
+    uint32_t sealed_blocks;
+    uint32_t dedup_hits;
+} fs_block_stats_t;
+
+fs_block_t* fs_block_alloc(void);
+void fs_block_get(fs_block_t* block);
+void fs_block_put(fs_block_t* block);
+fs_block_t* fs_block_seal(fs_block_t* block);
+fs_block_t* fs_block_make_private(fs_block_t* block);
+void fs_block_get_stats(fs_block_stats_t* out);
+
+#endif
@@ -0,0 +1,245 @@
+#include "compress.h"
+#include "blockstore.h"
+#include "../lib/lz.h"
+#include "../lib/memory.h"
+#include "../lib/string.h"
+#include "../drivers/timer/timer.h"
+
+// A packed file is one heap blob: a frame count, the end offset of every
+// compressed frame, then the frames. Frames are compressed independently so
+// a read only has to expand the frame it touches. A frame whose compressed
+// length equals its raw length is stored as is.
+#define PACK_FRAME_SIZE 4096
+
+// Files are packed into pack_stage in one pass, then copied into a blob of
+// the exact size. A file's blocks live on the heap, so the stage only needs
+// to hold as much as the whole heap.
+#define PACK_STAGE_SIZE (64 * 1024)
+
+static uint8_t frame_buf[PACK_FRAME_SIZE];
+static uint8_t pack_stage[PACK_STAGE_SIZE];
+// frame_buf doubles as a one-frame read cache for packed files.
+static const FsNode* frame_owner = NULL;
+static size_t frame_index = 0;
+
+static fs_compress_stats_t stats;
+static int compress_enabled = 1;
+static uint32_t last_poll = 0;
+
+static size_t frame_count(size_t size) {
+    return (size + PACK_FRAME_SIZE - 1) / PACK_FRAME_SIZE;
+}
+
+static size_t frame_len(size_t size, size_t i) {
+    size_t off = i * PACK_FRAME_SIZE;
+    return size - off < PACK_FRAME_SIZE ? size - off : PACK_FRAME_SIZE;
+}
+
+// Compresses frame `i` of a chunked file into `dst`, which has room for
+// `cap` bytes. A frame that does not shrink is stored as is. Returns the
+// stored length, or 0 if it does not fit.
+static size_t pack_frame(const FsNode* file, size_t i, uint8_t* dst, size_t cap) {
+    size_t n = frame_len(file->size, i);
+    size_t base = i * PACK_FRAME_SIZE;
+    for (size_t off = 0; off < n; off += FS_CHUNK_SIZE) {
+        size_t c = n - off < FS_CHUNK_SIZE ? n - off : FS_CHUNK_SIZE;
+        memcpy(frame_buf + off, file->chunks[(base + off) / FS_CHUNK_SIZE]->data, c);
+    }
+    size_t packed = lz_compress(frame_buf, n, dst, cap < n - 1 ? cap : n - 1);
+    if (packed) return packed;
+    if (n > cap) return 0;
+    memcpy(dst, frame_buf, n);
+    return n;
+}
+
+// Expands frame `i` of `file`'s packed blob (of logical `size`) into
+// frame_buf.
+static int load_frame(const FsNode* file, const uint8_t* blob, size_t size, size_t i) {
+    if (frame_owner == file && frame_index == i) {
+        stats.cache_hits++;
+        return 0;
+    }
+    stats.cache_misses++;
+    frame_owner = NULL;
+    const uint32_t* ends = (const uint32_t*)blob;
+    size_t count = ends[0];
+    if (i >= count) return -1;
+    const uint8_t* frames = blob + (count + 1) * sizeof(uint32_t);
+    size_t start = i ? ends[i] : 0;
+    size_t clen = ends[i + 1] - start;
+    size_t n = frame_len(size, i);
+    if (clen == n) {
+        memcpy(frame_buf, frames + start, n);
+    } else if (lz_decompress(frames + start, clen, frame_buf, n) != (int)n) {
+        return -1;
+    }
+    frame_owner = file;
+    frame_index = i;
+    return 0;
+}
+
+// Returns the heap the file's blocks occupy, or 0 if any block is also
+// referenced by another file (packing would then free nothing). A block may
+// repeat within the file itself.
+static size_t private_block_bytes(const FsNode* file) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < file->chunk_count; i++) {
+        const fs_block_t* block = file->chunks[i];
+        uint32_t uses = 0;
+        size_t first = i;
+        for (size_t j = 0; j < file->chunk_count; j++) {
+            if (file->chunks[j] != block) continue;
+            if (j < first) first = j;
+            uses++;
+        }
+        if (uses != block->refcount) return 0;
+        if (first == i) bytes += sizeof(fs_block_t);
+    }
+    return bytes;
+}
+
+// Packs a chunked file that nobody has open, if that saves at least an
+// eighth of the memory its blocks hold.
+int fs_compress_file(FsNode* file) {
+    if (!file || file->type != FS_NODE_FILE || file->packed || file->data) return -1;
+    if (file->flags & FS_NODE_VIRTUAL) return -1;
+    if (file->size < FS_COMPRESS_MIN_SIZE || file->refcount != 1) return -1;
+    size_t held = private_block_bytes(file);
+    if (held == 0) return -1;
+
+    // Packing has to save an eighth of the heap the blocks hold; stop as
+    // soon as the frames so far use more.
+    size_t count = frame_count(file->size);
+    size_t header = (count + 1) * sizeof(uint32_t);
+    size_t limit = held - held / 8;
+    if (limit > PACK_STAGE_SIZE) limit = PACK_STAGE_SIZE;
+    if (header >= limit) return -1;
+    uint32_t* ends = (uint32_t*)pack_stage;
+    size_t total = header;
+    frame_owner = NULL;
+    ends[0] = (uint32_t)count;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = pack_frame(file, i, pack_stage + total, limit - total);
+        if (n == 0) return -1;
+        total += n;
+        ends[i + 1] = (uint32_t)(total - header);
+    }
+    if (total >= limit) return -1;
+
+    uint8_t* blob = (uint8_t*)kmalloc(total);
+    if (!blob) return -1;
+    memcpy(blob, pack_stage, total);
+
+    size_t size = file->size;
+    fs_node_truncate(file, 0);
+    file->size = size;
+    file->packed = blob;
+    file->packed_size = total;
+    stats.packed_files++;
+    stats.logical_bytes += size;
+    stats.packed_bytes += total;
+    return 0;
+}
+
+static void forget_packed(FsNode* file) {
+    if (frame_owner == file) frame_owner = NULL;
+    stats.packed_files--;
+    stats.logical_bytes -= file->size;
+    stats.packed_bytes -= file->packed_size;
+    kfree(file->packed);
+    file->packed = NULL;
+    file->packed_size = 0;
+}
+
+// Rebuilds the file's chunks from its packed form. On failure the file is
+// left packed and intact.
+int fs_decompress_file(FsNode* file) {
+    if (!file || !file->packed) return 0;
+    uint32_t start = timer_ticks();
+    uint8_t* blob = file->packed;
+    size_t size = file->size;
+    size_t count = frame_count(size);
+
+    // Detach the blob so the writes below see an ordinary empty file.
+    file->packed = NULL;
+    file->size = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (load_frame(file, blob, size, i) != 0 ||
+            fs_node_write(file, i * PACK_FRAME_SIZE, frame_buf, frame_len(size, i)) != 0) {
+            fs_node_truncate(file, 0);
+            file->packed = blob;
+            file->size = size;
+            return -1;
+        }
+    }
+    file->packed = blob;
+    forget_packed(file);
+    stats.decompressions++;
+    stats.decompress_ticks += timer_ticks() - start;
+    return 0;
+}
+
+size_t fs_compress_read(const FsNode* file, size_t offset, uint8_t* dst, size_t len) {
+    if (!file || !file->packed || offset >= file->size) return 0;
+    if (len > file->size - offset) len = file->size - offset;
+    size_t done = 0;
+    while (done < len) {
+        size_t pos = offset + done;
+        size_t in_frame = pos % PACK_FRAME_SIZE;
+        size_t n = PACK_FRAME_SIZE - in_frame;
+        if (n > len - done) n = len - done;
+        if (load_frame(file, file->packed, file->size, pos / PACK_FRAME_SIZE) != 0) return done;
+        memcpy(dst + done, frame_buf + in_frame, n);
+        done += n;
+    }
+    return len;
+}
+
+// Drops a packed file's contents outright (file deleted or overwritten).
+void fs_compress_discard(FsNode* file) {
+    if (file && file->packed) forget_packed(file);
+}
+
+// Walks the tree below `dir` in preorder and packs every file idle for at
+// least `idle` ticks. Returns how many were packed.
+static int pack_tree(FsNode* dir, uint32_t now, uint32_t idle) {
+    int packed = 0;
+    FsNode* node = dir;
+    while (node) {
+        for (FsNode* f = node->files; f; f = f->next) {
+            if (now - f->last_access >= idle && fs_compress_file(f) == 0) packed++;
+        }
+        if (node->children) {
+            node = node->children;
+            continue;
+        }
+        while (node != dir && !node->next) node = node->parent;
+        node = (node == dir) ? NULL : node->next;
+    }
+    return packed;
+}
+
+// Called from the kernel idle loop.
+void fs_compress_poll(void) {
+    if (!compress_enabled) return;
+    uint32_t now = timer_ticks();
+    if (now - last_poll < FS_COMPRESS_POLL_TICKS) return;
+    last_poll = now;
+    pack_tree(fs_get_root(), now, FS_COMPRESS_IDLE_TICKS);
+}
+
+int fs_compress_all(void) {
+    return pack_tree(fs_get_root(), timer_ticks(), 0);
+}
+
+void fs_compress_set_enabled(int enabled) {
+    compress_enabled = enabled;
+}
+
+int fs_compress_enabled(void) {
+    return compress_enabled;
+}
+
+void fs_compress_get_stats(fs_compress_stats_t* out) {
+    if (out) *out = stats;
+}
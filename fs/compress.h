@@ -0,0 +1,37 @@
+#ifndef FS_COMPRESS_H
+#define FS_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "filesystem.h"
+
+// Files untouched for this long (timer ticks at 100 Hz) are packed by the
+// background pass, which runs at most every FS_COMPRESS_POLL_TICKS.
+#define FS_COMPRESS_IDLE_TICKS 3000
+#define FS_COMPRESS_POLL_TICKS 500
+// Smaller files are not worth the frame table overhead.
+#define FS_COMPRESS_MIN_SIZE   1024
+
+typedef struct {
+    uint32_t packed_files;
+    uint32_t logical_bytes;     // uncompressed size of the packed files
+    uint32_t packed_bytes;      // heap they occupy now
+    uint32_t decompressions;    // files unpacked on open or write
+    uint32_t decompress_ticks;  // total time spent unpacking
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+} fs_compress_stats_t;
+
+void fs_compress_poll(void);
+int fs_compress_all(void);
+void fs_compress_set_enabled(int enabled);
+int fs_compress_enabled(void);
+void fs_compress_get_stats(fs_compress_stats_t* out);
+
+// Used by the filesystem core.
+int fs_compress_file(FsNode* file);
+int fs_decompress_file(FsNode* file);
+size_t fs_compress_read(const FsNode* file, size_t offset, uint8_t* dst, size_t len);
+void fs_compress_discard(FsNode* file);
+
+#endif
@@ -0,0 +1,512 @@
+#include "ext2.h"
+#include "filesystem.h"
+#include "../drivers/storage/bios_disk.h"
+#include "../drivers/storage/bcache.h"
+#include "../lib/memory.h"
+#include "../lib/string.h"
+
+// Read-only ext2 driver mounted into the filesystem tree through fs_mount.
+// Revision 0 and 1 volumes with 1, 2 or 4 KiB blocks are supported; ext3
+// volumes mount as well once their journal has been replayed. All disk
+// access goes through the buffer cache.
+//
+// Each group's inode table location is read from the group descriptors at
+// mount time. Inodes are loaded from a cache of 4 KiB inode table chunks,
+// so files created together (and so stored next to each other in their
+// group) share one read. The indirect block last used at each level stays
+// in memory: mapping a run of file blocks reads every indirect block once
+// and then walks its entries, and reads are split only where the physical
+// blocks stop being contiguous, so a sequential reader turns into one block
+// request per extent rather than one per block.
+//
+// Only regular files and directories are listed; symlinks, devices and
+// the like are skipped.
+
+extern void print(const char*);
+
+#define SECTOR 512
+#define EXT2_SUPER_LBA 2
+#define EXT2_MAGIC 0xEF53
+#define EXT2_ROOT_INO 2
+#define EXT2_MAX_BLOCK 4096
+#define EXT2_NAME_MAX 255
+#define EXT2_N_DIRECT 12
+#define EXT2_N_BLOCKS 15
+#define EXT2_GROUP_DESC_SIZE 32
+
+#define EXT2_ITABLE_SLOTS 16
+#define EXT2_ITABLE_CHUNK 4096
+#define EXT2_ITABLE_SECTORS (EXT2_ITABLE_CHUNK / SECTOR)
+
+#define INCOMPAT_FILETYPE 0x0002
+#define INCOMPAT_RECOVER  0x0004
+#define INCOMPAT_FLEX_BG  0x0200
+#define INCOMPAT_SUPPORTED (INCOMPAT_FILETYPE | INCOMPAT_FLEX_BG)
+
+#define MODE_TYPE 0xF000
+#define MODE_DIR  0x4000
+#define MODE_REG  0x8000
+
+#define FT_REG_FILE 1
+#define FT_DIR      2
+
+typedef struct {
+    uint16_t mode;
+    uint32_t size;
+    uint32_t size_high;     // regular files only
+    uint32_t block[EXT2_N_BLOCKS];
+} ext2_inode_t;
+
+typedef struct {
+    char name[EXT2_NAME_MAX + 1];
+    uint32_t ino;
+    uint8_t type;           // FT_*, 0 when the directory does not say
+} ext2_dirent_t;
+
+typedef struct {
+    int mounted;
+    uint8_t drive;
+    uint64_t sectors;
+    uint32_t block_size;
+    uint32_t block_shift;
+    uint32_t sectors_per_block;
+    uint32_t ptrs;              // block numbers per indirect block
+    uint32_t ptr_shift;
+    uint32_t blocks;
+    uint32_t inodes;
+    uint32_t inodes_per_group;
+    uint32_t inode_size;
+    uint32_t groups;
+    int filetype;               // directory entries carry the file type
+    // One staged directory block.
+    uint8_t dir_block[EXT2_MAX_BLOCK];
+    uint32_t dir_ino;
+    uint32_t dir_index;
+    int dir_valid;
+    uint8_t bounce[SECTOR];
+} ext2_volume_t;
+
+typedef struct {
+    int valid;
+    uint32_t sector;
+    uint8_t data[EXT2_ITABLE_CHUNK];
+} ext2_itable_t;
+
+typedef struct {
+    int valid;
+    uint32_t block;
+    uint32_t data[EXT2_MAX_BLOCK / 4];
+} ext2_indirect_t;
+
+typedef struct {
+    ext2_inode_t inode;
+} ext2_file_t;
+
+typedef struct {
+    uint32_t ino;
+    ext2_inode_t inode;
+    uint32_t pos;
+} ext2_dir_t;
+
+static ext2_volume_t vol;
+static uint32_t group_itable[EXT2_MAX_GROUPS];     // first inode table block
+static ext2_itable_t itable[EXT2_ITABLE_SLOTS];
+static ext2_indirect_t indirect[3];                // by level, 0 = points at data
+static ext2_dirent_t found;     // result of the last lookup
+static ext2_dirent_t listed;    // scratch for directory listings
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t block_lba(uint32_t block) {
+    return block * vol.sectors_per_block;
+}
+
+// ---- Inodes ----
+
+static int inode_read(uint32_t ino, ext2_inode_t* out) {
+    if (ino == 0 || ino > vol.inodes) return -1;
+    uint32_t group = (ino - 1) / vol.inodes_per_group;
+    uint32_t byte = (ino - 1) % vol.inodes_per_group * vol.inode_size;
+    if (group >= vol.groups) return -1;
+    uint32_t sector = block_lba(group_itable[group]) + byte / SECTOR;
+    uint32_t chunk = sector & ~(uint32_t)(EXT2_ITABLE_SECTORS - 1);
+    ext2_itable_t* slot = &itable[(chunk / EXT2_ITABLE_SECTORS) % EXT2_ITABLE_SLOTS];
+    if (!slot->valid || slot->sector != chunk) {
+        uint32_t count = EXT2_ITABLE_SECTORS;
+        if (chunk + count > vol.sectors) count = (uint32_t)(vol.sectors - chunk);
+        slot->valid = 0;
+        if (sector >= vol.sectors || bcache_read(vol.drive, chunk, count, slot->data) != 0) return -1;
+        slot->sector = chunk;
+        slot->valid = 1;
+    }
+    // Inodes are at most a sector long, so one never straddles chunks.
+    const uint8_t* p = slot->data + (sector - chunk) * SECTOR + byte % SECTOR;
+    out->mode = get_u16(p);
+    out->size = get_u32(p + 4);
+    out->size_high = (out->mode & MODE_TYPE) == MODE_REG ? get_u32(p + 108) : 0;
+    for (int i = 0; i < EXT2_N_BLOCKS; i++) out->block[i] = get_u32(p + 40 + i * 4);
+    return 0;
+}
+
+// ---- Block map ----
+
+static const uint32_t* indirect_load(int level, uint32_t block) {
+    ext2_indirect_t* c = &indirect[level];
+    if (c->valid && c->block == block) return c->data;
+    c->valid = 0;
+    if (block >= vol.blocks) return NULL;
+    if (bcache_read(vol.drive, block_lba(block), vol.sectors_per_block, c->data) != 0) return NULL;
+    c->block = block;
+    c->valid = 1;
+    return c->data;
+}
+
+// Maps file block `index` to its disk block, 0 for a hole.
+static int block_map(const ext2_inode_t* inode, uint32_t index, uint32_t* out) {
+    uint32_t p = vol.ptrs;
+    int level;
+    uint32_t b;
+    if (index < EXT2_N_DIRECT) {
+        *out = inode->block[index];
+        return 0;
+    }
+    index -= EXT2_N_DIRECT;
+    if (index < p) {
+        level = 0;
+        b = inode->block[12];
+    } else if (index - p < p * p) {
+        index -= p;
+        level = 1;
+        b = inode->block[13];
+    } else {
+        index -= p + p * p;
+        if (index >= p * p * p) return -1;
+        level = 2;
+        b = inode->block[14];
+    }
+    for (; level >= 0; level--) {
+        if (b == 0) break;
+        const uint32_t* table = indirect_load(level, b);
+        if (!table) return -1;
+        b = table[(index >> (level * vol.ptr_shift)) & (p - 1)];
+    }
+    *out = b;
+    return 0;
+}
+
+// Maps up to `want` file blocks from `index` on, stopping where the disk
+// blocks stop being consecutive (or a hole starts or ends). Returns the
+// run length, 0 on error; `*first` is the run's first disk block, 0 for a
+// hole.
+static uint32_t map_run(const ext2_inode_t* inode, uint32_t index, uint32_t want, uint32_t* first) {
+    if (block_map(inode, index, first) != 0) return 0;
+    uint32_t run = 1;
+    while (run < want) {
+        uint32_t next;
+        if (block_map(inode, index + run, &next) != 0) break;
+        if (*first ? next != *first + run : next != 0) break;
+        run++;
+    }
+    if (*first && (*first >= vol.blocks || run > vol.blocks - *first)) return 0;
+    return run;
+}
+
+// Reads `len` bytes starting `offset` bytes into sector `lba`. Whole
+// sectors go to the cache in one request; partial ones through the bounce
+// sector.
+static int transfer(uint32_t lba, uint32_t offset, uint8_t* buf, uint32_t len) {
+    lba += offset / SECTOR;
+    offset %= SECTOR;
+    while (len > 0) {
+        if (offset == 0 && len >= SECTOR) {
+            uint32_t count = len / SECTOR;
+            if (bcache_read(vol.drive, lba, count, buf) != 0) return -1;
+            lba += count;
+            buf += count * SECTOR;
+            len -= count * SECTOR;
+            continue;
+        }
+        uint32_t n = SECTOR - offset;
+        if (n > len) n = len;
+        if (bcache_read(vol.drive, lba, 1, vol.bounce) != 0) return -1;
+        memcpy(buf, vol.bounce + offset, n);
+        lba++;
+        offset = 0;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static size_t file_read(const ext2_inode_t* inode, uint32_t offset, uint8_t* buf, uint32_t len) {
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t pos = offset + done;
+        uint32_t index = pos >> vol.block_shift;
+        uint32_t in = pos & (vol.block_size - 1);
+        uint32_t want = (in + (len - done) + vol.block_size - 1) >> vol.block_shift;
+        uint32_t first;
+        uint32_t run = map_run(inode, index, want, &first);
+        if (run == 0) break;
+        uint32_t n = run * vol.block_size - in;
+        if (n > len - done) n = len - done;
+        if (first == 0) memset(buf + done, 0, n);
+        else if (transfer(block_lba(first), in, buf + done, n) != 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// ---- Directories ----
+
+static const uint8_t* load_dir_block(uint32_t ino, const ext2_inode_t* inode, uint32_t index) {
+    if (vol.dir_valid && vol.dir_ino == ino && vol.dir_index == index) return vol.dir_block;
+    vol.dir_valid = 0;
+    uint32_t b;
+    if (block_map(inode, index, &b) != 0 || b == 0 || b >= vol.blocks) return NULL;
+    if (bcache_read(vol.drive, block_lba(b), vol.sectors_per_block, vol.dir_block) != 0) return NULL;
+    vol.dir_ino = ino;
+    vol.dir_index = index;
+    vol.dir_valid = 1;
+    return vol.dir_block;
+}
+
+// Returns the next entry other than "." and "..", 0 at the end of the
+// directory or -1 on a read error or corrupt entry. Entries never cross a
+// block.
+static int dir_next(ext2_dir_t* d, ext2_dirent_t* out) {
+    while (d->pos < d->inode.size) {
+        uint32_t off = d->pos & (vol.block_size - 1);
+        const uint8_t* b = load_dir_block(d->ino, &d->inode, d->pos >> vol.block_shift);
+        if (!b) return -1;
+        const uint8_t* e = b + off;
+        uint32_t ino = get_u32(e);
+        uint32_t rec_len = get_u16(e + 4);
+        uint32_t name_len = e[6];
+        if (rec_len < 8 || (rec_len & 3) || off + rec_len > vol.block_size || 8 + name_len > rec_len) return -1;
+        d->pos += rec_len;
+        if (ino == 0 || name_len == 0) continue;
+        if (e[8] == '.' && (name_len == 1 || (name_len == 2 && e[9] == '.'))) continue;
+        memcpy(out->name, e + 8, name_len);
+        out->name[name_len] = '\0';
+        out->ino = ino;
+        out->type = vol.filetype ? e[7] : 0;
+        return 1;
+    }
+    return 0;
+}
+
+static int dir_open(uint32_t ino, ext2_dir_t* d) {
+    if (inode_read(ino, &d->inode) != 0 || (d->inode.mode & MODE_TYPE) != MODE_DIR) return -1;
+    d->ino = ino;
+    d->pos = 0;
+    return 0;
+}
+
+// Looks `name` up in directory `dir`; the entry is left in `found`. Names
+// are case-sensitive.
+static int dir_lookup(uint32_t dir, const char* name, size_t len) {
+    ext2_dir_t d;
+    if (dir_open(dir, &d) != 0) return 0;
+    while (dir_next(&d, &found) == 1) {
+        if (strlen(found.name) == len && memcmp(found.name, name, len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Resolves `path` to an inode number; the root for "".
+static int walk_path(const char* path, uint32_t* ino) {
+    *ino = EXT2_ROOT_INO;
+    const char* p = path;
+    for (;;) {
+        while (*p == '/') p++;
+        if (*p == '\0') return 0;
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        if (!dir_lookup(*ino, start, (size_t)(p - start))) return -1;
+        *ino = found.ino;
+    }
+}
+
+// ---- fs_mount_ops ----
+
+static void* ext2_open(void* v, const char* path, int flags) {
+    (void)v;
+    uint32_t ino;
+    ext2_inode_t inode;
+    if (flags || walk_path(path, &ino) != 0 || inode_read(ino, &inode) != 0) return NULL;
+    // size_t cannot describe files of 4 GiB and more.
+    if ((inode.mode & MODE_TYPE) != MODE_REG || inode.size_high) return NULL;
+    ext2_file_t* f = (ext2_file_t*)kmalloc(sizeof(ext2_file_t));
+    if (!f) return NULL;
+    f->inode = inode;
+    return f;
+}
+
+static size_t ext2_read(void* file, size_t offset, uint8_t* buf, size_t len) {
+    ext2_file_t* f = (ext2_file_t*)file;
+    if (offset >= f->inode.size) return 0;
+    if (len > f->inode.size - offset) len = f->inode.size - offset;
+    return file_read(&f->inode, (uint32_t)offset, buf, (uint32_t)len);
+}
+
+static size_t ext2_size(void* file) {
+    return ((ext2_file_t*)file)->inode.size;
+}
+
+static void ext2_close(void* file) {
+    kfree(file);
+}
+
+static void* ext2_opendir(void* v, const char* path) {
+    (void)v;
+    uint32_t ino;
+    if (walk_path(path, &ino) != 0) return NULL;
+    ext2_dir_t* d = (ext2_dir_t*)kmalloc(sizeof(ext2_dir_t));
+    if (!d) return NULL;
+    if (dir_open(ino, d) != 0) {
+        kfree(d);
+        return NULL;
+    }
+    return d;
+}
+
+// Type-less entries (no filetype feature) need their inode for it; files
+// need it for the size anyway.
+static int ext2_readdir(void* dir, FsDirEntry* out) {
+    ext2_dir_t* d = (ext2_dir_t*)dir;
+    int rc;
+    while ((rc = dir_next(d, &listed)) == 1) {
+        if (listed.type && listed.type != FT_REG_FILE && listed.type != FT_DIR) continue;
+        ext2_inode_t inode;
+        if (inode_read(listed.ino, &inode) != 0) return -1;
+        uint32_t type = inode.mode & MODE_TYPE;
+        if (type != MODE_REG && type != MODE_DIR) continue;
+        size_t len = strlen(listed.name);
+        if (len >= MAX_NAME_LEN) len = MAX_NAME_LEN - 1;
+        memcpy(out->name, listed.name, len);
+        out->name[len] = '\0';
+        out->type = type == MODE_DIR ? FS_NODE_DIR : FS_NODE_FILE;
+        out->size = type == MODE_DIR ? 0 : inode.size;
+        return 1;
+    }
+    return rc;
+}
+
+static size_t ext2_dircount(void* dir) {
+    ext2_dir_t d = *(ext2_dir_t*)dir;
+    FsDirEntry e;
+    size_t count = 0;
+    d.pos = 0;
+    while (ext2_readdir(&d, &e) == 1) count++;
+    return count;
+}
+
+static void ext2_closedir(void* dir) {
+    kfree(dir);
+}
+
+static void ext2_unmount(void* v) {
+    (void)v;
+    vol.mounted = 0;
+}
+
+static const fs_mount_ops_t ext2_ops = {
+    "ext2",
+    ext2_open,
+    ext2_read,
+    0,
+    ext2_size,
+    ext2_close,
+    ext2_opendir,
+    ext2_readdir,
+    ext2_dircount,
+    ext2_closedir,
+    0,
+    0,
+    ext2_unmount,
+};
+
+// ---- Mounting ----
+
+static int load_group_descriptors(uint32_t first_data_block) {
+    uint32_t per_block = vol.block_size / EXT2_GROUP_DESC_SIZE;
+    uint8_t* buf = vol.dir_block;
+    for (uint32_t g = 0; g < vol.groups; g++) {
+        if (g % per_block == 0) {
+            uint32_t b = first_data_block + 1 + g / per_block;
+            if (bcache_read(vol.drive, block_lba(b), vol.sectors_per_block, buf) != 0) return -1;
+        }
+        group_itable[g] = get_u32(buf + (g % per_block) * EXT2_GROUP_DESC_SIZE + 8);
+        if (group_itable[g] == 0 || group_itable[g] >= vol.blocks) return -1;
+    }
+    return 0;
+}
+
+int ext2_mount(uint8_t drive, const char* path) {
+    if (vol.mounted) {
+        print("ext2: a volume is already mounted\n");
+        return -1;
+    }
+    const bios_drive_info_t* info = NULL;
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present && d->drive == drive) info = d;
+    }
+    if (!info || info->sector_size != SECTOR) return -1;
+
+    uint8_t* sb = vol.dir_block;
+    vol.drive = drive;
+    vol.sectors = info->sectors;
+    if (bcache_read(drive, EXT2_SUPER_LBA, 2, sb) != 0) return -1;
+    if (get_u16(sb + 56) != EXT2_MAGIC) return -1;
+    uint32_t log_block = get_u32(sb + 24);
+    uint32_t incompat = get_u32(sb + 96);
+    if (log_block > 2) return -1;
+    if (incompat & INCOMPAT_RECOVER) {
+        print("ext2: the journal needs recovery; mount it on Linux first\n");
+        return -1;
+    }
+    if (incompat & ~(uint32_t)INCOMPAT_SUPPORTED) {
+        print("ext2: volume uses unsupported features\n");
+        return -1;
+    }
+    vol.block_size = 1024u << log_block;
+    vol.block_shift = 10 + log_block;
+    vol.sectors_per_block = vol.block_size / SECTOR;
+    vol.ptrs = vol.block_size / 4;
+    vol.ptr_shift = vol.block_shift - 2;
+    vol.inodes = get_u32(sb);
+    vol.blocks = get_u32(sb + 4);
+    vol.inodes_per_group = get_u32(sb + 40);
+    vol.inode_size = get_u32(sb + 76) == 0 ? 128 : get_u16(sb + 88);
+    vol.filetype = (incompat & INCOMPAT_FILETYPE) != 0;
+    uint32_t first_data_block = get_u32(sb + 20);
+    uint32_t blocks_per_group = get_u32(sb + 32);
+    if (blocks_per_group == 0 || vol.inodes_per_group == 0 || vol.blocks <= first_data_block) return -1;
+    if (vol.inode_size < 128 || vol.inode_size > SECTOR || (vol.inode_size & (vol.inode_size - 1))) return -1;
+    if ((uint64_t)vol.blocks * vol.sectors_per_block > info->sectors) return -1;
+    vol.groups = (vol.blocks - first_data_block + blocks_per_group - 1) / blocks_per_group;
+    if (vol.groups > EXT2_MAX_GROUPS) {
+        print("ext2: volume has too many block groups\n");
+        return -1;
+    }
+
+    vol.dir_valid = 0;
+    memset(itable, 0, sizeof(itable));
+    memset(indirect, 0, sizeof(indirect));
+    if (load_group_descriptors(first_data_block) != 0) return -1;
+
+    vol.mounted = 1;
+    if (fs_mount(path, &ext2_ops, &vol) != 0) {
+        vol.mounted = 0;
+        return -1;
+    }
+    return 0;
+}
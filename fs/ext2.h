@@ -0,0 +1,14 @@
+#ifndef EXT2_H
+#define EXT2_H
+
+#include <stdint.h>
+
+// Largest volume whose group descriptors fit the in-memory table: 8192
+// groups, i.e. 1 TiB with 4 KiB blocks. One ext2 volume can be mounted at a
+// time.
+#define EXT2_MAX_GROUPS 8192
+
+// Mounts the ext2 filesystem on `drive` at `path`, read-only.
+int ext2_mount(uint8_t drive, const char* path);
+
+#endif
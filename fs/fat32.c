@@ -0,0 +1,1071 @@
+#include "fat32.h"
+#include "filesystem.h"
+#include "../drivers/storage/bios_disk.h"
+#include "../drivers/storage/bcache.h"
+#include "../lib/memory.h"
+#include "../lib/string.h"
+
+// FAT32 driver mounted into the filesystem tree through fs_mount. All disk
+// access goes through the buffer cache.
+//
+// The whole FAT is read into memory at mount time, alongside a bitmap of
+// free clusters, so following a chain never touches the disk and the
+// allocator can look for contiguous runs a word of the bitmap at a time.
+// Changed FAT sectors are tracked in a dirty bitmap and written to every
+// FAT copy when a file is closed, after each directory change and on
+// unmount. New files get their clusters as one contiguous run whenever
+// free space allows, and a file that grows is first extended into the
+// clusters right after its tail.
+//
+// Reads and writes are split only where a file's chain stops being
+// physically contiguous, so a sequential reader turns into one block
+// request per run of clusters rather than one per cluster. Long file names
+// are read and written; names that fit 8.3 exactly (in one case) are stored
+// as short entries only, using the NT lowercase flags where needed.
+//
+// There is no clock, so every entry is stamped 1980-01-01 00:00.
+
+extern void print(const char*);
+
+#define SECTOR 512
+#define DIRENT_SIZE 32
+#define FAT_MASK 0x0FFFFFFFu
+#define FAT_EOC 0x0FFFFFFFu
+#define FAT_ENTRIES_PER_SECTOR (SECTOR / 4)
+#define FAT_NAME_MAX 255
+#define FAT_DATE_1980 0x0021
+#define FAT_LOAD_SECTORS 128
+
+#define ATTR_READ_ONLY 0x01
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_ARCHIVE   0x20
+#define ATTR_LFN       0x0F
+
+#define NTRES_LOWER_BASE 0x08
+#define NTRES_LOWER_EXT  0x10
+
+#define FSINFO_LEAD_SIG   0x41615252u
+#define FSINFO_STRUCT_SIG 0x61417272u
+
+#define FAT_TABLE_ENTRIES (FAT32_MAX_CLUSTERS + FAT_ENTRIES_PER_SECTOR)
+#define FAT_TABLE_SECTORS (FAT_TABLE_ENTRIES / FAT_ENTRIES_PER_SECTOR)
+
+static uint32_t fat_table[FAT_TABLE_ENTRIES];
+static uint32_t free_map[FAT_TABLE_ENTRIES / 32];     // bit set: cluster free
+static uint32_t fat_dirty[FAT_TABLE_SECTORS / 32 + 1];
+
+// A position in a directory: entry `index` of cluster `cluster`.
+typedef struct {
+    uint32_t cluster;
+    uint32_t index;
+} dirpos_t;
+
+typedef struct {
+    char name[FAT_NAME_MAX + 1];
+    uint8_t attr;
+    uint32_t cluster;
+    uint32_t size;
+    dirpos_t first;     // first slot of the entry (its first LFN slot, if any)
+    dirpos_t slot;      // the short entry itself
+    uint32_t slots;
+} fat_dirent_t;
+
+typedef struct {
+    int mounted;
+    uint8_t drive;
+    uint32_t sectors_per_cluster;
+    uint32_t cluster_bytes;
+    uint32_t entries_per_cluster;
+    uint32_t fat_start;
+    uint32_t fat_sectors;
+    uint32_t num_fats;
+    uint32_t data_start;
+    uint32_t root_cluster;
+    uint32_t fsinfo_sector;
+    uint32_t entries;           // FAT entries in use: clusters + 2
+    uint32_t free_count;
+    uint32_t next_free;
+    // One staged directory sector, written through to the cache.
+    uint8_t sec[SECTOR];
+    uint32_t sec_lba;
+    int sec_valid;
+    uint8_t bounce[SECTOR];
+} fat_volume_t;
+
+// State of an open file. Every handle on the same directory entry shares
+// one of these, so all of them see the same size and chain.
+typedef struct fat_file {
+    uint32_t first;             // 0 for an empty file
+    uint32_t size;
+    uint32_t last;              // last cluster of the chain, 0 if none
+    uint32_t clusters;
+    dirpos_t slot;              // short directory entry
+    int dirty;
+    // Where the previous access ended, so sequential access never rewalks
+    // the chain from the start.
+    uint32_t pos_index;
+    uint32_t pos_cluster;
+    int refs;
+    struct fat_file* next;
+} fat_file_t;
+
+typedef struct {
+    uint32_t start;
+    dirpos_t pos;
+    int done;
+} fat_dir_t;
+
+static fat_volume_t vol;
+static fat_file_t* open_files;  // keyed by their short entry's slot
+static fat_dirent_t found;      // result of the last lookup
+static fat_dirent_t listed;     // scratch for directory listings
+static const uint8_t zero_sector[SECTOR];
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static char to_upper(char c) {
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// ---- FAT and free-cluster bitmap ----
+
+static int cluster_valid(uint32_t c) {
+    return c >= 2 && c < vol.entries;
+}
+
+static uint32_t cluster_lba(uint32_t c) {
+    return vol.data_start + (c - 2) * vol.sectors_per_cluster;
+}
+
+static uint32_t fat_get(uint32_t c) {
+    return fat_table[c] & FAT_MASK;
+}
+
+static int is_free(uint32_t c) {
+    return (free_map[c >> 5] >> (c & 31)) & 1;
+}
+
+static void fat_set(uint32_t c, uint32_t value) {
+    int was_free = is_free(c);
+    fat_table[c] = (fat_table[c] & ~FAT_MASK) | (value & FAT_MASK);
+    fat_dirty[(c / FAT_ENTRIES_PER_SECTOR) >> 5] |= 1u << ((c / FAT_ENTRIES_PER_SECTOR) & 31);
+    if (value == 0 && !was_free) {
+        free_map[c >> 5] |= 1u << (c & 31);
+        vol.free_count++;
+    } else if (value != 0 && was_free) {
+        free_map[c >> 5] &= ~(1u << (c & 31));
+        vol.free_count--;
+    }
+}
+
+// Next cluster of a chain, or 0 at its end.
+static uint32_t chain_next(uint32_t c) {
+    uint32_t next = fat_get(c);
+    return cluster_valid(next) ? next : 0;
+}
+
+static void fsinfo_update(void);
+
+static int fat_flush(void) {
+    int rc = 0;
+    uint32_t sectors = (vol.entries + FAT_ENTRIES_PER_SECTOR - 1) / FAT_ENTRIES_PER_SECTOR;
+    for (uint32_t w = 0; w * 32 < sectors; w++) {
+        while (fat_dirty[w]) {
+            uint32_t bit = 0;
+            while (!(fat_dirty[w] & (1u << bit))) bit++;
+            fat_dirty[w] &= ~(1u << bit);
+            uint32_t s = w * 32 + bit;
+            const uint8_t* data = (const uint8_t*)&fat_table[s * FAT_ENTRIES_PER_SECTOR];
+            for (uint32_t k = 0; k < vol.num_fats; k++) {
+                if (bcache_write(vol.drive, vol.fat_start + k * vol.fat_sectors + s, 1, data) != 0) rc = -1;
+            }
+        }
+    }
+    fsinfo_update();
+    return rc;
+}
+
+// Finds up to `want` free clusters in a row, starting the search at the
+// allocation hint. Returns the first cluster of the run, with its length in
+// `got`; when no run is long enough, the longest one seen is returned.
+static uint32_t find_run(uint32_t want, uint32_t* got) {
+    uint32_t best = 0, best_len = 0;
+    uint32_t run_start = 0, run_len = 0;
+    uint32_t c = cluster_valid(vol.next_free) ? vol.next_free : 2;
+    for (uint32_t n = 0; n < vol.entries - 2; n++, c++) {
+        if (c >= vol.entries) {
+            c = 2;
+            run_len = 0;
+        }
+        if ((c & 31) == 0 && free_map[c >> 5] == 0) {
+            run_len = 0;
+            n += 31;
+            c += 31;
+            continue;
+        }
+        if (!is_free(c)) {
+            run_len = 0;
+            continue;
+        }
+        if (run_len++ == 0) run_start = c;
+        if (run_len > best_len) {
+            best = run_start;
+            best_len = run_len;
+            if (best_len == want) break;
+        }
+    }
+    *got = best_len;
+    return best;
+}
+
+// Appends `count` clusters to the chain ending at `last` (0 for a new
+// chain), preferring the clusters right after `last`, then the fewest runs
+// the free space allows. Returns the first new cluster, or 0 when the
+// volume is too full; nothing is allocated then.
+static uint32_t alloc_clusters(uint32_t last, uint32_t count) {
+    if (count == 0 || count > vol.free_count) return 0;
+    uint32_t first = 0;
+    while (count > 0) {
+        uint32_t start, len = 0;
+        if (last && cluster_valid(last + 1) && is_free(last + 1)) {
+            start = last + 1;
+            while (len < count && cluster_valid(start + len) && is_free(start + len)) len++;
+        } else {
+            start = find_run(count, &len);
+            if (len == 0) return 0;
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            uint32_t c = start + i;
+            fat_set(c, FAT_EOC);
+            if (last) fat_set(last, c);
+            last = c;
+        }
+        if (!first) first = start;
+        count -= len;
+        vol.next_free = last + 1;
+    }
+    return first;
+}
+
+static void free_chain(uint32_t c) {
+    while (cluster_valid(c)) {
+        uint32_t next = fat_get(c);
+        fat_set(c, 0);
+        if (c < vol.next_free) vol.next_free = c;
+        c = next;
+    }
+}
+
+static int zero_cluster(uint32_t c) {
+    uint32_t lba = cluster_lba(c);
+    for (uint32_t i = 0; i < vol.sectors_per_cluster; i++) {
+        if (bcache_write(vol.drive, lba + i, 1, zero_sector) != 0) return -1;
+    }
+    return 0;
+}
+
+// ---- Staged directory sectors ----
+
+static uint8_t* load_sector(uint32_t lba) {
+    if (vol.sec_valid && vol.sec_lba == lba) return vol.sec;
+    vol.sec_valid = 0;
+    if (bcache_read(vol.drive, lba, 1, vol.sec) != 0) return NULL;
+    vol.sec_lba = lba;
+    vol.sec_valid = 1;
+    return vol.sec;
+}
+
+static int store_sector(void) {
+    return bcache_write(vol.drive, vol.sec_lba, 1, vol.sec);
+}
+
+static void fsinfo_update(void) {
+    if (vol.fsinfo_sector == 0 || vol.fsinfo_sector == 0xFFFF) return;
+    uint8_t* s = load_sector(vol.fsinfo_sector);
+    if (!s || get_u32(s) != FSINFO_LEAD_SIG || get_u32(s + 484) != FSINFO_STRUCT_SIG) return;
+    put_u32(s + 488, vol.free_count);
+    put_u32(s + 492, vol.next_free);
+    store_sector();
+}
+
+// ---- Directory entries ----
+
+static uint8_t* dir_entry_at(const dirpos_t* pos) {
+    uint32_t byte = pos->index * DIRENT_SIZE;
+    uint8_t* s = load_sector(cluster_lba(pos->cluster) + byte / SECTOR);
+    return s ? s + byte % SECTOR : NULL;
+}
+
+// Moves to the next slot; returns 0 at the end of the directory's chain.
+static int dir_advance(dirpos_t* pos) {
+    if (++pos->index < vol.entries_per_cluster) return 1;
+    uint32_t next = chain_next(pos->cluster);
+    if (!next) return 0;
+    pos->cluster = next;
+    pos->index = 0;
+    return 1;
+}
+
+static uint8_t short_checksum(const uint8_t* name11) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name11[i]);
+    return sum;
+}
+
+static void short_to_name(const uint8_t* e, char* out) {
+    int n = 0;
+    int lower_base = e[12] & NTRES_LOWER_BASE;
+    int lower_ext = e[12] & NTRES_LOWER_EXT;
+    for (int i = 0; i < 8 && e[i] != ' '; i++) {
+        char c = (i == 0 && e[0] == 0x05) ? (char)0xE5 : (char)e[i];
+        out[n++] = lower_base ? to_lower(c) : c;
+    }
+    if (e[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && e[i] != ' '; i++) out[n++] = lower_ext ? to_lower((char)e[i]) : (char)e[i];
+    }
+    out[n] = '\0';
+}
+
+// UCS-2 offsets of the 13 name characters in a long-name slot.
+static const uint8_t lfn_offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+// Reads the entry at `pos`, assembling its long name from the slots before
+// it, and leaves `pos` after it. Returns 1 for an entry, 0 at the end of
+// the directory and -1 on a read error.
+static int dir_next(dirpos_t* pos, int* done, fat_dirent_t* out) {
+    uint32_t lfn_left = 0;
+    uint8_t lfn_sum = 0;
+    int lfn_ok = 0;
+    while (!*done) {
+        uint8_t* e = dir_entry_at(pos);
+        if (!e) return -1;
+        if (e[0] == 0x00) {
+            *done = 1;
+            return 0;
+        }
+        dirpos_t here = *pos;
+        if (!dir_advance(pos)) *done = 1;
+        if (e[0] == 0xE5) {
+            lfn_ok = 0;
+            continue;
+        }
+        if ((e[11] & 0x3F) == ATTR_LFN) {
+            uint32_t seq = e[0] & 0x1F;
+            if (e[0] & 0x40) {
+                lfn_ok = seq > 0 && seq <= 20;
+                lfn_left = seq;
+                lfn_sum = e[13];
+                out->first = here;
+                out->slots = seq + 1;
+                if (lfn_ok) memset(out->name, 0, sizeof(out->name));
+            }
+            if (!lfn_ok || seq != lfn_left || e[13] != lfn_sum) {
+                lfn_ok = 0;
+                continue;
+            }
+            for (int i = 0; i < 13; i++) {
+                uint32_t at = (seq - 1) * 13 + (uint32_t)i;
+                uint16_t ch = get_u16(e + lfn_offsets[i]);
+                if (ch == 0x0000 || ch == 0xFFFF || at >= FAT_NAME_MAX) break;
+                out->name[at] = ch < 0x80 ? (char)ch : '?';
+            }
+            lfn_left--;
+            continue;
+        }
+        if (e[11] & ATTR_VOLUME_ID) {
+            lfn_ok = 0;
+            continue;
+        }
+        if (!(lfn_ok && lfn_left == 0 && short_checksum(e) == lfn_sum && out->name[0])) {
+            short_to_name(e, out->name);
+            out->first = here;
+            out->slots = 1;
+        }
+        out->attr = e[11];
+        out->cluster = ((uint32_t)get_u16(e + 20) << 16) | get_u16(e + 26);
+        out->size = get_u32(e + 28);
+        out->slot = here;
+        return 1;
+    }
+    return 0;
+}
+
+static int name_equal(const char* a, const char* b, size_t b_len) {
+    for (size_t i = 0; i < b_len; i++) {
+        if (a[i] == '\0' || to_upper(a[i]) != to_upper(b[i])) return 0;
+    }
+    return a[b_len] == '\0';
+}
+
+static uint32_t dir_cluster_of(const fat_dirent_t* e) {
+    // ".." entries of first-level directories point at cluster 0.
+    return e->cluster ? e->cluster : vol.root_cluster;
+}
+
+// Looks `name` up in the directory starting at `dir`; the entry is left in
+// `found`.
+static int dir_lookup(uint32_t dir, const char* name, size_t len) {
+    dirpos_t pos = { dir, 0 };
+    int done = 0;
+    while (dir_next(&pos, &done, &found) == 1) {
+        if (name_equal(found.name, name, len)) return 1;
+    }
+    return 0;
+}
+
+// Resolves every component of `path` but the last, which is returned in
+// `leaf` (empty for the volume root).
+static int walk_path(const char* path, uint32_t* dir, const char** leaf, size_t* leaf_len) {
+    *dir = vol.root_cluster;
+    const char* p = path;
+    for (;;) {
+        while (*p == '/') p++;
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        size_t len = (size_t)(p - start);
+        const char* rest = p;
+        while (*rest == '/') rest++;
+        if (*rest == '\0') {
+            *leaf = start;
+            *leaf_len = len;
+            return 0;
+        }
+        if (!dir_lookup(*dir, start, len) || !(found.attr & ATTR_DIRECTORY)) return -1;
+        *dir = dir_cluster_of(&found);
+        p = rest;
+    }
+}
+
+// ---- Creating entries ----
+
+static int short_char_ok(char c) {
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (uint8_t)c >= 0x80) return 1;
+    const char* extra = "$%'-_@~`!(){}^#&";
+    for (; *extra; extra++) {
+        if (*extra == c) return 1;
+    }
+    return 0;
+}
+
+static int long_char_ok(char c) {
+    if ((uint8_t)c < 0x20) return 0;
+    const char* bad = "\"*/:<>?\\|";
+    for (; *bad; bad++) {
+        if (*bad == c) return 0;
+    }
+    return 1;
+}
+
+// Fills `out` with the 8.3 form of `name` if it has one: at most one dot,
+// 1-8 + 0-3 valid characters, each part all upper or all lower case.
+static int fits_short(const char* name, size_t len, uint8_t out[11], uint8_t* ntres) {
+    size_t dot = len;
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '.') {
+            if (dot != len) return 0;
+            dot = i;
+        }
+    }
+    size_t base_len = dot;
+    size_t ext_len = dot < len ? len - dot - 1 : 0;
+    if (base_len == 0 || base_len > 8 || ext_len > 3 || (dot < len && ext_len == 0)) return 0;
+    memset(out, ' ', 11);
+    *ntres = 0;
+    for (int part = 0; part < 2; part++) {
+        const char* s = part ? name + dot + 1 : name;
+        size_t n = part ? ext_len : base_len;
+        int upper = 0, lower = 0;
+        for (size_t i = 0; i < n; i++) {
+            char c = s[i];
+            if (c >= 'a' && c <= 'z') lower = 1;
+            if (c >= 'A' && c <= 'Z') upper = 1;
+            c = to_upper(c);
+            if (!short_char_ok(c)) return 0;
+            out[(part ? 8 : 0) + i] = (uint8_t)c;
+        }
+        if (upper && lower) return 0;
+        if (lower) *ntres |= part ? NTRES_LOWER_EXT : NTRES_LOWER_BASE;
+    }
+    if (out[0] == 0xE5) out[0] = 0x05;
+    return 1;
+}
+
+static int short_name_taken(uint32_t dir, const uint8_t name11[11]) {
+    dirpos_t pos = { dir, 0 };
+    for (;;) {
+        uint8_t* e = dir_entry_at(&pos);
+        if (!e || e[0] == 0x00) return 0;
+        if (e[0] != 0xE5 && (e[11] & 0x3F) != ATTR_LFN && !memcmp(e, name11, 11)) return 1;
+        if (!dir_advance(&pos)) return 0;
+    }
+}
+
+// Builds a unique "BASIS~N.EXT" alias for a name that needs a long entry.
+static int make_alias(uint32_t dir, const char* name, size_t len, uint8_t out[11]) {
+    size_t dot = len;
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '.') dot = i;
+    }
+    uint8_t basis[8];
+    size_t basis_len = 0;
+    for (size_t i = 0; i < dot && basis_len < 6; i++) {
+        char c = to_upper(name[i]);
+        if (c == ' ' || c == '.') continue;
+        basis[basis_len++] = (uint8_t)(short_char_ok(c) ? c : '_');
+    }
+    if (basis_len == 0) basis[basis_len++] = '_';
+    memset(out, ' ', 11);
+    for (size_t i = dot + 1, n = 0; i < len && n < 3; i++) {
+        char c = to_upper(name[i]);
+        if (c == ' ') continue;
+        out[8 + n++] = (uint8_t)(short_char_ok(c) ? c : '_');
+    }
+    for (uint32_t num = 1; num < 1000000; num++) {
+        char tail[8];
+        int tail_len = 0;
+        for (uint32_t v = num; v; v /= 10) tail[tail_len++] = (char)('0' + v % 10);
+        tail[tail_len++] = '~';
+        size_t keep = basis_len;
+        if (keep + (size_t)tail_len > 8) keep = 8 - (size_t)tail_len;
+        memset(out, ' ', 8);
+        memcpy(out, basis, keep);
+        for (int i = 0; i < tail_len; i++) out[keep + (size_t)i] = (uint8_t)tail[tail_len - 1 - i];
+        if (!short_name_taken(dir, out)) return 0;
+    }
+    return -1;
+}
+
+// Finds `count` free slots in a row, growing the directory by zeroed
+// clusters when it is full.
+static int dir_find_free(uint32_t dir, uint32_t count, dirpos_t* start) {
+    dirpos_t pos = { dir, 0 };
+    uint32_t run = 0;
+    for (;;) {
+        uint8_t* e = dir_entry_at(&pos);
+        if (!e) return -1;
+        if (e[0] == 0x00 || e[0] == 0xE5) {
+            if (run++ == 0) *start = pos;
+            if (run == count) return 0;
+        } else {
+            run = 0;
+        }
+        if (dir_advance(&pos)) continue;
+        uint32_t grown = alloc_clusters(pos.cluster, 1);
+        if (!grown || zero_cluster(grown) != 0) return -1;
+        vol.sec_valid = 0;
+        pos.cluster = grown;
+        pos.index = 0;
+    }
+}
+
+static void fill_short_entry(uint8_t* e, const uint8_t name11[11], uint8_t ntres, uint8_t attr, uint32_t cluster) {
+    memset(e, 0, DIRENT_SIZE);
+    memcpy(e, name11, 11);
+    e[11] = attr;
+    e[12] = ntres;
+    put_u16(e + 16, FAT_DATE_1980);     // creation date
+    put_u16(e + 18, FAT_DATE_1980);     // last access date
+    put_u16(e + 20, (uint16_t)(cluster >> 16));
+    put_u16(e + 24, FAT_DATE_1980);     // write date
+    put_u16(e + 26, (uint16_t)cluster);
+}
+
+// Links a new entry called `name` into `dir`. Its short entry position is
+// returned in `slot`.
+static int dir_create(uint32_t dir, const char* name, size_t len, uint8_t attr, uint32_t cluster, dirpos_t* slot) {
+    if (len == 0 || len > FAT_NAME_MAX || name[len - 1] == '.' || name[len - 1] == ' ') return -1;
+    for (size_t i = 0; i < len; i++) {
+        if (!long_char_ok(name[i])) return -1;
+    }
+    if (dir_lookup(dir, name, len)) return -1;
+
+    uint8_t name11[11];
+    uint8_t ntres = 0;
+    uint32_t lfn_slots = 0;
+    if (!fits_short(name, len, name11, &ntres) || short_name_taken(dir, name11)) {
+        if (make_alias(dir, name, len, name11) != 0) return -1;
+        ntres = 0;
+        lfn_slots = (uint32_t)(len + 12) / 13;
+    }
+
+    dirpos_t pos;
+    if (dir_find_free(dir, lfn_slots + 1, &pos) != 0) return -1;
+    uint8_t sum = short_checksum(name11);
+    for (uint32_t seq = lfn_slots; seq > 0; seq--) {
+        uint8_t* e = dir_entry_at(&pos);
+        if (!e) return -1;
+        memset(e, 0, DIRENT_SIZE);
+        e[0] = (uint8_t)(seq | (seq == lfn_slots ? 0x40 : 0));
+        e[11] = ATTR_LFN;
+        e[13] = sum;
+        for (int i = 0; i < 13; i++) {
+            size_t at = (seq - 1) * 13 + (size_t)i;
+            uint16_t ch = at < len ? (uint8_t)name[at] : (at == len ? 0x0000 : 0xFFFF);
+            put_u16(e + lfn_offsets[i], ch);
+        }
+        if (store_sector() != 0 || !dir_advance(&pos)) return -1;
+    }
+    uint8_t* e = dir_entry_at(&pos);
+    if (!e) return -1;
+    fill_short_entry(e, name11, ntres, attr, cluster);
+    if (store_sector() != 0) return -1;
+    *slot = pos;
+    return 0;
+}
+
+static int dir_mark_deleted(const fat_dirent_t* entry) {
+    dirpos_t pos = entry->first;
+    for (uint32_t i = 0; i < entry->slots; i++) {
+        uint8_t* e = dir_entry_at(&pos);
+        if (!e) return -1;
+        e[0] = 0xE5;
+        if (store_sector() != 0) return -1;
+        if (i + 1 < entry->slots && !dir_advance(&pos)) return -1;
+    }
+    return 0;
+}
+
+// ---- File data ----
+
+// Cluster holding the file's `index`-th cluster, or 0 past the chain.
+static uint32_t file_cluster(fat_file_t* f, uint32_t index) {
+    uint32_t c = f->first;
+    uint32_t at = 0;
+    if (f->pos_cluster && f->pos_index <= index) {
+        c = f->pos_cluster;
+        at = f->pos_index;
+    }
+    while (c && at < index) {
+        c = chain_next(c);
+        at++;
+    }
+    return c;
+}
+
+// Moves `len` bytes between `buf` and the disk starting `offset` bytes into
+// sector `lba`. Whole sectors go straight to the cache in one request;
+// partial ones are read, patched and written back.
+static int transfer(uint32_t lba, uint32_t offset, uint8_t* buf, uint32_t len, int write) {
+    lba += offset / SECTOR;
+    offset %= SECTOR;
+    vol.sec_valid = 0;
+    while (len > 0) {
+        if (offset == 0 && len >= SECTOR) {
+            uint32_t count = len / SECTOR;
+            int rc = write ? bcache_write(vol.drive, lba, count, buf) : bcache_read(vol.drive, lba, count, buf);
+            if (rc != 0) return -1;
+            lba += count;
+            buf += count * SECTOR;
+            len -= count * SECTOR;
+            continue;
+        }
+        uint32_t n = SECTOR - offset;
+        if (n > len) n = len;
+        if (bcache_read(vol.drive, lba, 1, vol.bounce) != 0) return -1;
+        if (write) {
+            memcpy(vol.bounce + offset, buf, n);
+            if (bcache_write(vol.drive, lba, 1, vol.bounce) != 0) return -1;
+        } else {
+            memcpy(buf, vol.bounce + offset, n);
+        }
+        lba++;
+        offset = 0;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads or writes file bytes already covered by the chain, one physically
+// contiguous run of clusters per transfer.
+static size_t file_io(fat_file_t* f, uint32_t offset, uint8_t* buf, uint32_t len, int write) {
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t pos = offset + done;
+        uint32_t index = pos / vol.cluster_bytes;
+        uint32_t in = pos % vol.cluster_bytes;
+        uint32_t c = file_cluster(f, index);
+        if (!c) break;
+        uint32_t run = 1;
+        uint32_t want = in + (len - done);
+        while (run * vol.cluster_bytes < want && chain_next(c + run - 1) == c + run) run++;
+        f->pos_index = index + run - 1;
+        f->pos_cluster = c + run - 1;
+        uint32_t n = run * vol.cluster_bytes - in;
+        if (n > len - done) n = len - done;
+        if (transfer(cluster_lba(c), in, buf + done, n, write) != 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// Grows the chain so it covers `size` bytes.
+static int file_reserve(fat_file_t* f, uint32_t size) {
+    uint32_t need = size / vol.cluster_bytes + (size % vol.cluster_bytes != 0);
+    if (need <= f->clusters) return 0;
+    uint32_t first = alloc_clusters(f->last, need - f->clusters);
+    if (!first) return -1;
+    if (!f->first) {
+        f->first = first;
+        f->dirty = 1;
+    }
+    uint32_t last = f->last ? f->last : first;
+    while (chain_next(last)) last = chain_next(last);
+    f->last = last;
+    f->clusters = need;
+    return 0;
+}
+
+static int file_store_entry(fat_file_t* f) {
+    uint8_t* e = dir_entry_at(&f->slot);
+    if (!e) return -1;
+    put_u16(e + 20, (uint16_t)(f->first >> 16));
+    put_u16(e + 26, (uint16_t)f->first);
+    put_u32(e + 28, f->size);
+    e[11] |= ATTR_ARCHIVE;
+    if (store_sector() != 0) return -1;
+    f->dirty = 0;
+    return 0;
+}
+
+static fat_file_t* find_open(const dirpos_t* slot) {
+    for (fat_file_t* f = open_files; f; f = f->next) {
+        if (f->slot.cluster == slot->cluster && f->slot.index == slot->index) return f;
+    }
+    return NULL;
+}
+
+// ---- fs_mount_ops ----
+
+static void* fat_open(void* v, const char* path, int flags) {
+    (void)v;
+    uint32_t dir;
+    const char* leaf;
+    size_t leaf_len;
+    if (walk_path(path, &dir, &leaf, &leaf_len) != 0 || leaf_len == 0) return NULL;
+    int exists = dir_lookup(dir, leaf, leaf_len);
+    if (exists) {
+        if (found.attr & ATTR_DIRECTORY) return NULL;
+        fat_file_t* shared = find_open(&found.slot);
+        if (shared) {
+            // Truncating would free clusters the other handles still read.
+            if ((flags & FS_OPEN_TRUNC) && (shared->first || shared->size)) return NULL;
+            shared->refs++;
+            return shared;
+        }
+    } else if (!(flags & FS_OPEN_CREATE)) {
+        return NULL;
+    }
+    fat_file_t* f = (fat_file_t*)kmalloc(sizeof(fat_file_t));
+    if (!f) return NULL;
+    memset(f, 0, sizeof(fat_file_t));
+    int created = 0;
+    if (exists) {
+        f->first = cluster_valid(found.cluster) ? found.cluster : 0;
+        f->size = found.size;
+        f->slot = found.slot;
+    } else if (dir_create(dir, leaf, leaf_len, ATTR_ARCHIVE, 0, &f->slot) != 0) {
+        kfree(f);
+        return NULL;
+    } else {
+        created = 1;
+    }
+    for (uint32_t c = f->first; c; c = chain_next(c)) {
+        f->last = c;
+        f->clusters++;
+    }
+    if ((flags & FS_OPEN_TRUNC) && (f->first || f->size)) {
+        free_chain(f->first);
+        f->first = f->last = f->clusters = f->size = 0;
+        f->dirty = 1;
+    }
+    if (f->dirty || created) {
+        file_store_entry(f);
+        fat_flush();
+    }
+    f->refs = 1;
+    f->next = open_files;
+    open_files = f;
+    return f;
+}
+
+static size_t fat_read(void* file, size_t offset, uint8_t* buf, size_t len) {
+    fat_file_t* f = (fat_file_t*)file;
+    if (offset >= f->size) return 0;
+    if (len > f->size - offset) len = f->size - offset;
+    return file_io(f, (uint32_t)offset, buf, (uint32_t)len, 0);
+}
+
+static size_t fat_write(void* file, size_t offset, const uint8_t* data, size_t len) {
+    fat_file_t* f = (fat_file_t*)file;
+    uint32_t end = (uint32_t)(offset + len);
+    if (len == 0 || end < offset) return 0;
+    if (file_reserve(f, end) != 0) return 0;
+    // FAT has no holes: the gap between the old end and `offset` is zeroed.
+    while (f->size < offset) {
+        uint32_t n = (uint32_t)offset - f->size;
+        if (n > SECTOR) n = SECTOR;
+        if (file_io(f, f->size, (uint8_t*)zero_sector, n, 1) != n) return 0;
+        f->size += n;
+        f->dirty = 1;
+    }
+    size_t done = file_io(f, (uint32_t)offset, (uint8_t*)data, (uint32_t)len, 1);
+    if (offset + done > f->size) {
+        f->size = (uint32_t)(offset + done);
+        f->dirty = 1;
+    }
+    return done;
+}
+
+static size_t fat_size(void* file) {
+    return ((fat_file_t*)file)->size;
+}
+
+static void fat_close(void* file) {
+    fat_file_t* f = (fat_file_t*)file;
+    if (f->dirty) file_store_entry(f);
+    fat_flush();
+    if (--f->refs > 0) return;
+    fat_file_t** link = &open_files;
+    while (*link && *link != f) link = &(*link)->next;
+    if (*link) *link = f->next;
+    kfree(f);
+}
+
+static void* fat_opendir(void* v, const char* path) {
+    (void)v;
+    uint32_t start = vol.root_cluster;
+    if (path[0]) {
+        uint32_t dir;
+        const char* leaf;
+        size_t leaf_len;
+        if (walk_path(path, &dir, &leaf, &leaf_len) != 0) return NULL;
+        if (!dir_lookup(dir, leaf, leaf_len) || !(found.attr & ATTR_DIRECTORY)) return NULL;
+        start = dir_cluster_of(&found);
+    }
+    fat_dir_t* d = (fat_dir_t*)kmalloc(sizeof(fat_dir_t));
+    if (!d) return NULL;
+    d->start = start;
+    d->pos.cluster = start;
+    d->pos.index = 0;
+    d->done = 0;
+    return d;
+}
+
+static int is_dot_entry(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static int fat_readdir(void* dir, FsDirEntry* out) {
+    fat_dir_t* d = (fat_dir_t*)dir;
+    int rc;
+    while ((rc = dir_next(&d->pos, &d->done, &listed)) == 1) {
+        if (is_dot_entry(listed.name)) continue;
+        size_t len = strlen(listed.name);
+        if (len >= MAX_NAME_LEN) len = MAX_NAME_LEN - 1;
+        memcpy(out->name, listed.name, len);
+        out->name[len] = '\0';
+        out->type = (listed.attr & ATTR_DIRECTORY) ? FS_NODE_DIR : FS_NODE_FILE;
+        out->size = (listed.attr & ATTR_DIRECTORY) ? 0 : listed.size;
+        return 1;
+    }
+    return rc;
+}
+
+static size_t fat_dircount(void* dir) {
+    fat_dir_t* d = (fat_dir_t*)dir;
+    dirpos_t pos = { d->start, 0 };
+    int done = 0;
+    size_t count = 0;
+    while (dir_next(&pos, &done, &listed) == 1) {
+        if (!is_dot_entry(listed.name)) count++;
+    }
+    return count;
+}
+
+static void fat_closedir(void* dir) {
+    kfree(dir);
+}
+
+static int fat_mkdir(void* v, const char* path) {
+    (void)v;
+    uint32_t dir;
+    const char* leaf;
+    size_t leaf_len;
+    if (walk_path(path, &dir, &leaf, &leaf_len) != 0 || leaf_len == 0) return -1;
+    if (dir_lookup(dir, leaf, leaf_len)) return -1;
+    uint32_t c = alloc_clusters(0, 1);
+    if (!c) return -1;
+    if (zero_cluster(c) != 0) {
+        free_chain(c);
+        return -1;
+    }
+    uint8_t* e = load_sector(cluster_lba(c));
+    if (!e) {
+        free_chain(c);
+        return -1;
+    }
+    static const uint8_t dot[11] = { '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+    static const uint8_t dotdot[11] = { '.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+    fill_short_entry(e, dot, 0, ATTR_DIRECTORY, c);
+    fill_short_entry(e + DIRENT_SIZE, dotdot, 0, ATTR_DIRECTORY, dir == vol.root_cluster ? 0 : dir);
+    dirpos_t slot;
+    if (store_sector() != 0 || dir_create(dir, leaf, leaf_len, ATTR_DIRECTORY, c, &slot) != 0) {
+        free_chain(c);
+        fat_flush();
+        return -1;
+    }
+    return fat_flush();
+}
+
+static int dir_is_empty(uint32_t start) {
+    dirpos_t pos = { start, 0 };
+    int done = 0;
+    while (dir_next(&pos, &done, &listed) == 1) {
+        if (!is_dot_entry(listed.name)) return 0;
+    }
+    return 1;
+}
+
+static int fat_remove(void* v, const char* path, fs_node_type_t type) {
+    (void)v;
+    uint32_t dir;
+    const char* leaf;
+    size_t leaf_len;
+    if (walk_path(path, &dir, &leaf, &leaf_len) != 0 || leaf_len == 0) return -1;
+    if (!dir_lookup(dir, leaf, leaf_len) || is_dot_entry(found.name)) return -1;
+    int is_dir = (found.attr & ATTR_DIRECTORY) != 0;
+    if (is_dir != (type == FS_NODE_DIR)) return -1;
+    if (found.attr & ATTR_READ_ONLY) return -1;
+    fat_dirent_t entry = found;
+    if (is_dir && !dir_is_empty(dir_cluster_of(&entry))) return -1;
+    // An open file keeps its chain until the last handle is closed.
+    if (!is_dir && find_open(&entry.slot)) return -1;
+    if (dir_mark_deleted(&entry) != 0) return -1;
+    free_chain(entry.cluster);
+    return fat_flush();
+}
+
+static void fat_unmount(void* v) {
+    (void)v;
+    fat_flush();
+    bcache_sync(vol.drive);
+    vol.mounted = 0;
+}
+
+static const fs_mount_ops_t fat32_ops = {
+    "fat32",
+    fat_open,
+    fat_read,
+    fat_write,
+    fat_size,
+    fat_close,
+    fat_opendir,
+    fat_readdir,
+    fat_dircount,
+    fat_closedir,
+    fat_mkdir,
+    fat_remove,
+    fat_unmount,
+};
+
+// ---- Mounting ----
+
+static int load_fat(void) {
+    uint32_t sectors = (vol.entries + FAT_ENTRIES_PER_SECTOR - 1) / FAT_ENTRIES_PER_SECTOR;
+    uint8_t* dst = (uint8_t*)fat_table;
+    for (uint32_t s = 0; s < sectors; s += FAT_LOAD_SECTORS) {
+        uint32_t n = sectors - s < FAT_LOAD_SECTORS ? sectors - s : FAT_LOAD_SECTORS;
+        if (bcache_read(vol.drive, vol.fat_start + s, n, dst + s * SECTOR) != 0) return -1;
+    }
+    memset(free_map, 0, sizeof(free_map));
+    memset(fat_dirty, 0, sizeof(fat_dirty));
+    vol.free_count = 0;
+    for (uint32_t c = 2; c < vol.entries; c++) {
+        if ((fat_table[c] & FAT_MASK) == 0) {
+            free_map[c >> 5] |= 1u << (c & 31);
+            vol.free_count++;
+        }
+    }
+    return 0;
+}
+
+int fat32_mount(uint8_t drive, const char* path) {
+    if (vol.mounted) {
+        print("fat32: a volume is already mounted\n");
+        return -1;
+    }
+    const bios_drive_info_t* info = NULL;
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present && d->drive == drive) info = d;
+    }
+    if (!info || info->sector_size != SECTOR) return -1;
+
+    uint8_t* bs = vol.bounce;
+    vol.drive = drive;
+    vol.sec_valid = 0;
+    if (bcache_read(drive, 0, 1, bs) != 0) return -1;
+    if (bs[510] != 0x55 || bs[511] != 0xAA || get_u16(bs + 11) != SECTOR) return -1;
+    uint32_t spc = bs[13];
+    uint32_t reserved = get_u16(bs + 14);
+    uint32_t fats = bs[16];
+    // FAT32 has no fixed root directory and no 16-bit FAT size.
+    if (get_u16(bs + 17) != 0 || get_u16(bs + 22) != 0) return -1;
+    if (spc == 0 || (spc & (spc - 1)) || reserved == 0 || fats == 0) return -1;
+    uint32_t total = get_u16(bs + 19) ? get_u16(bs + 19) : get_u32(bs + 32);
+    uint32_t fat_sectors = get_u32(bs + 36);
+    uint32_t data_start = reserved + fats * fat_sectors;
+    if (fat_sectors == 0 || total <= data_start || total > info->sectors) return -1;
+    uint32_t clusters = (total - data_start) / spc;
+    if (clusters > fat_sectors * FAT_ENTRIES_PER_SECTOR - 2) clusters = fat_sectors * FAT_ENTRIES_PER_SECTOR - 2;
+    if (clusters > FAT32_MAX_CLUSTERS) {
+        print("fat32: volume too large for the in-memory FAT\n");
+        return -1;
+    }
+
+    vol.sectors_per_cluster = spc;
+    vol.cluster_bytes = spc * SECTOR;
+    vol.entries_per_cluster = vol.cluster_bytes / DIRENT_SIZE;
+    vol.fat_start = reserved;
+    vol.fat_sectors = fat_sectors;
+    vol.num_fats = fats;
+    vol.data_start = data_start;
+    vol.entries = clusters + 2;
+    vol.root_cluster = get_u32(bs + 44);
+    vol.fsinfo_sector = get_u16(bs + 48);
+    vol.next_free = 2;
+    if (!cluster_valid(vol.root_cluster)) return -1;
+    if (load_fat() != 0) return -1;
+
+    vol.mounted = 1;
+    if (fs_mount(path, &fat32_ops, &vol) != 0) {
+        vol.mounted = 0;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include <stdint.h>
+
+// Largest volume whose FAT fits the in-memory copy: 2^20 clusters, i.e. a
+// 4 MiB table (32 GiB with 32 KiB clusters). One FAT32 volume can be
+// mounted at a time.
+#define FAT32_MAX_CLUSTERS (1u << 20)
+
+// Mounts the FAT32 filesystem on `drive` (usually a partition) at `path`.
+int fat32_mount(uint8_t drive, const char* path);
+
+#endif
@@ -1,9 +1,12 @@
 #include "filesystem.h"
+#include "blockstore.h"
+#include "compress.h"
 #include <stddef.h>
 #include <stdint.h>
 #include "../lib/memory.h"
 #include "../lib/string.h"
 #include "../kernel.h"
+#include "../drivers/timer/timer.h"
 
 extern void print(const char*);
 
@@ -12,136 +15,829 @@ const uint8_t readme_data[] = "This is a readme file in /docs\n";
 const uint8_t log_data[] = "System logs...\n";
 const uint8_t config_data[] = "Configuration settings.\n";
 
-static FileEntry root_files_static[] = {
-    { "file1.txt", (uint8_t*)file1_data, sizeof(file1_data) - 1, 0 },
-    { "log.txt", (uint8_t*)log_data, sizeof(log_data) - 1, 0 }
-};
+static FsNode* root_dir = NULL;
 
-static FileEntry docs_files_static[] = {
-    { "readme.txt", (uint8_t*)readme_data, sizeof(readme_data) - 1, 0 }
-};
+typedef struct {
+    FileEntry* entry;       // NULL for files on a mounted volume
+    fs_mount_t* mount;
+    void* mfile;
+    size_t offset;
+    uint16_t generation;
+    uint16_t next_free;
+    int used;
+} FileHandle;
 
-static FileEntry etc_files_static[] = {
-    { "config.ini", (uint8_t*)config_data, sizeof(config_data) - 1, 0 }
-};
+// Growable open-file table. Free slots are chained through next_free so
+// both open and close are O(1).
+#define HANDLE_TABLE_INITIAL 8
+#define HANDLE_SLOT_MAX 0xFFFF
+#define HANDLE_NO_SLOT 0xFFFF
+static FileHandle* handles = NULL;
+static size_t handle_capacity = 0;
+static uint16_t handle_free_head = HANDLE_NO_SLOT;
 
-static Directory base_root_dir[] = {
-    { "/", root_files_static, sizeof(root_files_static) / sizeof(FileEntry), NULL, NULL, 0 },
-    { "docs", docs_files_static, sizeof(docs_files_static) / sizeof(FileEntry), &base_root_dir[0], NULL, 0 },
-    { "etc", etc_files_static, sizeof(etc_files_static) / sizeof(FileEntry), &base_root_dir[0], NULL, 0 }
-};
+Directory* current_dir = NULL;
 
-static Directory* root_dir = base_root_dir;
-static size_t root_dir_count = sizeof(base_root_dir) / sizeof(Directory);
+// Path of current_dir, rebuilt lazily after the directory changes.
+static char cwd_path[256];
+static int cwd_path_valid = 0;
 
-#define MAX_OPEN_FILES 8
-static FileHandle handles[MAX_OPEN_FILES];
+// Direct-mapped dentry cache keyed by (parent, name, type). A slot only
+// stores the node; a hit is confirmed against the node's own parent and
+// name, and slots are cleared when their node is unlinked.
+#define DCACHE_SLOTS 64
+static FsNode* dcache[DCACHE_SLOTS];
 
-Directory* current_dir = NULL;
+struct fs_mount {
+    FsNode* node;           // NULL while the slot is free
+    const fs_mount_ops_t* ops;
+    void* vol;
+    uint32_t users;         // open handles and directory cursors
+    char path[FS_PATH_MAX];
+};
+
+static fs_mount_t mounts[FS_MOUNT_MAX];
+static int mount_count = 0;
+// When current_dir is a mount point, the directory below it we are in.
+static char mount_cwd[FS_PATH_MAX];
+// Scratch for the volume-relative part of the path being resolved.
+static char mount_rest[FS_PATH_MAX];
+
+// fs_view on a mounted file reads this much per call, so sequential readers
+// hand drivers requests large enough to span several clusters.
+#define MOUNT_VIEW_SIZE (16 * 1024)
+static uint8_t mount_view_buf[MOUNT_VIEW_SIZE];
 
 static int dir_name_equal(const char* a, const char* b) {
     return strcmp(a, b) == 0;
 }
 
-void fs_init() {
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        handles[i].used = 0;
-        handles[i].entry = NULL;
-        handles[i].offset = 0;
-    }
-    root_dir = base_root_dir;
-    root_dir_count = sizeof(base_root_dir) / sizeof(Directory);
-    root_dir[0].parent = NULL;
-    root_dir[1].parent = &root_dir[0];
-    root_dir[2].parent = &root_dir[0];
-    if (root_dir[0].children == NULL) {
-        root_dir[0].children = (Directory*)kmalloc(2 * sizeof(Directory));
-        root_dir[0].children[0] = root_dir[1];
-        root_dir[0].children[1] = root_dir[2];
-        root_dir[0].child_count = 2;
-    }
-    current_dir = &root_dir[0];
-}
-
-FileHandle* fs_open(const char* filename) {
-    if (!current_dir || !filename) return 0;
-    for (size_t i = 0; i < current_dir->file_count; i++) {
-        if (dir_name_equal(filename, current_dir->files[i].name)) {
-            for (size_t h = 0; h < MAX_OPEN_FILES; h++) {
-                if (!handles[h].used) {
-                    handles[h].used = 1;
-                    handles[h].entry = &current_dir->files[i];
-                    handles[h].offset = 0;
-                    return &handles[h];
-                }
+static uint32_t dcache_slot(const FsNode* dir, const char* name, fs_node_type_t type) {
+    uint32_t h = 2166136261u ^ (uint32_t)(uintptr_t)dir ^ (uint32_t)type;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return (h ^ (h >> 16)) % DCACHE_SLOTS;
+}
+
+static void dcache_forget(FsNode* node) {
+    if (!node->parent) return;
+    uint32_t slot = dcache_slot(node->parent, node->name, node->type);
+    if (dcache[slot] == node) dcache[slot] = NULL;
+}
+
+static FsNode* fs_node_alloc(const char* name, fs_node_type_t type) {
+    FsNode* node = (FsNode*)kmalloc(sizeof(FsNode));
+    if (!node) return NULL;
+    memset(node, 0, sizeof(FsNode));
+    strncpy(node->name, name, MAX_NAME_LEN);
+    node->name[MAX_NAME_LEN - 1] = '\0';
+    node->type = type;
+    node->refcount = 1;
+    node->last_access = timer_ticks();
+    return node;
+}
+
+void fs_node_retain(FsNode* node) {
+    if (node) node->refcount++;
+}
+
+static void file_free_chunks(FsNode* file, size_t keep) {
+    while (file->chunk_count > keep) {
+        fs_block_put(file->chunks[--file->chunk_count]);
+        file->chunks[file->chunk_count] = NULL;
+    }
+    if (file->chunk_count == 0 && file->chunks) {
+        kfree(file->chunks);
+        file->chunks = NULL;
+        file->chunk_capacity = 0;
+    }
+}
+
+void fs_node_release(FsNode* node) {
+    if (!node || node->refcount == 0) return;
+    if (--node->refcount > 0) return;
+    if (node->type == FS_NODE_FILE) {
+        fs_compress_discard(node);
+        file_free_chunks(node, 0);
+    }
+    kfree(node);
+}
+
+static int file_grow_chunk_array(FsNode* file, size_t needed) {
+    if (needed <= file->chunk_capacity) return 0;
+    size_t cap = file->chunk_capacity ? file->chunk_capacity : 4;
+    while (cap < needed) cap *= 2;
+    fs_block_t** grown = (fs_block_t**)kmalloc(cap * sizeof(fs_block_t*));
+    if (!grown) return -1;
+    for (size_t i = 0; i < file->chunk_count; i++) grown[i] = file->chunks[i];
+    if (file->chunks) kfree(file->chunks);
+    file->chunks = grown;
+    file->chunk_capacity = cap;
+    return 0;
+}
+
+// Makes sure chunks cover `size` bytes. New chunks are zeroed, so a write
+// past the end of the file leaves a zero-filled gap.
+static int file_reserve(FsNode* file, size_t size) {
+    size_t needed = (size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+    if (needed <= file->chunk_count) return 0;
+    if (file_grow_chunk_array(file, needed) != 0) return -1;
+    while (file->chunk_count < needed) {
+        fs_block_t* chunk = fs_block_alloc();
+        if (!chunk) return -1;
+        file->chunks[file->chunk_count++] = chunk;
+    }
+    return 0;
+}
+
+// Returns chunk `idx` ready to be modified, un-sharing it if needed.
+static uint8_t* file_chunk_for_write(FsNode* file, size_t idx) {
+    fs_block_t* block = fs_block_make_private(file->chunks[idx]);
+    if (!block) return NULL;
+    file->chunks[idx] = block;
+    return block->data;
+}
+
+// Seals chunks [first, last) into the block store so identical blocks are
+// shared. Only whole chunks are sealed unless `include_tail` is set, which
+// keeps small appends from rehashing the partial last chunk every time.
+static void file_seal_chunks(FsNode* file, size_t first, size_t last, int include_tail) {
+    size_t full = file->size / FS_CHUNK_SIZE;
+    if (include_tail) full = file->chunk_count;
+    if (last > full) last = full;
+    for (size_t i = first; i < last; i++) {
+        file->chunks[i] = fs_block_seal(file->chunks[i]);
+    }
+}
+
+// Shrinks a chunked file to `size`, freeing whole chunks past the end and
+// zeroing the tail of the last one so later gaps read back as zeros.
+static void file_truncate(FsNode* file, size_t size) {
+    if (size >= file->size) return;
+    size_t keep = (size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+    file_free_chunks(file, keep);
+    if (keep > 0 && (size % FS_CHUNK_SIZE) != 0) {
+        size_t used = size % FS_CHUNK_SIZE;
+        uint8_t* tail = file_chunk_for_write(file, keep - 1);
+        if (tail) memset(tail + used, 0, FS_CHUNK_SIZE - used);
+    }
+    file->size = size;
+}
+
+// Moves read-only backing data into owned chunks before the first write.
+static int file_make_writable(FsNode* file) {
+    if (!file->data) return 0;
+    const uint8_t* src = file->data;
+    size_t size = file->size;
+    if (file_reserve(file, size) != 0) return -1;
+    for (size_t off = 0; off < size; off += FS_CHUNK_SIZE) {
+        size_t n = size - off < FS_CHUNK_SIZE ? size - off : FS_CHUNK_SIZE;
+        memcpy(file->chunks[off / FS_CHUNK_SIZE]->data, src + off, n);
+    }
+    file->data = NULL;
+    return 0;
+}
+
+static int file_write_at(FsNode* file, size_t offset, const uint8_t* src, size_t len) {
+    if (len == 0) return 0;
+    if (fs_decompress_file(file) != 0) return -1;
+    if (file_make_writable(file) != 0) return -1;
+    file->last_access = timer_ticks();
+    if (file_reserve(file, offset + len) != 0) return -1;
+    size_t done = 0;
+    while (done < len) {
+        size_t pos = offset + done;
+        size_t in_chunk = pos % FS_CHUNK_SIZE;
+        size_t n = FS_CHUNK_SIZE - in_chunk;
+        if (n > len - done) n = len - done;
+        uint8_t* chunk = file_chunk_for_write(file, pos / FS_CHUNK_SIZE);
+        if (!chunk) return -1;
+        memcpy(chunk + in_chunk, src + done, n);
+        done += n;
+    }
+    if (offset + len > file->size) file->size = offset + len;
+    file_seal_chunks(file, offset / FS_CHUNK_SIZE, (offset + len + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE, 0);
+    return 0;
+}
+
+static size_t file_read_at(const FsNode* file, size_t offset, uint8_t* dst, size_t len) {
+    if (offset >= file->size) return 0;
+    if (len > file->size - offset) len = file->size - offset;
+    if (file->packed) return fs_compress_read(file, offset, dst, len);
+    if (file->data) {
+        memcpy(dst, file->data + offset, len);
+        return len;
+    }
+    size_t done = 0;
+    while (done < len) {
+        size_t pos = offset + done;
+        size_t in_chunk = pos % FS_CHUNK_SIZE;
+        size_t n = FS_CHUNK_SIZE - in_chunk;
+        if (n > len - done) n = len - done;
+        memcpy(dst + done, file->chunks[pos / FS_CHUNK_SIZE]->data + in_chunk, n);
+        done += n;
+    }
+    return len;
+}
+
+// Appends `node` to the matching sibling list of `dir`. The caller's
+// reference from fs_node_alloc becomes the tree's reference.
+static void dir_link(FsNode* dir, FsNode* node) {
+    static uint32_t link_seq = 0;
+    FsNode** head = (node->type == FS_NODE_DIR) ? &dir->children : &dir->files;
+    FsNode** tail = (node->type == FS_NODE_DIR) ? &dir->children_tail : &dir->files_tail;
+    node->parent = dir;
+    node->seq = ++link_seq;
+    node->next = NULL;
+    node->prev = *tail;
+    if (*tail) (*tail)->next = node;
+    else *head = node;
+    *tail = node;
+    if (node->type == FS_NODE_DIR) dir->child_count++;
+    else dir->file_count++;
+}
+
+// Detaches `node` from its parent and drops the tree's reference. Handles
+// that still hold the node keep it alive until they are closed.
+static void dir_unlink(FsNode* node) {
+    FsNode* dir = node->parent;
+    if (!dir) return;
+    dcache_forget(node);
+    FsNode** head = (node->type == FS_NODE_DIR) ? &dir->children : &dir->files;
+    FsNode** tail = (node->type == FS_NODE_DIR) ? &dir->children_tail : &dir->files_tail;
+    if (node->prev) node->prev->next = node->next;
+    else *head = node->next;
+    if (node->next) node->next->prev = node->prev;
+    else *tail = node->prev;
+    if (node->type == FS_NODE_DIR) dir->child_count--;
+    else dir->file_count--;
+    node->parent = NULL;
+    node->prev = NULL;
+    node->next = NULL;
+    fs_node_release(node);
+}
+
+static void dir_unlink_tree(FsNode* dir) {
+    while (dir->files) dir_unlink(dir->files);
+    while (dir->children) {
+        dir_unlink_tree(dir->children);
+        dir_unlink(dir->children);
+    }
+}
+
+static FsNode* dir_lookup(FsNode* dir, const char* name, fs_node_type_t type) {
+    if (!dir || dir->type != FS_NODE_DIR) return NULL;
+    uint32_t slot = dcache_slot(dir, name, type);
+    FsNode* cached = dcache[slot];
+    if (cached && cached->parent == dir && cached->type == type && dir_name_equal(cached->name, name)) {
+        return cached;
+    }
+    for (FsNode* it = (type == FS_NODE_DIR) ? dir->children : dir->files; it; it = it->next) {
+        if (dir_name_equal(it->name, name)) {
+            dcache[slot] = it;
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static FsNode* find_file(FsNode* dir, const char* name) {
+    return dir_lookup(dir, name, FS_NODE_FILE);
+}
+
+static FsNode* find_child_dir(FsNode* dir, const char* name) {
+    return dir_lookup(dir, name, FS_NODE_DIR);
+}
+
+static FsNode* add_dir(FsNode* dir, const char* name);
+
+// Walks every component of `path` except the last, starting at the root for
+// absolute paths and at current_dir otherwise. The last component is copied
+// into `leaf`; it is left empty when the path names a directory itself
+// ("/", "..", "docs/."). With `create`, missing directories along the way
+// are made instead of failing the walk.
+static FsNode* walk_parent(const char* path, char leaf[MAX_NAME_LEN], int create) {
+    FsNode* dir = (path[0] == '/') ? root_dir : current_dir;
+    const char* p = path;
+    leaf[0] = '\0';
+    while (dir && *p) {
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        size_t len = (size_t)(p - start);
+        const char* rest = p;
+        while (*rest == '/') rest++;
+
+        if (len == 1 && start[0] == '.') continue;
+        if (len == 2 && start[0] == '.' && start[1] == '.') {
+            if (dir->parent) dir = dir->parent;
+            continue;
+        }
+        if (len >= MAX_NAME_LEN) return NULL;
+
+        char name[MAX_NAME_LEN];
+        memcpy(name, start, len);
+        name[len] = '\0';
+        if (*rest == '\0') {
+            memcpy(leaf, name, len + 1);
+            break;
+        }
+        FsNode* next = find_child_dir(dir, name);
+        if (!next && create) next = add_dir(dir, name);
+        dir = next;
+    }
+    return dir;
+}
+
+static FsNode* resolve_parent(const char* path, char leaf[MAX_NAME_LEN]) {
+    return walk_parent(path, leaf, 0);
+}
+
+static FsNode* resolve_dir(const char* path) {
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = resolve_parent(path, leaf);
+    if (!dir || leaf[0] == '\0') return dir;
+    return find_child_dir(dir, leaf);
+}
+
+static FsNode* resolve_file(const char* path) {
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = resolve_parent(path, leaf);
+    if (!dir || leaf[0] == '\0') return NULL;
+    return find_file(dir, leaf);
+}
+
+static fs_mount_t* mount_of(const FsNode* node) {
+    if (!node || !(node->flags & FS_NODE_MOUNT)) return NULL;
+    for (int i = 0; i < FS_MOUNT_MAX; i++) {
+        if (mounts[i].node == node) return &mounts[i];
+    }
+    return NULL;
+}
+
+static int mount_path_push(char* path, const char* name, size_t len) {
+    size_t at = strlen(path);
+    if (at + len + 2 > FS_PATH_MAX) return -1;
+    if (at) path[at++] = '/';
+    memcpy(path + at, name, len);
+    path[at + len] = '\0';
+    return 0;
+}
+
+static void mount_path_pop(char* path) {
+    size_t at = strlen(path);
+    while (at > 0 && path[at - 1] != '/') at--;
+    path[at ? at - 1 : 0] = '\0';
+}
+
+// Walks `path` like walk_parent, but only to find out whether it ends up on
+// a mounted volume. If so, returns the mount and leaves the normalized part
+// below its mount point in `out`; paths that stay in this tree give NULL.
+static fs_mount_t* mount_resolve(const char* path, char out[FS_PATH_MAX]) {
+    if (mount_count == 0) return NULL;
+    if (!path) path = "";
+    FsNode* dir = (path[0] == '/') ? root_dir : current_dir;
+    fs_mount_t* m = mount_of(dir);
+    out[0] = '\0';
+    if (m && dir == current_dir) memcpy(out, mount_cwd, strlen(mount_cwd) + 1);
+    const char* p = path;
+    while (dir && *p) {
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        size_t len = (size_t)(p - start);
+
+        if (len == 1 && start[0] == '.') continue;
+        if (len == 2 && start[0] == '.' && start[1] == '.') {
+            if (m && out[0]) {
+                mount_path_pop(out);
+            } else if (dir->parent) {
+                dir = dir->parent;
+                m = mount_of(dir);
             }
-            return 0;
+            continue;
         }
+        if (m) {
+            if (mount_path_push(out, start, len) != 0) return NULL;
+            continue;
+        }
+        if (len >= MAX_NAME_LEN) return NULL;
+        char name[MAX_NAME_LEN];
+        memcpy(name, start, len);
+        name[len] = '\0';
+        dir = find_child_dir(dir, name);
+        m = mount_of(dir);
+    }
+    return m;
+}
+
+static void set_current_dir(FsNode* dir) {
+    mount_cwd[0] = '\0';
+    cwd_path_valid = 0;
+    if (dir == current_dir) return;
+    fs_node_retain(dir);
+    fs_node_release(current_dir);
+    current_dir = dir;
+}
+
+static FsNode* add_static_file(FsNode* dir, const char* name, const uint8_t* data, size_t size) {
+    FsNode* file = fs_node_alloc(name, FS_NODE_FILE);
+    if (!file) return NULL;
+    file->data = data;
+    file->size = size;
+    dir_link(dir, file);
+    return file;
+}
+
+static FsNode* add_dir(FsNode* dir, const char* name) {
+    FsNode* child = fs_node_alloc(name, FS_NODE_DIR);
+    if (!child) return NULL;
+    dir_link(dir, child);
+    return child;
+}
+
+void fs_init() {
+    memset(mounts, 0, sizeof(mounts));
+    mount_count = 0;
+    handles = NULL;
+    handle_capacity = 0;
+    handle_free_head = HANDLE_NO_SLOT;
+    for (size_t i = 0; i < DCACHE_SLOTS; i++) dcache[i] = NULL;
+    cwd_path_valid = 0;
+    root_dir = fs_node_alloc("/", FS_NODE_DIR);
+    if (!root_dir) {
+        print("fs_init: Memory allocation failed\n");
+        return;
     }
+    add_static_file(root_dir, "file1.txt", file1_data, sizeof(file1_data) - 1);
+    add_static_file(root_dir, "log.txt", log_data, sizeof(log_data) - 1);
+    FsNode* docs = add_dir(root_dir, "docs");
+    if (docs) add_static_file(docs, "readme.txt", readme_data, sizeof(readme_data) - 1);
+    FsNode* etc = add_dir(root_dir, "etc");
+    if (etc) add_static_file(etc, "config.ini", config_data, sizeof(config_data) - 1);
+    current_dir = NULL;
+    set_current_dir(root_dir);
+}
+
+static int handle_table_grow(void) {
+    size_t cap = handle_capacity ? handle_capacity * 2 : HANDLE_TABLE_INITIAL;
+    if (cap > HANDLE_SLOT_MAX) cap = HANDLE_SLOT_MAX;
+    if (cap <= handle_capacity) return -1;
+    FileHandle* grown = (FileHandle*)kmalloc(cap * sizeof(FileHandle));
+    if (!grown) return -1;
+    for (size_t i = 0; i < handle_capacity; i++) grown[i] = handles[i];
+    // Chain the new slots in ascending order in front of the free list.
+    for (size_t i = cap; i-- > handle_capacity;) {
+        grown[i].entry = NULL;
+        grown[i].mount = NULL;
+        grown[i].mfile = NULL;
+        grown[i].offset = 0;
+        grown[i].generation = 1;
+        grown[i].used = 0;
+        grown[i].next_free = handle_free_head;
+        handle_free_head = (uint16_t)i;
+    }
+    if (handles) kfree(handles);
+    handles = grown;
+    handle_capacity = cap;
     return 0;
 }
 
-size_t fs_read(FileHandle* fh, uint8_t* buffer, size_t bytes) {
-    if (!fh || !fh->entry || !buffer) return 0;
-    if (fh->offset >= fh->entry->size) return 0;
-    size_t remain = fh->entry->size - fh->offset;
-    size_t to_read = (bytes < remain) ? bytes : remain;
-    for (size_t i = 0; i < to_read; i++) {
-        buffer[i] = fh->entry->data[fh->offset + i];
+static FileHandle* handle_lookup(fs_handle_t handle) {
+    uint32_t slot = (handle & 0xFFFF) - 1;
+    if (slot >= handle_capacity) return NULL;
+    FileHandle* fh = &handles[slot];
+    if (!fh->used || fh->generation != (uint16_t)(handle >> 16)) return NULL;
+    return fh;
+}
+
+static void refresh_generated(FsNode* file) {
+    uint32_t now = timer_ticks();
+    if ((file->flags & FS_NODE_FRESH) && file->generated_at == now) return;
+    file_truncate(file, 0);
+    file->generate(file);
+    file->generated_at = now;
+    file->flags |= FS_NODE_FRESH;
+}
+
+static FileHandle* handle_alloc(void) {
+    if (handle_free_head == HANDLE_NO_SLOT && handle_table_grow() != 0) return NULL;
+    FileHandle* fh = &handles[handle_free_head];
+    handle_free_head = fh->next_free;
+    fh->used = 1;
+    fh->entry = NULL;
+    fh->mount = NULL;
+    fh->mfile = NULL;
+    fh->offset = 0;
+    return fh;
+}
+
+static fs_handle_t handle_id(const FileHandle* fh) {
+    return ((uint32_t)fh->generation << 16) | (uint32_t)(fh - handles + 1);
+}
+
+static void handle_free(FileHandle* fh) {
+    fh->used = 0;
+    fh->entry = NULL;
+    fh->mount = NULL;
+    fh->mfile = NULL;
+    fh->offset = 0;
+    if (++fh->generation == 0) fh->generation = 1;
+    fh->next_free = handle_free_head;
+    handle_free_head = (uint16_t)(fh - handles);
+}
+
+static fs_handle_t mount_open(fs_mount_t* m, const char* path) {
+    FileHandle* fh = handle_alloc();
+    if (!fh) return FS_INVALID_HANDLE;
+    fh->mfile = m->ops->open(m->vol, path, 0);
+    if (!fh->mfile) {
+        handle_free(fh);
+        return FS_INVALID_HANDLE;
     }
+    fh->mount = m;
+    m->users++;
+    return handle_id(fh);
+}
+
+fs_handle_t fs_open(const char* filename) {
+    if (!current_dir || !filename) return FS_INVALID_HANDLE;
+    fs_mount_t* m = mount_resolve(filename, mount_rest);
+    if (m) return mount_open(m, mount_rest);
+    FsNode* file = resolve_file(filename);
+    if (!file) return FS_INVALID_HANDLE;
+    // Handles hand out views into chunks, so open files are never packed.
+    if (fs_decompress_file(file) != 0) return FS_INVALID_HANDLE;
+    if (file->generate) refresh_generated(file);
+    FileHandle* fh = handle_alloc();
+    if (!fh) return FS_INVALID_HANDLE;
+    fs_node_retain(file);
+    fh->entry = file;
+    return handle_id(fh);
+}
+
+size_t fs_read(fs_handle_t handle, uint8_t* buffer, size_t bytes) {
+    FileHandle* fh = handle_lookup(handle);
+    if (!fh || !buffer) return 0;
+    size_t to_read;
+    if (fh->mount) to_read = fh->mount->ops->read(fh->mfile, fh->offset, buffer, bytes);
+    else to_read = file_read_at(fh->entry, fh->offset, buffer, bytes);
     fh->offset += to_read;
     return to_read;
 }
 
-void fs_close(FileHandle* fh) {
+// Returns the contiguous run of bytes at the handle's offset (up to the end
+// of the current chunk) without copying, and advances past it.
+size_t fs_view(fs_handle_t handle, FsSpan* span) {
+    FileHandle* fh = handle_lookup(handle);
+    if (!span) return 0;
+    span->data = NULL;
+    span->len = 0;
+    if (!fh) return 0;
+    if (fh->mount) {
+        size_t n = fh->mount->ops->read(fh->mfile, fh->offset, mount_view_buf, MOUNT_VIEW_SIZE);
+        span->data = mount_view_buf;
+        span->len = n;
+        fh->offset += n;
+        return n;
+    }
+    FsNode* file = fh->entry;
+    if (fh->offset >= file->size) return 0;
+    size_t len = file->size - fh->offset;
+    if (file->data) {
+        span->data = file->data + fh->offset;
+    } else {
+        size_t in_chunk = fh->offset % FS_CHUNK_SIZE;
+        if (len > FS_CHUNK_SIZE - in_chunk) len = FS_CHUNK_SIZE - in_chunk;
+        span->data = file->chunks[fh->offset / FS_CHUNK_SIZE]->data + in_chunk;
+    }
+    span->len = len;
+    fh->offset += len;
+    return len;
+}
+
+// Maps the whole file when it is stored contiguously; callers fall back to
+// fs_view for files spread over several chunks.
+const uint8_t* fs_map(fs_handle_t handle, size_t* size) {
+    FileHandle* fh = handle_lookup(handle);
+    if (!fh || !fh->entry) return NULL;     // mounted files are never mapped
+    FsNode* file = fh->entry;
+    if (size) *size = file->size;
+    if (file->data) return file->data;
+    if (file->chunk_count == 1) return file->chunks[0]->data;
+    return NULL;
+}
+
+size_t fs_write_handle(fs_handle_t handle, const uint8_t* data, size_t bytes) {
+    FileHandle* fh = handle_lookup(handle);
+    if (!fh || (!data && bytes > 0)) return 0;
+    if (fh->mount) {
+        if (!fh->mount->ops->write) return 0;
+        size_t n = fh->mount->ops->write(fh->mfile, fh->offset, data, bytes);
+        fh->offset += n;
+        return n;
+    }
+    if (fh->entry->flags & FS_NODE_VIRTUAL) return 0;
+    if (file_write_at(fh->entry, fh->offset, data, bytes) != 0) return 0;
+    fh->offset += bytes;
+    return bytes;
+}
+
+// Returns the new position, or -1 when it would fall before the start of
+// the file or past what a size_t offset can hold.
+int64_t fs_seek(fs_handle_t handle, int64_t offset, int whence) {
+    FileHandle* fh = handle_lookup(handle);
+    if (!fh) return -1;
+    size_t size = fh->mount ? fh->mount->ops->size(fh->mfile) : fh->entry->size;
+    int64_t base;
+    if (whence == FS_SEEK_SET) base = 0;
+    else if (whence == FS_SEEK_CUR) base = (int64_t)fh->offset;
+    else if (whence == FS_SEEK_END) base = (int64_t)size;
+    else return -1;
+    // base is at most SIZE_MAX, so only a huge positive offset can overflow.
+    if (offset > INT64_MAX - base) return -1;
+    int64_t pos = base + offset;
+    if (pos < 0 || (uint64_t)pos > (size_t)-1) return -1;
+    fh->offset = (size_t)pos;
+    return pos;
+}
+
+void fs_close(fs_handle_t handle) {
+    FileHandle* fh = handle_lookup(handle);
     if (!fh) return;
-    fh->used = 0;
-    fh->entry = NULL;
-    fh->offset = 0;
+    if (fh->mount) {
+        fh->mount->ops->close(fh->mfile);
+        fh->mount->users--;
+    } else {
+        fh->entry->last_access = timer_ticks();
+        fs_node_release(fh->entry);
+    }
+    handle_free(fh);
 }
 
 int fs_list() {
+    if (mount_of(current_dir)) {
+        FsDirCursor cur;
+        FsDirEntry entry;
+        if (fs_opendir(NULL, &cur) != 0) return -1;
+        print("Contents of directory: ");
+        print(fs_get_cwd());
+        print("\n");
+        while (fs_readdir(&cur, &entry) == 1) {
+            if (entry.type == FS_NODE_DIR) print("<DIR> ");
+            print(entry.name);
+            print("\n");
+        }
+        fs_closedir(&cur);
+        return 0;
+    }
     print("Contents of directory: ");
     print(current_dir->name);
     print("\n");
-    for (size_t i = 0; i < current_dir->file_count; i++) {
-        print(current_dir->files[i].name);
+    for (FsNode* it = current_dir->files; it; it = it->next) {
+        print(it->name);
         print("\n");
     }
-    for (size_t i = 0; i < current_dir->child_count; i++) {
+    for (FsNode* it = current_dir->children; it; it = it->next) {
         print("<DIR> ");
-        print(current_dir->children[i].name);
+        print(it->name);
         print("\n");
     }
     return 0;
 }
 
-static Directory* find_child_dir(Directory* dir, const char* name) {
-    if (!dir) return NULL;
-    for (size_t i = 0; i < dir->child_count; i++) {
-        if (dir_name_equal(dir->children[i].name, name)) return &dir->children[i];
+// Directory cursors walk the sibling lists directly and keep a reference to
+// the next entry. If that entry is deleted meanwhile, the walk resumes after
+// the last sequence number returned instead.
+#define DIRCUR_SUBDIRS 0
+#define DIRCUR_FILES   1
+#define DIRCUR_DONE    2
+
+int fs_opendir(const char* path, FsDirCursor* cur) {
+    if (!cur) return -1;
+    memset(cur, 0, sizeof(FsDirCursor));
+    fs_mount_t* m = mount_resolve(path, mount_rest);
+    if (m) {
+        cur->mdir = m->ops->opendir(m->vol, mount_rest);
+        if (!cur->mdir) return -1;
+        cur->mount = m;
+        m->users++;
+        return 0;
+    }
+    FsNode* dir = (!path || path[0] == '\0') ? current_dir : resolve_dir(path);
+    if (!dir) return -1;
+    fs_node_retain(dir);
+    cur->dir = dir;
+    return 0;
+}
+
+static FsNode* cursor_peek(FsDirCursor* cur) {
+    while (cur->phase != DIRCUR_DONE) {
+        FsNode* node = cur->pos;
+        if (node && node->parent == cur->dir) return node;
+        if (node) {
+            fs_node_release(node);
+            cur->pos = NULL;
+        }
+        node = (cur->phase == DIRCUR_SUBDIRS) ? cur->dir->children : cur->dir->files;
+        while (node && node->seq <= cur->last_seq) node = node->next;
+        if (node) {
+            fs_node_retain(node);
+            cur->pos = node;
+            return node;
+        }
+        cur->phase++;
+        cur->last_seq = 0;
     }
     return NULL;
 }
 
+static void cursor_advance(FsDirCursor* cur, FsNode* node) {
+    FsNode* next = node->next;
+    fs_node_retain(next);
+    cur->last_seq = node->seq;
+    cur->pos = next;
+    fs_node_release(node);
+}
+
+int fs_readdir(FsDirCursor* cur, FsDirEntry* out) {
+    if (!cur || !out) return -1;
+    if (cur->mount) return cur->mount->ops->readdir(cur->mdir, out);
+    if (!cur->dir) return -1;
+    FsNode* node = cursor_peek(cur);
+    if (!node) return 0;
+    memcpy(out->name, node->name, MAX_NAME_LEN);
+    out->type = node->type;
+    out->size = (node->type == FS_NODE_DIR) ? node->child_count + node->file_count : node->size;
+    cursor_advance(cur, node);
+    return 1;
+}
+
+// Moves past `count` entries without copying them out, so callers can jump
+// to the visible part of a long listing. Returns how many were skipped.
+size_t fs_skipdir(FsDirCursor* cur, size_t count) {
+    size_t skipped = 0;
+    if (!cur) return 0;
+    if (cur->mount) {
+        FsDirEntry entry;
+        while (skipped < count && fs_readdir(cur, &entry) == 1) skipped++;
+        return skipped;
+    }
+    if (!cur->dir) return 0;
+    while (skipped < count) {
+        FsNode* node = cursor_peek(cur);
+        if (!node) break;
+        cursor_advance(cur, node);
+        skipped++;
+    }
+    return skipped;
+}
+
+size_t fs_dir_count(const FsDirCursor* cur) {
+    if (cur && cur->mount) return cur->mount->ops->dircount(cur->mdir);
+    if (!cur || !cur->dir) return 0;
+    return cur->dir->child_count + cur->dir->file_count;
+}
+
+void fs_closedir(FsDirCursor* cur) {
+    if (!cur) return;
+    if (cur->mount) {
+        cur->mount->ops->closedir(cur->mdir);
+        cur->mount->users--;
+    }
+    fs_node_release(cur->pos);
+    fs_node_release(cur->dir);
+    memset(cur, 0, sizeof(FsDirCursor));
+}
+
 int fs_change_dir(const char* path) {
     if (!path || path[0] == '\0') {
         return -1;
     }
-    if (path[0] == '/' && path[1] == '\0') {
-        current_dir = &root_dir[0];
-        return 0;
+    if (dir_name_equal(path, "..") && !current_dir->parent) {
+        return -1;
     }
-    if (dir_name_equal(path, "..")) {
-        if (current_dir->parent) {
-            current_dir = current_dir->parent;
+    fs_mount_t* m = mount_resolve(path, mount_rest);
+    if (m) {
+        void* dir = m->ops->opendir(m->vol, mount_rest);
+        if (dir) {
+            m->ops->closedir(dir);
+            set_current_dir(m->node);
+            memcpy(mount_cwd, mount_rest, strlen(mount_rest) + 1);
             return 0;
         }
+        print("cd: Directory not found: ");
+        print(path);
+        print("\n");
         return -1;
     }
-    Directory* found = find_child_dir(current_dir, path);
+    FsNode* found = resolve_dir(path);
     if (found) {
-        current_dir = found;
+        set_current_dir(found);
         return 0;
     }
     print("cd: Directory not found: ");
@@ -152,218 +848,439 @@ int fs_change_dir(const char* path) {
 
 int fs_cd_up() {
     if (!current_dir) return -1;
+    if (mount_cwd[0]) {
+        mount_path_pop(mount_cwd);
+        cwd_path_valid = 0;
+        return 0;
+    }
     if (current_dir->parent) {
-        current_dir = current_dir->parent;
+        set_current_dir(current_dir->parent);
         return 0;
     }
     return -1;
 }
 
+// Writes `size` bytes at `offset` (or at the end, with offset -1) of a file
+// on a mounted volume, creating it first if needed.
+static int mount_put(fs_mount_t* m, const char* path, int flags, const uint8_t* data, size_t size, size_t offset) {
+    if (!m->ops->write) return -1;
+    void* file = m->ops->open(m->vol, path, flags | FS_OPEN_CREATE);
+    if (!file) return -1;
+    if (offset == (size_t)-1) offset = m->ops->size(file);
+    size_t written = size ? m->ops->write(file, offset, data, size) : 0;
+    m->ops->close(file);
+    return written == size ? 0 : -1;
+}
+
 int fs_create(const char* filename) {
     if (!filename || filename[0] == '\0') return -1;
-    for (size_t i = 0; i < current_dir->file_count; i++) {
-        if (dir_name_equal(filename, current_dir->files[i].name)) {
+    fs_mount_t* m = mount_resolve(filename, mount_rest);
+    if (m) {
+        void* file = m->ops->open(m->vol, mount_rest, 0);
+        if (file) {
+            m->ops->close(file);
             print("fs_create: File already exists\n");
             return -1;
         }
+        return mount_put(m, mount_rest, 0, NULL, 0, 0);
     }
-    size_t new_count = current_dir->file_count + 1;
-    FileEntry* new_files = (FileEntry*)kmalloc(new_count * sizeof(FileEntry));
-    if (!new_files) {
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = resolve_parent(filename, leaf);
+    if (!dir || leaf[0] == '\0' || (dir->flags & FS_NODE_VIRTUAL)) return -1;
+    if (find_file(dir, leaf)) {
+        print("fs_create: File already exists\n");
+        return -1;
+    }
+    FsNode* file = fs_node_alloc(leaf, FS_NODE_FILE);
+    if (!file) {
         print("fs_create: Memory allocation failed\n");
         return -1;
     }
-    for (size_t i = 0; i < current_dir->file_count; i++) {
-        new_files[i] = current_dir->files[i];
-    }
-    for (size_t j = 0; j < MAX_NAME_LEN; j++) new_files[new_count - 1].name[j] = 0;
-    strncpy(new_files[new_count - 1].name, filename, MAX_NAME_LEN);
-    new_files[new_count - 1].name[MAX_NAME_LEN - 1] = '\0';
-    new_files[new_count - 1].data = 0;
-    new_files[new_count - 1].size = 0;
-    new_files[new_count - 1].owned = 0;
-    if (current_dir->files != root_files_static &&
-        current_dir->files != docs_files_static &&
-        current_dir->files != etc_files_static) {
-        kfree(current_dir->files);
-    }
-    current_dir->files = new_files;
-    current_dir->file_count = new_count;
+    dir_link(dir, file);
     return 0;
 }
 
+static FsNode* open_or_create(const char* filename) {
+    FsNode* target = resolve_file(filename);
+    if (target) return (target->flags & FS_NODE_VIRTUAL) ? NULL : target;
+    if (fs_create(filename) != 0) return NULL;
+    return resolve_file(filename);
+}
+
 int fs_write(const char* filename, const uint8_t* data, size_t size) {
     if (!filename) return -1;
-    FileEntry* target = NULL;
-    for (size_t i = 0; i < current_dir->file_count; i++) {
-        if (dir_name_equal(filename, current_dir->files[i].name)) {
-            target = &current_dir->files[i];
-            break;
-        }
-    }
-    if (!target) {
-        if (fs_create(filename) != 0) return -1;
-        target = &current_dir->files[current_dir->file_count - 1];
+    fs_mount_t* m = mount_resolve(filename, mount_rest);
+    if (m) return mount_put(m, mount_rest, FS_OPEN_TRUNC, data, size, 0);
+    FsNode* target = open_or_create(filename);
+    if (!target) return -1;
+    // Replacing a built-in or packed file just drops its old contents.
+    if (target->packed) {
+        fs_compress_discard(target);
+        target->size = 0;
     }
-    if (target->owned && target->data) {
-        kfree(target->data);
+    if (target->data) {
         target->data = NULL;
         target->size = 0;
-        target->owned = 0;
-    }
-    if (size > 0) {
-        uint8_t* buf = (uint8_t*)kmalloc(size);
-        if (!buf) return -1;
-        for (size_t i = 0; i < size; i++) buf[i] = data[i];
-        target->data = buf;
-        target->size = size;
-        target->owned = 1;
-    } else {
-        target->data = 0;
-        target->size = 0;
-        target->owned = 1;
     }
+    file_truncate(target, size);
+    if (file_write_at(target, 0, data, size) != 0) return -1;
+    // A whole-file write is complete, so its tail chunk can be shared too.
+    file_seal_chunks(target, 0, target->chunk_count, 1);
+    return 0;
+}
+
+int fs_append(const char* filename, const uint8_t* data, size_t size) {
+    if (!filename) return -1;
+    fs_mount_t* m = mount_resolve(filename, mount_rest);
+    if (m) return mount_put(m, mount_rest, 0, data, size, (size_t)-1);
+    FsNode* target = open_or_create(filename);
+    if (!target) return -1;
+    return file_write_at(target, target->size, data, size);
+}
+
+int fs_pwrite(const char* filename, const uint8_t* data, size_t size, size_t offset) {
+    if (!filename) return -1;
+    fs_mount_t* m = mount_resolve(filename, mount_rest);
+    if (m) return mount_put(m, mount_rest, 0, data, size, offset);
+    FsNode* target = open_or_create(filename);
+    if (!target) return -1;
+    return file_write_at(target, offset, data, size);
+}
+
+// Copies to or from a mounted volume by streaming the data through.
+static int copy_streamed(const char* src, const char* dst) {
+    fs_handle_t in = fs_open(src);
+    if (!in) return -1;
+    int rc = fs_write(dst, NULL, 0);
+    FsSpan span;
+    while (rc == 0 && fs_view(in, &span) > 0) rc = fs_append(dst, span.data, span.len);
+    fs_close(in);
+    return rc;
+}
+
+// Copies a file by sharing its blocks; no file data is duplicated.
+int fs_copy(const char* src, const char* dst) {
+    if (!src || !dst) return -1;
+    if (mount_count > 0) {
+        static char src_rest[FS_PATH_MAX];
+        fs_mount_t* from_m = mount_resolve(src, src_rest);
+        fs_mount_t* to_m = mount_resolve(dst, mount_rest);
+        if (from_m && from_m == to_m && !strcmp(src_rest, mount_rest)) return -1;
+        if (from_m || to_m) return copy_streamed(src, dst);
+    }
+    FsNode* from = resolve_file(src);
+    if (!from) return -1;
+    FsNode* to = open_or_create(dst);
+    if (!to || to == from) return -1;
+    if (fs_decompress_file(from) != 0) return -1;
+    if (from->generate) refresh_generated(from);
+    fs_compress_discard(to);
+    file_free_chunks(to, 0);
+    to->data = from->data;
+    to->size = from->size;
+    if (from->data) return 0;
+    if (file_grow_chunk_array(to, from->chunk_count) != 0) return -1;
+    file_seal_chunks(from, 0, from->chunk_count, 1);
+    for (size_t i = 0; i < from->chunk_count; i++) {
+        fs_block_get(from->chunks[i]);
+        to->chunks[i] = from->chunks[i];
+    }
+    to->chunk_count = from->chunk_count;
     return 0;
 }
 
 int fs_delete(const char* filename) {
     if (!filename || filename[0] == '\0') return -1;
-    size_t idx = current_dir->file_count;
-    for (size_t i = 0; i < current_dir->file_count; i++) {
-        if (dir_name_equal(filename, current_dir->files[i].name)) {
-            idx = i;
-            break;
+    fs_mount_t* m = mount_resolve(filename, mount_rest);
+    if (m) {
+        if (!m->ops->remove || m->ops->remove(m->vol, mount_rest, FS_NODE_FILE) != 0) {
+            print("fs_delete: File not found or read-only\n");
+            return -1;
         }
+        return 0;
     }
-    if (idx == current_dir->file_count) {
+    FsNode* file = resolve_file(filename);
+    if (!file) {
         print("fs_delete: File not found\n");
         return -1;
     }
-    if (current_dir->files[idx].owned && current_dir->files[idx].data) {
-        kfree(current_dir->files[idx].data);
-    }
-    size_t new_count = current_dir->file_count - 1;
-    if (new_count == 0) {
-        if (current_dir->files != root_files_static &&
-            current_dir->files != docs_files_static &&
-            current_dir->files != etc_files_static) {
-            kfree(current_dir->files);
-        }
-        current_dir->files = 0;
-        current_dir->file_count = 0;
-        return 0;
-    }
-    FileEntry* new_files = (FileEntry*)kmalloc(new_count * sizeof(FileEntry));
-    if (!new_files) {
-        print("fs_delete: Memory allocation failed\n");
+    if (file->flags & FS_NODE_VIRTUAL) {
+        print("fs_delete: File is read-only\n");
         return -1;
     }
-    for (size_t i = 0, j = 0; i < current_dir->file_count; i++) {
-        if (i != idx) {
-            new_files[j++] = current_dir->files[i];
-        }
-    }
-    if (current_dir->files != root_files_static &&
-        current_dir->files != docs_files_static &&
-        current_dir->files != etc_files_static) {
-        kfree(current_dir->files);
-    }
-    current_dir->files = new_files;
-    current_dir->file_count = new_count;
+    dir_unlink(file);
     return 0;
 }
 
 int fs_create_dir(const char* dirname) {
     if (!dirname || dirname[0] == '\0') return -1;
-    for (size_t i = 0; i < current_dir->child_count; i++) {
-        if (dir_name_equal(dirname, current_dir->children[i].name)) {
-            print("fs_create_dir: Directory already exists\n");
-            return -1;
-        }
+    fs_mount_t* m = mount_resolve(dirname, mount_rest);
+    if (m) return (m->ops->mkdir && mount_rest[0]) ? m->ops->mkdir(m->vol, mount_rest) : -1;
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = resolve_parent(dirname, leaf);
+    if (!dir || leaf[0] == '\0') return -1;
+    if (find_child_dir(dir, leaf)) {
+        print("fs_create_dir: Directory already exists\n");
+        return -1;
     }
-    Directory* new_children = (Directory*)kmalloc((current_dir->child_count + 1) * sizeof(Directory));
-    if (!new_children) {
+    if (!add_dir(dir, leaf)) {
         print("fs_create_dir: Memory allocation failed\n");
         return -1;
     }
-    for (size_t i = 0; i < current_dir->child_count; i++) {
-        new_children[i] = current_dir->children[i];
-    }
-    for (size_t j = 0; j < MAX_NAME_LEN; j++) new_children[current_dir->child_count].name[j] = 0;
-    strncpy(new_children[current_dir->child_count].name, dirname, MAX_NAME_LEN);
-    new_children[current_dir->child_count].name[MAX_NAME_LEN - 1] = '\0';
-    new_children[current_dir->child_count].files = 0;
-    new_children[current_dir->child_count].file_count = 0;
-    new_children[current_dir->child_count].parent = current_dir;
-    new_children[current_dir->child_count].children = NULL;
-    new_children[current_dir->child_count].child_count = 0;
-    if (current_dir->children) kfree(current_dir->children);
-    current_dir->children = new_children;
-    current_dir->child_count++;
     return 0;
 }
 
 int fs_delete_dir(const char* dirname) {
     if (!dirname || dirname[0] == '\0') return -1;
-    for (size_t i = 0; i < current_dir->child_count; i++) {
-        if (dir_name_equal(dirname, current_dir->children[i].name)) {
-            for (size_t f = 0; f < current_dir->children[i].file_count; f++) {
-                if (current_dir->children[i].files[f].owned && current_dir->children[i].files[f].data) {
-                    kfree(current_dir->children[i].files[f].data);
-                }
-            }
-            if (current_dir->children[i].files &&
-                current_dir->children[i].files != root_files_static &&
-                current_dir->children[i].files != docs_files_static &&
-                current_dir->children[i].files != etc_files_static) {
-                kfree(current_dir->children[i].files);
-            }
-            size_t new_count = current_dir->child_count - 1;
-            if (new_count == 0) {
-                kfree(current_dir->children);
-                current_dir->children = NULL;
-                current_dir->child_count = 0;
-                return 0;
-            }
-            Directory* new_children = (Directory*)kmalloc(new_count * sizeof(Directory));
-            if (!new_children) {
-                print("fs_delete_dir: Memory allocation failed\n");
+    fs_mount_t* m = mount_resolve(dirname, mount_rest);
+    if (m) {
+        size_t len = strlen(mount_rest);
+        if (len == 0) {
+            print("fs_delete_dir: Directory is a mount point\n");
+            return -1;
+        }
+        if (current_dir == m->node && !strncmp(mount_cwd, mount_rest, len) &&
+            (mount_cwd[len] == '\0' || mount_cwd[len] == '/')) {
+            print("fs_delete_dir: Directory is in use\n");
+            return -1;
+        }
+        if (!m->ops->remove || m->ops->remove(m->vol, mount_rest, FS_NODE_DIR) != 0) {
+            print("fs_delete_dir: Directory not found, not empty or read-only\n");
+            return -1;
+        }
+        return 0;
+    }
+    FsNode* dir = resolve_dir(dirname);
+    if (!dir || !dir->parent) {
+        print("fs_delete_dir: Directory not found\n");
+        return -1;
+    }
+    for (int i = 0; i < FS_MOUNT_MAX; i++) {
+        for (FsNode* it = mounts[i].node; it; it = it->parent) {
+            if (it == dir) {
+                print("fs_delete_dir: Directory holds a mount point\n");
                 return -1;
             }
-            for (size_t a = 0, b = 0; a < current_dir->child_count; a++) {
-                if (a != i) new_children[b++] = current_dir->children[a];
-            }
-            kfree(current_dir->children);
-            current_dir->children = new_children;
-            current_dir->child_count = new_count;
-            return 0;
         }
     }
-    print("fs_delete_dir: Directory not found\n");
-    return -1;
+    if (dir->flags & FS_NODE_VIRTUAL) {
+        print("fs_delete_dir: Directory is read-only\n");
+        return -1;
+    }
+    for (FsNode* it = current_dir; it; it = it->parent) {
+        if (it == dir) {
+            print("fs_delete_dir: Directory is in use\n");
+            return -1;
+        }
+    }
+    dir_unlink_tree(dir);
+    dir_unlink(dir);
+    return 0;
+}
+
+// Links a read-only file whose content `generate` rebuilds on open. The
+// containing directory, created if missing, becomes virtual as well unless
+// it is the root.
+int fs_add_generated_file(const char* path, fs_generator_t generate) {
+    if (!path || !generate) return -1;
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = walk_parent(path, leaf, 1);
+    if (!dir || leaf[0] == '\0' || find_file(dir, leaf)) return -1;
+    FsNode* file = fs_node_alloc(leaf, FS_NODE_FILE);
+    if (!file) return -1;
+    file->flags = FS_NODE_VIRTUAL;
+    file->generate = generate;
+    dir_link(dir, file);
+    if (dir != root_dir) dir->flags |= FS_NODE_VIRTUAL;
+    return 0;
+}
+
+// Creates every missing directory along `path`, like `mkdir -p`.
+int fs_create_dirs(const char* path) {
+    if (!path || path[0] == '\0') return -1;
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = walk_parent(path, leaf, 1);
+    if (!dir) return -1;
+    if (leaf[0] != '\0' && !find_child_dir(dir, leaf) && !add_dir(dir, leaf)) return -1;
+    return 0;
+}
+
+// Links a file whose contents stay in memory owned by the caller (boot
+// modules, built-in data). Nothing is copied until the file is first
+// written. Missing parent directories are created, and an existing file at
+// `path` is repointed at the new data.
+int fs_add_external_file(const char* path, const uint8_t* data, size_t size) {
+    if (!path || (!data && size > 0)) return -1;
+    char leaf[MAX_NAME_LEN];
+    FsNode* dir = walk_parent(path, leaf, 1);
+    if (!dir || leaf[0] == '\0') return -1;
+    FsNode* file = find_file(dir, leaf);
+    if (file) {
+        fs_compress_discard(file);
+        file_free_chunks(file, 0);
+        file->data = data;
+        file->size = size;
+        return 0;
+    }
+    return add_static_file(dir, leaf, data, size) ? 0 : -1;
+}
+
+// Writes the absolute path of `dir` to `out`; "/" if it does not fit.
+static void node_path(const FsNode* dir, char* out, size_t cap) {
+    size_t len = 0;
+    for (const FsNode* it = dir; it && it->parent; it = it->parent) {
+        len += strlen(it->name) + 1;
+    }
+    if (len == 0 || len >= cap) {
+        out[0] = '/';
+        out[1] = '\0';
+        return;
+    }
+    // Fill from the right so each name is copied exactly once.
+    out[len] = '\0';
+    size_t pos = len;
+    for (const FsNode* it = dir; it && it->parent; it = it->parent) {
+        size_t name_len = strlen(it->name);
+        pos -= name_len;
+        memcpy(&out[pos], it->name, name_len);
+        out[--pos] = '/';
+    }
 }
 
 const char* fs_get_cwd(void) {
-    static char path[256];
-    for (size_t i = 0; i < sizeof(path); i++) path[i] = 0;
-    if (!current_dir) { path[0] = '/'; path[1] = '\0'; return path; }
-    if (current_dir->parent == NULL) { path[0] = '/'; path[1] = '\0'; return path; }
-    const char* parts[32];
-    int count = 0;
-    Directory* it = current_dir;
-    while (it && it->parent && count < (int)(sizeof(parts)/sizeof(parts[0]))) {
-        parts[count++] = it->name;
-        it = it->parent;
-    }
-    path[0] = '/';
-    path[1] = '\0';
-    for (int i = count - 1; i >= 0; i--) {
-        strcat(path, parts[i]);
-        if (i > 0) strcat(path, "/");
-    }
-    return path;
+    if (cwd_path_valid) return cwd_path;
+    node_path(current_dir, cwd_path, sizeof(cwd_path));
+    size_t len = strlen(cwd_path);
+    size_t sub = strlen(mount_cwd);
+    if (sub && len + sub + 1 < sizeof(cwd_path)) {
+        cwd_path[len] = '/';
+        memcpy(&cwd_path[len + 1], mount_cwd, sub + 1);
+    }
+    cwd_path_valid = 1;
+    return cwd_path;
+}
+
+// Attaches a volume at `path`, which is created if missing and must be an
+// empty directory of this tree. The mount point is virtual, so snapshots
+// skip it.
+int fs_mount(const char* path, const fs_mount_ops_t* ops, void* vol) {
+    if (!path || path[0] != '/' || !ops || mount_count >= FS_MOUNT_MAX) return -1;
+    if (mount_resolve(path, mount_rest)) return -1;
+    if (fs_create_dirs(path) != 0) return -1;
+    FsNode* dir = resolve_dir(path);
+    if (!dir || !dir->parent || dir->children || dir->files) return -1;
+    fs_mount_t* m = NULL;
+    for (int i = 0; i < FS_MOUNT_MAX && !m; i++) {
+        if (!mounts[i].node) m = &mounts[i];
+    }
+    fs_node_retain(dir);
+    dir->flags |= FS_NODE_VIRTUAL | FS_NODE_MOUNT;
+    m->node = dir;
+    m->ops = ops;
+    m->vol = vol;
+    m->users = 0;
+    node_path(dir, m->path, sizeof(m->path));
+    mount_count++;
+    return 0;
+}
+
+// Detaches the volume mounted at `path` and hands it back to its driver,
+// which writes out anything still pending. Fails while files or directory
+// listings on it are open.
+int fs_unmount(const char* path) {
+    fs_mount_t* m = mount_resolve(path, mount_rest);
+    if (!m || mount_rest[0] || m->users) return -1;
+    if (current_dir == m->node) set_current_dir(m->node->parent);
+    m->ops->unmount(m->vol);
+    m->node->flags &= ~(uint32_t)(FS_NODE_VIRTUAL | FS_NODE_MOUNT);
+    fs_node_release(m->node);
+    m->node = NULL;
+    mount_count--;
+    return 0;
+}
+
+int fs_mount_get(int index, const char** path, const char** type) {
+    for (int i = 0; i < FS_MOUNT_MAX; i++) {
+        if (!mounts[i].node || index-- > 0) continue;
+        if (path) *path = mounts[i].path;
+        if (type) *type = mounts[i].ops->name;
+        return 0;
+    }
+    return -1;
 }
 
 const Directory* fs_get_current_dir(void) {
     return current_dir;
 }
+
+FsNode* fs_get_root(void) {
+    return root_dir;
+}
+
+FsNode* fs_node_create(FsNode* dir, const char* name, fs_node_type_t type) {
+    if (!name || name[0] == '\0') return NULL;
+    if (dir && dir_lookup(dir, name, type)) return NULL;
+    FsNode* node = fs_node_alloc(name, type);
+    if (node && dir) dir_link(dir, node);
+    return node;
+}
+
+int fs_node_write(FsNode* file, size_t offset, const uint8_t* data, size_t len) {
+    if (!file || file->type != FS_NODE_FILE) return -1;
+    return file_write_at(file, offset, data, len);
+}
+
+void fs_node_truncate(FsNode* file, size_t size) {
+    if (!file || file->type != FS_NODE_FILE || file->data || file->packed) return;
+    file_truncate(file, size);
+}
+
+size_t fs_node_read(const FsNode* file, size_t offset, uint8_t* dst, size_t len) {
+    if (!file || file->type != FS_NODE_FILE || !dst) return 0;
+    return file_read_at(file, offset, dst, len);
+}
+
+// Drops a tree that is detached or about to be: every entry below `dir` is
+// unlinked, then the caller's reference to `dir` itself is released.
+void fs_node_destroy_tree(FsNode* dir) {
+    if (!dir) return;
+    dir_unlink_tree(dir);
+    if (dir->parent) dir_unlink(dir);
+    else fs_node_release(dir);
+}
+
+// Swaps in a fully built tree (e.g. a restored snapshot) and moves the
+// current directory to its root. Virtual directories are carried over to the
+// new tree; open handles keep their old files alive.
+void fs_replace_root(FsNode* new_root) {
+    if (!new_root || new_root->type != FS_NODE_DIR || new_root == root_dir) return;
+    FsNode* old_root = root_dir;
+    FsNode* it = old_root ? old_root->children : NULL;
+    while (it) {
+        FsNode* next = it->next;
+        if (it->flags & FS_NODE_VIRTUAL) {
+            FsNode* clash = find_child_dir(new_root, it->name);
+            if (clash) fs_node_destroy_tree(clash);
+            fs_node_retain(it);
+            dir_unlink(it);
+            dir_link(new_root, it);
+        }
+        it = next;
+    }
+    root_dir = new_root;
+    // Mount points deeper than the root are relinked at the same path.
+    for (int i = 0; i < FS_MOUNT_MAX; i++) {
+        FsNode* node = mounts[i].node;
+        if (!node || node->parent == new_root) continue;
+        char leaf[MAX_NAME_LEN];
+        FsNode* dir = walk_parent(mounts[i].path, leaf, 1);
+        if (!dir || leaf[0] == '\0') continue;
+        FsNode* clash = find_child_dir(dir, leaf);
+        if (clash) fs_node_destroy_tree(clash);
+        fs_node_retain(node);
+        dir_unlink(node);
+        dir_link(dir, node);
+    }
+    set_current_dir(root_dir);
+    fs_node_destroy_tree(old_root);
+}
@@ -5,44 +5,180 @@
 #include <stdint.h>
 
 #define MAX_NAME_LEN 32
+#define FS_CHUNK_SIZE 512
 
-typedef struct Directory Directory;
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
 
-typedef struct {
-    char name[MAX_NAME_LEN];
-    uint8_t* data;
-    size_t size;
-    int owned;
-} FileEntry;
+typedef enum {
+    FS_NODE_FILE = 1,
+    FS_NODE_DIR = 2
+} fs_node_type_t;
 
-struct Directory {
+typedef struct FsNode FsNode;
+typedef struct fs_block fs_block_t;
+
+// Virtual nodes (procfs) are never written by users, saved in snapshots or
+// compressed. A generated file's content is rebuilt by its generator on
+// open, at most once per timer tick.
+#define FS_NODE_VIRTUAL 0x1
+#define FS_NODE_FRESH   0x2
+#define FS_NODE_MOUNT   0x4     // a mount point; its contents live elsewhere
+typedef void (*fs_generator_t)(FsNode* file);
+
+// Every file and directory is a heap-allocated inode that never moves once
+// created. Siblings are kept on doubly linked lists so inserts and removals
+// never copy or relocate other entries. The tree itself holds one reference,
+// open handles and the current directory hold one each.
+struct FsNode {
     char name[MAX_NAME_LEN];
-    FileEntry* files;
-    size_t file_count;
-    Directory* parent;
-    Directory* children;
+    fs_node_type_t type;
+    uint32_t refcount;
+    FsNode* parent;
+    FsNode* prev;
+    FsNode* next;
+    uint32_t seq;   // link order; increases along every sibling list
+    uint32_t flags;
+
+    // FS_NODE_DIR
+    FsNode* children;
+    FsNode* children_tail;
     size_t child_count;
+    FsNode* files;
+    FsNode* files_tail;
+    size_t file_count;
+
+    // FS_NODE_FILE: contents either live in memory the filesystem does not
+    // own (built-in files, read-only until first written) or are split into
+    // FS_CHUNK_SIZE chunks so writes never need one contiguous allocation.
+    // Chunks are blocks from the deduplicating block store.
+    const uint8_t* data;
+    size_t size;
+    fs_block_t** chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    // Cold files may instead be held LZ-compressed (see compress.c); `size`
+    // stays the uncompressed length.
+    uint8_t* packed;
+    size_t packed_size;
+    uint32_t last_access;
+    fs_generator_t generate;
+    uint32_t generated_at;
 };
 
+typedef FsNode Directory;
+typedef FsNode FileEntry;
+
+// Open files are referred to by 32-bit IDs: the low 16 bits select a slot
+// in the open-file table and the high 16 bits carry that slot's generation.
+// Closing a file bumps the generation, so a stale ID is rejected instead of
+// reaching whatever file reuses the slot. 0 is never a valid handle.
+typedef uint32_t fs_handle_t;
+#define FS_INVALID_HANDLE 0
+
+// Read-only window straight into a file's storage. It stays valid while the
+// handle is open and the file is not written. Files on mounted volumes are
+// read into a shared buffer instead, valid only until the next fs_view.
 typedef struct {
-    FileEntry* entry;
-    size_t offset;
-    int used;
-} FileHandle;
+    const uint8_t* data;
+    size_t len;
+} FsSpan;
+
+// One entry returned by fs_readdir. `size` is the byte length of a file or
+// the number of entries in a directory.
+typedef struct {
+    char name[MAX_NAME_LEN];
+    fs_node_type_t type;
+    size_t size;
+} FsDirEntry;
+
+// Caller-owned directory cursor: subdirectories first, then files, each in
+// creation order. The cursor pins the directory and its next entry, so
+// entries created or deleted while it is open never make it skip or repeat
+// one that survives; new entries show up unless the cursor is already past
+// their list.
+typedef struct fs_mount fs_mount_t;
+
+typedef struct {
+    FsNode* dir;
+    FsNode* pos;
+    uint32_t last_seq;
+    int phase;
+    fs_mount_t* mount;      // set when listing a mounted volume
+    void* mdir;
+} FsDirCursor;
+
+// Other filesystems are attached at empty directories. Every path that
+// crosses a mount point is handed to the mount's ops as the normalized part
+// below it ("docs/a.txt", or "" for the volume root), so drivers never see
+// "." or "..". Ops a read-only driver leaves NULL fail with -1.
+#define FS_MOUNT_MAX 4
+#define FS_PATH_MAX 256
+#define FS_OPEN_CREATE 0x1
+#define FS_OPEN_TRUNC  0x2
+
+typedef struct fs_mount_ops {
+    const char* name;
+    void* (*open)(void* vol, const char* path, int flags);
+    size_t (*read)(void* file, size_t offset, uint8_t* buf, size_t len);
+    size_t (*write)(void* file, size_t offset, const uint8_t* data, size_t len);
+    size_t (*size)(void* file);
+    void (*close)(void* file);
+    void* (*opendir)(void* vol, const char* path);
+    int (*readdir)(void* dir, FsDirEntry* out);     // 1 entry, 0 end, -1 error
+    size_t (*dircount)(void* dir);
+    void (*closedir)(void* dir);
+    int (*mkdir)(void* vol, const char* path);
+    int (*remove)(void* vol, const char* path, fs_node_type_t type);
+    void (*unmount)(void* vol);
+} fs_mount_ops_t;
 
 void fs_init(void);
-FileHandle* fs_open(const char* filename);
-size_t fs_read(FileHandle* fh, uint8_t* buffer, size_t bytes);
-void fs_close(FileHandle* fh);
+fs_handle_t fs_open(const char* filename);
+size_t fs_read(fs_handle_t handle, uint8_t* buffer, size_t bytes);
+size_t fs_view(fs_handle_t handle, FsSpan* span);
+const uint8_t* fs_map(fs_handle_t handle, size_t* size);
+size_t fs_write_handle(fs_handle_t handle, const uint8_t* data, size_t bytes);
+int64_t fs_seek(fs_handle_t handle, int64_t offset, int whence);
+void fs_close(fs_handle_t handle);
 int fs_list(void);
+int fs_opendir(const char* path, FsDirCursor* cur);
+int fs_readdir(FsDirCursor* cur, FsDirEntry* out);
+size_t fs_skipdir(FsDirCursor* cur, size_t count);
+size_t fs_dir_count(const FsDirCursor* cur);
+void fs_closedir(FsDirCursor* cur);
 int fs_change_dir(const char* path);
 int fs_cd_up(void);
 int fs_create(const char* filename);
 int fs_delete(const char* filename);
 int fs_delete_dir(const char* dirname);
 int fs_create_dir(const char* dirname);
+int fs_create_dirs(const char* path);
+int fs_add_external_file(const char* path, const uint8_t* data, size_t size);
+int fs_add_generated_file(const char* path, fs_generator_t generate);
 int fs_write(const char* filename, const uint8_t* data, size_t size);
+int fs_append(const char* filename, const uint8_t* data, size_t size);
+int fs_pwrite(const char* filename, const uint8_t* data, size_t size, size_t offset);
+int fs_copy(const char* src, const char* dst);
 const char* fs_get_cwd(void);
 const Directory* fs_get_current_dir(void);
 
+int fs_mount(const char* path, const fs_mount_ops_t* ops, void* vol);
+int fs_unmount(const char* path);
+int fs_mount_get(int index, const char** path, const char** type);
+
+void fs_node_retain(FsNode* node);
+void fs_node_release(FsNode* node);
+
+// Inode-level access for services that walk or rebuild the whole tree
+// (snapshots). A NULL `dir` creates a detached node.
+FsNode* fs_get_root(void);
+FsNode* fs_node_create(FsNode* dir, const char* name, fs_node_type_t type);
+int fs_node_write(FsNode* file, size_t offset, const uint8_t* data, size_t len);
+void fs_node_truncate(FsNode* file, size_t size);
+size_t fs_node_read(const FsNode* file, size_t offset, uint8_t* dst, size_t len);
+void fs_node_destroy_tree(FsNode* dir);
+void fs_replace_root(FsNode* new_root);
+
 #endif
@@ -0,0 +1,88 @@
+#include "initrd.h"
+#include "filesystem.h"
+#include "../lib/string.h"
+
+// The initrd is a POSIX ustar archive loaded by GRUB as a multiboot module.
+// Only the 512-byte headers are read while indexing; file entries point
+// straight at the data blocks inside the module, so boot time depends on
+// the number of files, not on how many bytes they hold.
+
+#define TAR_BLOCK 512
+#define TAR_PATH_MAX 256
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} __attribute__((packed)) tar_header_t;
+
+static size_t tar_octal(const char* s, size_t len) {
+    size_t val = 0;
+    for (size_t i = 0; i < len && s[i] >= '0' && s[i] <= '7'; i++) {
+        val = (val << 3) | (size_t)(s[i] - '0');
+    }
+    return val;
+}
+
+static size_t append_field(char* dst, size_t pos, const char* src, size_t max) {
+    for (size_t i = 0; i < max && src[i] != '\0' && pos < TAR_PATH_MAX - 1; i++) {
+        dst[pos++] = src[i];
+    }
+    dst[pos] = '\0';
+    return pos;
+}
+
+static void tar_path(const tar_header_t* h, char* out) {
+    size_t pos = 0;
+    out[0] = '/';
+    out[1] = '\0';
+    pos = 1;
+    if (h->prefix[0] != '\0') {
+        pos = append_field(out, pos, h->prefix, sizeof(h->prefix));
+        pos = append_field(out, pos, "/", 1);
+    }
+    append_field(out, pos, h->name, sizeof(h->name));
+}
+
+int initrd_is_archive(const uint8_t* base, size_t size) {
+    if (!base || size < TAR_BLOCK) return 0;
+    const tar_header_t* h = (const tar_header_t*)base;
+    return strncmp(h->magic, "ustar", 5) == 0;
+}
+
+int initrd_load(const uint8_t* base, size_t size) {
+    if (!initrd_is_archive(base, size)) return -1;
+    int files = 0;
+    size_t off = 0;
+    while (off + TAR_BLOCK <= size) {
+        const tar_header_t* h = (const tar_header_t*)(base + off);
+        if (h->name[0] == '\0' || strncmp(h->magic, "ustar", 5) != 0) break;
+        size_t file_size = tar_octal(h->size, sizeof(h->size));
+        size_t data_off = off + TAR_BLOCK;
+        char path[TAR_PATH_MAX];
+        tar_path(h, path);
+
+        if (h->typeflag == '5') {
+            fs_create_dirs(path);
+        } else if (h->typeflag == '0' || h->typeflag == '\0') {
+            if (data_off + file_size > size) break;
+            if (fs_add_external_file(path, base + data_off, file_size) == 0) files++;
+        }
+        off = data_off + ((file_size + TAR_BLOCK - 1) & ~(size_t)(TAR_BLOCK - 1));
+    }
+    return files;
+}
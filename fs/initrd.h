@@ -0,0 +1,10 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+int initrd_is_archive(const uint8_t* base, size_t size);
+int initrd_load(const uint8_t* base, size_t size);
+
+#endif
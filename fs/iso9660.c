@@ -0,0 +1,494 @@
+#include "iso9660.h"
+#include "filesystem.h"
+#include "../drivers/storage/bios_disk.h"
+#include "../drivers/storage/bcache.h"
+#include "../drivers/storage/blkdev.h"
+#include "../lib/memory.h"
+#include "../lib/string.h"
+
+// Read-only ISO9660 driver mounted into the filesystem tree through
+// fs_mount, normally over the boot CD. The drive is addressed in 512-byte
+// sectors like any other, so a 2048-byte logical block n starts at sector
+// 4n.
+//
+// Rock Ridge names (NM, continued through CE areas) are used when the
+// volume carries SUSP; otherwise the plain ISO name is shown lowercased and
+// without its ";1" version. Directories relocated by Rock Ridge (CL/RE)
+// appear where they belong. Name lookups ignore case.
+//
+// Directory blocks are read through the buffer cache, and every record a
+// lookup or listing parses lands in a small direct-mapped cache keyed by
+// (directory, name), so walking the same paths again does not rescan
+// directories. File data bypasses the cache: it is read ahead in runs of
+// up to ISO_RUN_SIZE into a dedicated buffer, and reads that cover a whole
+// run go straight into the caller's buffer.
+
+extern void print(const char*);
+
+#define SECTOR 512
+#define ISO_BLOCK 2048
+#define ISO_SECTORS_PER_BLOCK (ISO_BLOCK / SECTOR)
+#define ISO_PVD_BLOCK 16
+#define ISO_MAX_DESCRIPTORS 32
+#define ISO_NAME_MAX 255
+#define ISO_CE_MAX 8
+#define ISO_RUN_SIZE (64 * 1024)
+#define ISO_RUN_SECTORS (ISO_RUN_SIZE / SECTOR)
+#define ISO_CACHE_SLOTS 128
+#define ISO_CACHE_NAME 48
+
+#define VD_PRIMARY    1
+#define VD_TERMINATOR 255
+
+#define REC_FLAG_DIR 0x02
+
+#define NM_CONTINUE 0x01
+#define NM_CURRENT  0x02
+#define NM_PARENT   0x04
+
+typedef struct {
+    char name[ISO_NAME_MAX + 1];
+    uint32_t extent;    // first logical block
+    uint32_t size;
+    int dir;
+} iso_dirent_t;
+
+typedef struct {
+    int valid;
+    uint32_t parent;
+    uint32_t extent;
+    uint32_t size;
+    int dir;
+    char name[ISO_CACHE_NAME];
+} iso_cache_t;
+
+typedef struct {
+    int mounted;
+    uint8_t drive;
+    uint32_t blocks;
+    uint32_t root_extent;
+    uint32_t root_size;
+    int susp;               // System Use Sharing Protocol present
+    uint32_t susp_skip;     // bytes to skip at the start of each SU area
+    // The directory block last parsed, and a second buffer for CE areas
+    // and relocated directories so a record's block stays put meanwhile.
+    uint8_t block[ISO_BLOCK];
+    uint32_t block_no;
+    int block_valid;
+    uint8_t aux[ISO_BLOCK];
+} iso_volume_t;
+
+typedef struct {
+    uint32_t lba;           // first 512-byte sector
+    uint32_t size;
+} iso_file_t;
+
+typedef struct {
+    uint32_t extent;
+    uint32_t size;
+    uint32_t pos;
+} iso_dir_t;
+
+static iso_volume_t vol;
+static iso_dirent_t found;      // result of the last lookup
+static iso_dirent_t listed;     // scratch for directory listings
+static iso_cache_t cache[ISO_CACHE_SLOTS];
+
+static uint8_t run_buf[ISO_RUN_SIZE];
+static uint32_t run_lba;
+static uint32_t run_count;      // sectors in run_buf, 0 when empty
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static int read_block(uint32_t block, uint8_t* out) {
+    if (block >= vol.blocks) return -1;
+    return bcache_read(vol.drive, (uint64_t)block * ISO_SECTORS_PER_BLOCK, ISO_SECTORS_PER_BLOCK, out);
+}
+
+static uint8_t* load_block(uint32_t block) {
+    if (vol.block_valid && vol.block_no == block) return vol.block;
+    vol.block_valid = 0;
+    if (read_block(block, vol.block) != 0) return NULL;
+    vol.block_no = block;
+    vol.block_valid = 1;
+    return vol.block;
+}
+
+// ---- Directory records ----
+
+// Plain ISO names are upper case with a ";1" version and a '.' even when
+// there is no extension.
+static size_t iso_name(const uint8_t* p, size_t len, char* out) {
+    size_t n = 0;
+    while (n < len && p[n] != ';') n++;
+    while (n > 0 && p[n - 1] == '.') n--;
+    for (size_t i = 0; i < n; i++) out[i] = to_lower((char)p[i]);
+    out[n] = '\0';
+    return n;
+}
+
+// Walks the SUSP entries of one record, following CE continuation areas.
+// Picks up the Rock Ridge name and relocation entries; returns 0 for a
+// record that should stay hidden (RE: a relocated directory's real entry
+// is the CL one in its logical parent).
+static int rock_ridge(const uint8_t* su, uint32_t left, iso_dirent_t* out) {
+    char name[ISO_NAME_MAX + 1];
+    size_t name_len = 0;
+    int have_name = 0;
+    uint32_t child = 0;
+    for (int hops = 0;;) {
+        uint32_t ce_block = 0;
+        uint32_t ce_off = 0;
+        uint32_t ce_len = 0;
+        while (left >= 4) {
+            uint8_t len = su[2];
+            if (len < 4 || len > left) break;
+            if (su[0] == 'N' && su[1] == 'M' && len >= 5) {
+                if (!(su[4] & (NM_CURRENT | NM_PARENT))) {
+                    for (uint32_t i = 5; i < len && name_len < ISO_NAME_MAX; i++) name[name_len++] = (char)su[i];
+                    have_name = 1;
+                }
+            } else if (su[0] == 'R' && su[1] == 'E') {
+                return 0;
+            } else if (su[0] == 'C' && su[1] == 'L' && len >= 12) {
+                child = get_u32(su + 4);
+            } else if (su[0] == 'C' && su[1] == 'E' && len >= 28) {
+                ce_block = get_u32(su + 4);
+                ce_off = get_u32(su + 12);
+                ce_len = get_u32(su + 20);
+            } else if (su[0] == 'S' && su[1] == 'T') {
+                break;
+            }
+            su += len;
+            left -= len;
+        }
+        if (ce_len == 0 || ++hops > ISO_CE_MAX) break;
+        if (ce_off >= ISO_BLOCK || ce_len > ISO_BLOCK - ce_off) break;
+        if (read_block(ce_block, vol.aux) != 0) break;
+        su = vol.aux + ce_off;
+        left = ce_len;
+    }
+    if (have_name && name_len > 0) {
+        memcpy(out->name, name, name_len);
+        out->name[name_len] = '\0';
+    }
+    if (child) {
+        // The placeholder is a file record; the directory's size comes from
+        // the "." record at the start of its extent.
+        if (read_block(child, vol.aux) != 0) return 0;
+        out->extent = child;
+        out->size = get_u32(vol.aux + 10);
+        out->dir = 1;
+    }
+    return 1;
+}
+
+// Fills `out` from the directory record at `rec` (`len` bytes). Returns 0
+// for records that are not listed.
+static int parse_record(const uint8_t* rec, uint32_t len, iso_dirent_t* out) {
+    uint32_t name_len = rec[32];
+    if (33 + name_len > len) return 0;
+    if (name_len == 1 && (rec[33] == 0 || rec[33] == 1)) return 0;   // "." and ".."
+    // File data starts after the extended attribute record, if any.
+    out->extent = get_u32(rec + 2) + rec[1];
+    out->size = get_u32(rec + 10);
+    out->dir = (rec[25] & REC_FLAG_DIR) != 0;
+    if (iso_name(rec + 33, name_len, out->name) == 0) return 0;
+    if (!vol.susp) return 1;
+    uint32_t su = 33 + name_len + !(name_len & 1) + vol.susp_skip;
+    if (su >= len) return 1;
+    return rock_ridge(rec + su, len - su, out);
+}
+
+// Returns the next listed record of the directory, 0 at its end or -1 on a
+// read error or corrupt record. Records never cross a block; the rest of a
+// block after a zero length byte is padding.
+static int dir_next(iso_dir_t* d, iso_dirent_t* out) {
+    while (d->pos < d->size) {
+        uint32_t off = d->pos % ISO_BLOCK;
+        const uint8_t* b = load_block(d->extent + d->pos / ISO_BLOCK);
+        if (!b) return -1;
+        uint32_t len = b[off];
+        if (len == 0) {
+            d->pos += ISO_BLOCK - off;
+            continue;
+        }
+        if (len < 34 || off + len > ISO_BLOCK) return -1;
+        d->pos += len;
+        if (parse_record(b + off, len, out)) return 1;
+    }
+    return 0;
+}
+
+// ---- Lookup cache ----
+
+static uint32_t name_hash(uint32_t parent, const char* name, size_t len) {
+    uint32_t h = 2166136261u ^ parent;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)to_lower(name[i]);
+        h *= 16777619u;
+    }
+    return h % ISO_CACHE_SLOTS;
+}
+
+static int name_equal(const char* a, const char* b, size_t b_len) {
+    for (size_t i = 0; i < b_len; i++) {
+        if (a[i] == '\0' || to_lower(a[i]) != to_lower(b[i])) return 0;
+    }
+    return a[b_len] == '\0';
+}
+
+static void cache_insert(uint32_t parent, const iso_dirent_t* e) {
+    size_t len = strlen(e->name);
+    if (len >= ISO_CACHE_NAME) return;
+    iso_cache_t* c = &cache[name_hash(parent, e->name, len)];
+    c->valid = 1;
+    c->parent = parent;
+    c->extent = e->extent;
+    c->size = e->size;
+    c->dir = e->dir;
+    memcpy(c->name, e->name, len + 1);
+}
+
+// Looks `name` up in the directory at `extent`; the entry is left in
+// `found`.
+static int dir_lookup(uint32_t extent, uint32_t size, const char* name, size_t len) {
+    if (len < ISO_CACHE_NAME) {
+        const iso_cache_t* c = &cache[name_hash(extent, name, len)];
+        if (c->valid && c->parent == extent && name_equal(c->name, name, len)) {
+            memcpy(found.name, c->name, strlen(c->name) + 1);
+            found.extent = c->extent;
+            found.size = c->size;
+            found.dir = c->dir;
+            return 1;
+        }
+    }
+    iso_dir_t d = { extent, size, 0 };
+    while (dir_next(&d, &found) == 1) {
+        if (name_equal(found.name, name, len)) {
+            cache_insert(extent, &found);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Resolves `path` to its record in `found`; the volume root for "".
+static int walk_path(const char* path) {
+    found.name[0] = '\0';
+    found.extent = vol.root_extent;
+    found.size = vol.root_size;
+    found.dir = 1;
+    const char* p = path;
+    for (;;) {
+        while (*p == '/') p++;
+        if (*p == '\0') return 0;
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        if (!found.dir || !dir_lookup(found.extent, found.size, start, (size_t)(p - start))) return -1;
+    }
+}
+
+// ---- File data ----
+
+// Reads `len` bytes at sector `lba` + `offset` bytes of a file that ends at
+// sector `end`. Short reads are served from the read-ahead run, refilled
+// from the current position with up to ISO_RUN_SECTORS of the file.
+static size_t file_read(uint32_t lba, uint32_t end, uint32_t offset, uint8_t* buf, uint32_t len) {
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t sector = lba + (offset + done) / SECTOR;
+        uint32_t in = (offset + done) % SECTOR;
+        uint32_t n;
+        if (in == 0 && len - done >= ISO_RUN_SIZE) {
+            n = (len - done) / SECTOR * SECTOR;
+            if (blkdev_read(vol.drive, sector, n / SECTOR, buf + done) != 0) break;
+        } else {
+            if (run_count == 0 || sector < run_lba || sector >= run_lba + run_count) {
+                uint32_t count = end - sector < ISO_RUN_SECTORS ? end - sector : ISO_RUN_SECTORS;
+                run_count = 0;
+                if (blkdev_read(vol.drive, sector, count, run_buf) != 0) break;
+                run_lba = sector;
+                run_count = count;
+            }
+            n = (run_lba + run_count - sector) * SECTOR - in;
+            if (n > len - done) n = len - done;
+            memcpy(buf + done, run_buf + (sector - run_lba) * SECTOR + in, n);
+        }
+        done += n;
+    }
+    return done;
+}
+
+// ---- fs_mount_ops ----
+
+static void* iso_open(void* v, const char* path, int flags) {
+    (void)v;
+    if (flags || walk_path(path) != 0 || found.dir) return NULL;
+    if ((uint64_t)found.extent * ISO_SECTORS_PER_BLOCK + found.size / SECTOR > (uint64_t)vol.blocks * ISO_SECTORS_PER_BLOCK) {
+        return NULL;
+    }
+    iso_file_t* f = (iso_file_t*)kmalloc(sizeof(iso_file_t));
+    if (!f) return NULL;
+    f->lba = found.extent * ISO_SECTORS_PER_BLOCK;
+    f->size = found.size;
+    return f;
+}
+
+static size_t iso_read(void* file, size_t offset, uint8_t* buf, size_t len) {
+    iso_file_t* f = (iso_file_t*)file;
+    if (offset >= f->size) return 0;
+    if (len > f->size - offset) len = f->size - offset;
+    uint32_t end = f->lba + f->size / SECTOR + (f->size % SECTOR != 0);
+    return file_read(f->lba, end, (uint32_t)offset, buf, (uint32_t)len);
+}
+
+static size_t iso_size(void* file) {
+    return ((iso_file_t*)file)->size;
+}
+
+static void iso_close(void* file) {
+    kfree(file);
+}
+
+static void* iso_opendir(void* v, const char* path) {
+    (void)v;
+    if (walk_path(path) != 0 || !found.dir) return NULL;
+    iso_dir_t* d = (iso_dir_t*)kmalloc(sizeof(iso_dir_t));
+    if (!d) return NULL;
+    d->extent = found.extent;
+    d->size = found.size;
+    d->pos = 0;
+    return d;
+}
+
+static int iso_readdir(void* dir, FsDirEntry* out) {
+    iso_dir_t* d = (iso_dir_t*)dir;
+    int rc = dir_next(d, &listed);
+    if (rc != 1) return rc;
+    cache_insert(d->extent, &listed);
+    size_t len = strlen(listed.name);
+    if (len >= MAX_NAME_LEN) len = MAX_NAME_LEN - 1;
+    memcpy(out->name, listed.name, len);
+    out->name[len] = '\0';
+    out->type = listed.dir ? FS_NODE_DIR : FS_NODE_FILE;
+    out->size = listed.dir ? 0 : listed.size;
+    return 1;
+}
+
+static size_t iso_dircount(void* dir) {
+    iso_dir_t d = *(iso_dir_t*)dir;
+    size_t count = 0;
+    d.pos = 0;
+    while (dir_next(&d, &listed) == 1) count++;
+    return count;
+}
+
+static void iso_closedir(void* dir) {
+    kfree(dir);
+}
+
+static void iso_unmount(void* v) {
+    (void)v;
+    vol.mounted = 0;
+}
+
+static const fs_mount_ops_t iso9660_ops = {
+    "iso9660",
+    iso_open,
+    iso_read,
+    0,
+    iso_size,
+    iso_close,
+    iso_opendir,
+    iso_readdir,
+    iso_dircount,
+    iso_closedir,
+    0,
+    0,
+    iso_unmount,
+};
+
+// ---- Mounting ----
+
+// Looks for the SUSP "SP" entry at the start of the root's "." record,
+// which announces Rock Ridge and gives the per-record skip length.
+static void detect_susp(void) {
+    vol.susp = 0;
+    vol.susp_skip = 0;
+    const uint8_t* b = load_block(vol.root_extent);
+    if (!b) return;
+    uint32_t len = b[0];
+    uint32_t su = 33 + b[32] + !(b[32] & 1);
+    if (len < 34 || su + 7 > len) return;
+    const uint8_t* sp = b + su;
+    if (sp[0] == 'S' && sp[1] == 'P' && sp[2] >= 7 && sp[4] == 0xBE && sp[5] == 0xEF) {
+        vol.susp = 1;
+        vol.susp_skip = sp[6];
+    }
+}
+
+int iso9660_mount(uint8_t drive, const char* path) {
+    if (vol.mounted) {
+        print("iso9660: a volume is already mounted\n");
+        return -1;
+    }
+    const bios_drive_info_t* info = NULL;
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present && d->drive == drive) info = d;
+    }
+    if (!info || info->sector_size != SECTOR) return -1;
+
+    // The disc may have been changed since these sectors were cached.
+    bcache_invalidate(drive);
+    run_count = 0;
+    vol.drive = drive;
+    vol.blocks = (uint32_t)(info->sectors / ISO_SECTORS_PER_BLOCK);
+    vol.block_valid = 0;
+
+    const uint8_t* pvd = NULL;
+    for (uint32_t b = ISO_PVD_BLOCK; b < ISO_PVD_BLOCK + ISO_MAX_DESCRIPTORS; b++) {
+        const uint8_t* vd = load_block(b);
+        if (!vd || memcmp(vd + 1, "CD001", 5) != 0 || vd[0] == VD_TERMINATOR) break;
+        if (vd[0] == VD_PRIMARY) {
+            pvd = vd;
+            break;
+        }
+    }
+    if (!pvd || get_u16(pvd + 128) != ISO_BLOCK) return -1;
+    uint32_t space = get_u32(pvd + 80);
+    if (space < vol.blocks) vol.blocks = space;
+    const uint8_t* root = pvd + 156;
+    vol.root_extent = get_u32(root + 2) + root[1];
+    vol.root_size = get_u32(root + 10);
+    if (root[0] < 34 || !(root[25] & REC_FLAG_DIR) || vol.root_extent >= vol.blocks) return -1;
+    detect_susp();
+    memset(cache, 0, sizeof(cache));
+
+    vol.mounted = 1;
+    if (fs_mount(path, &iso9660_ops, &vol) != 0) {
+        vol.mounted = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int iso9660_mount_media(const char* path) {
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (!d || !d->present || !d->ops || strcmp(d->ops->name, "atapi") != 0) continue;
+        if (iso9660_mount(d->drive, path) == 0) return 0;
+    }
+    return -1;
+}
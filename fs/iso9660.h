@@ -0,0 +1,13 @@
+#ifndef ISO9660_H
+#define ISO9660_H
+
+#include <stdint.h>
+
+// Mounts the ISO9660 filesystem on `drive` at `path`, read-only. One
+// volume can be mounted at a time.
+int iso9660_mount(uint8_t drive, const char* path);
+
+// Mounts the disc in the first CD drive holding an ISO9660 volume.
+int iso9660_mount_media(const char* path);
+
+#endif
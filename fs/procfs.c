@@ -0,0 +1,155 @@
+#include "procfs.h"
+#include "filesystem.h"
+#include "blockstore.h"
+#include "compress.h"
+#include "../lib/memory.h"
+#include "../lib/string.h"
+#include "../drivers/timer/timer.h"
+#include "../drivers/pci/pci.h"
+#include "../drivers/usb/usb.h"
+#include "../drivers/usb/host/host.h"
+#include "../taskmgr/process.h"
+#include "../kernel.h"
+
+#define PROC_BUF_SIZE 4096
+#define PROC_MAX_PCI  32
+
+// Generators format into this buffer and store it as the file's content.
+static char proc_buf[PROC_BUF_SIZE];
+static size_t proc_len;
+
+static void emit(const char* s) {
+    while (*s && proc_len < PROC_BUF_SIZE) proc_buf[proc_len++] = *s++;
+}
+
+static void emit_uint(uint32_t value) {
+    char buf[12];
+    size_t n = 0;
+    do {
+        buf[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n > 0 && proc_len < PROC_BUF_SIZE) proc_buf[proc_len++] = buf[--n];
+}
+
+static void emit_hex(uint32_t value, int digits) {
+    static const char hex[] = "0123456789abcdef";
+    for (int shift = (digits - 1) * 4; shift >= 0 && proc_len < PROC_BUF_SIZE; shift -= 4) {
+        proc_buf[proc_len++] = hex[(value >> shift) & 0xF];
+    }
+}
+
+static void emit_field(const char* label, uint32_t value, const char* unit) {
+    emit(label);
+    emit_uint(value);
+    emit(unit);
+}
+
+static void flush_to(FsNode* file) {
+    fs_node_write(file, 0, (const uint8_t*)proc_buf, proc_len);
+    proc_len = 0;
+}
+
+static void gen_meminfo(FsNode* file) {
+    fs_block_stats_t blocks;
+    fs_compress_stats_t packed;
+    fs_block_get_stats(&blocks);
+    fs_compress_get_stats(&packed);
+    size_t total = memory_capacity();
+    size_t used = memory_used();
+    emit_field("HeapTotal:    ", (uint32_t)total, " bytes\n");
+    emit_field("HeapUsed:     ", (uint32_t)used, " bytes\n");
+    emit_field("HeapFree:     ", (uint32_t)(total - used), " bytes\n");
+    emit_field("FileBlocks:   ", blocks.physical_blocks, "\n");
+    emit_field("FileBlockRefs:", blocks.block_refs, "\n");
+    emit_field("PackedFiles:  ", packed.packed_files, "\n");
+    emit_field("PackedBytes:  ", packed.packed_bytes, " bytes\n");
+    emit_field("PackedLogical:", packed.logical_bytes, " bytes\n");
+    flush_to(file);
+}
+
+static void gen_processes(FsNode* file) {
+    process_entry_t* table = get_kernel_process_table();
+    int count = get_kernel_process_count();
+    emit("PID  MEM(KB)  NAME\n");
+    for (int i = 0; i < count; i++) {
+        if (!table[i].active) continue;
+        emit_uint((uint32_t)table[i].pid);
+        emit("  ");
+        emit_uint((uint32_t)table[i].memory_kb);
+        emit("  ");
+        emit(table[i].name);
+        emit("\n");
+    }
+    flush_to(file);
+}
+
+static void gen_pci(FsNode* file) {
+    static pci_device_t devices[PROC_MAX_PCI];
+    int found = pci_enumerate(devices, PROC_MAX_PCI);
+    for (int i = 0; i < found && i < PROC_MAX_PCI; i++) {
+        const pci_device_t* d = &devices[i];
+        emit_hex(d->bus, 2);
+        emit(":");
+        emit_hex(d->slot, 2);
+        emit(".");
+        emit_hex(d->func, 1);
+        emit(" ");
+        emit_hex(d->vendor_id, 4);
+        emit(":");
+        emit_hex(d->device_id, 4);
+        emit(" class ");
+        emit_hex(d->base_class, 2);
+        emit_hex(d->sub_class, 2);
+        emit_hex(d->prog_if, 2);
+        emit("\n");
+    }
+    if (found > PROC_MAX_PCI) emit_field("... ", (uint32_t)(found - PROC_MAX_PCI), " more\n");
+    flush_to(file);
+}
+
+static void gen_usb(FsNode* file) {
+    uint8_t type = usb_host_controller_type();
+    emit("Controller: ");
+    if (!usb_host_ready()) emit("none");
+    else if (type == 0x00) emit("UHCI");
+    else emit("other");
+    emit("\nHealthy:    ");
+    emit(usb_host_is_healthy() ? "yes" : "no");
+    emit("\nPointer:    ");
+    emit(usb_has_pointer_device() ? "yes" : "no");
+    emit("\nTouchpad:   ");
+    emit(usb_has_touchpad_device() ? "yes" : "no");
+    emit("\n");
+    flush_to(file);
+}
+
+static void gen_irqstats(FsNode* file) {
+    emit_field("IRQ0  timer    ", kernel_irq_count(0), "\n");
+    emit_field("IRQ1  keyboard ", kernel_irq_count(1), "\n");
+    emit_field("IRQ12 mouse    ", kernel_irq_count(12), "\n");
+    emit_field("IRQ14 ide0     ", kernel_irq_count(14), "\n");
+    emit_field("IRQ15 ide1     ", kernel_irq_count(15), "\n");
+    flush_to(file);
+}
+
+// The timer runs at 100 Hz.
+static void gen_uptime(FsNode* file) {
+    uint32_t ticks = timer_ticks();
+    emit_uint(ticks / 100);
+    emit(".");
+    if (ticks % 100 < 10) emit("0");
+    emit_uint(ticks % 100);
+    emit(" s\n");
+    emit_field("ticks ", ticks, "\n");
+    flush_to(file);
+}
+
+void procfs_init(void) {
+    fs_add_generated_file("/proc/meminfo", gen_meminfo);
+    fs_add_generated_file("/proc/processes", gen_processes);
+    fs_add_generated_file("/proc/pci", gen_pci);
+    fs_add_generated_file("/proc/usb", gen_usb);
+    fs_add_generated_file("/proc/irqstats", gen_irqstats);
+    fs_add_generated_file("/proc/uptime", gen_uptime);
+}
@@ -0,0 +1,8 @@
+#ifndef PROCFS_H
+#define PROCFS_H
+
+// Registers the /proc virtual files: meminfo, processes, pci, usb,
+// irqstats and uptime. Their text is only built when a file is opened.
+void procfs_init(void);
+
+#endif
@@ -0,0 +1,322 @@
+#include "snapshot.h"
+#include "filesystem.h"
+#include "../drivers/storage/bcache.h"
+#include "../drivers/storage/bios_disk.h"
+#include "../drivers/storage/partition.h"
+#include "../lib/crc32c.h"
+#include "../lib/string.h"
+
+// On-disk layout, starting at the snapshot LBA:
+//
+//   sector 0   snapshot_header_t
+//   sector 1.. body: one record per node in preorder, each followed by the
+//              file's contents
+//
+// A record is { u32 parent, u32 size, u8 type, u8 name_len, name[] }, where
+// `parent` is the index of an earlier directory record (or SNAP_ROOT).
+// Preorder means a record's parent is always one of the directories on the
+// path being rebuilt, so the loader only needs a small stack. The header and
+// the body each carry a CRC-32C; the body is streamed through a staging
+// buffer in SNAP_IO_SECTORS-sized extents in both directions.
+
+#define SNAP_MAGIC 0x504E5347u  // "GSNP"
+#define SNAP_VERSION 1
+#define SNAP_ROOT 0xFFFFFFFFu
+#define SNAP_SECTOR 512
+#define SNAP_IO_SECTORS 32
+#define SNAP_MAX_DEPTH 64
+#define SNAP_RECORD_FIXED 10
+#define ISO_DESCRIPTOR_LBA 64   // ISO9660 volume descriptors start 32 KiB in
+
+extern void print(const char*);
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t node_count;
+    uint32_t body_bytes;
+    uint32_t body_crc;
+    uint32_t header_crc;
+} __attribute__((packed)) snapshot_header_t;
+
+typedef struct {
+    uint8_t drive;
+    uint32_t next_lba;
+    size_t fill;
+    size_t avail;
+    uint32_t remaining;
+    uint32_t crc;
+    int error;
+} snap_stream_t;
+
+static uint8_t snap_buf[SNAP_IO_SECTORS * SNAP_SECTOR];
+
+static void stream_flush(snap_stream_t* s) {
+    if (s->error || s->fill == 0) return;
+    uint16_t sectors = (uint16_t)((s->fill + SNAP_SECTOR - 1) / SNAP_SECTOR);
+    memset(snap_buf + s->fill, 0, (size_t)sectors * SNAP_SECTOR - s->fill);
+    if (bcache_write(s->drive, s->next_lba, sectors, snap_buf) != 0) s->error = 1;
+    s->next_lba += sectors;
+    s->fill = 0;
+}
+
+static void stream_put(snap_stream_t* s, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    s->crc = crc32c(s->crc, p, len);
+    while (len > 0 && !s->error) {
+        size_t n = sizeof(snap_buf) - s->fill;
+        if (n > len) n = len;
+        memcpy(snap_buf + s->fill, p, n);
+        s->fill += n;
+        p += n;
+        len -= n;
+        if (s->fill == sizeof(snap_buf)) stream_flush(s);
+    }
+}
+
+static int stream_fill(snap_stream_t* s) {
+    if (s->fill < s->avail) return 0;
+    if (s->remaining == 0) return -1;
+    uint32_t sectors = (s->remaining + SNAP_SECTOR - 1) / SNAP_SECTOR;
+    if (sectors > SNAP_IO_SECTORS) sectors = SNAP_IO_SECTORS;
+    if (bcache_read(s->drive, s->next_lba, sectors, snap_buf) != 0) return -1;
+    s->next_lba += sectors;
+    s->avail = sectors * SNAP_SECTOR;
+    if (s->avail > s->remaining) s->avail = s->remaining;
+    s->remaining -= (uint32_t)s->avail;
+    s->fill = 0;
+    return 0;
+}
+
+static int stream_get(snap_stream_t* s, void* out, size_t len) {
+    uint8_t* p = (uint8_t*)out;
+    while (len > 0) {
+        if (stream_fill(s) != 0) return -1;
+        size_t n = s->avail - s->fill;
+        if (n > len) n = len;
+        memcpy(p, snap_buf + s->fill, n);
+        s->crc = crc32c(s->crc, p, n);
+        s->fill += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Moves `size` bytes of file contents from the staging buffer into `file`.
+static int stream_get_file(snap_stream_t* s, FsNode* file, uint32_t size) {
+    uint32_t off = 0;
+    while (off < size) {
+        if (stream_fill(s) != 0) return -1;
+        size_t n = s->avail - s->fill;
+        if (n > size - off) n = size - off;
+        s->crc = crc32c(s->crc, snap_buf + s->fill, n);
+        if (fs_node_write(file, off, snap_buf + s->fill, n) != 0) return -1;
+        s->fill += n;
+        off += (uint32_t)n;
+    }
+    return 0;
+}
+
+static void put_record(snap_stream_t* s, uint32_t parent, const FsNode* node) {
+    uint8_t rec[SNAP_RECORD_FIXED];
+    uint32_t size = (node->type == FS_NODE_FILE) ? (uint32_t)node->size : 0;
+    uint8_t name_len = (uint8_t)strlen(node->name);
+    memcpy(rec, &parent, 4);
+    memcpy(rec + 4, &size, 4);
+    rec[8] = (uint8_t)node->type;
+    rec[9] = name_len;
+    stream_put(s, rec, sizeof(rec));
+    stream_put(s, node->name, name_len);
+}
+
+// File contents are read straight into the staging buffer.
+static void put_file_data(snap_stream_t* s, const FsNode* file) {
+    size_t off = 0;
+    while (off < file->size && !s->error) {
+        size_t n = fs_node_read(file, off, snap_buf + s->fill, sizeof(snap_buf) - s->fill);
+        if (n == 0) break;
+        s->crc = crc32c(s->crc, snap_buf + s->fill, n);
+        s->fill += n;
+        off += n;
+        if (s->fill == sizeof(snap_buf)) stream_flush(s);
+    }
+}
+
+// Emits `dir`'s files and subdirectories, skipping virtual ones; `index`
+// numbers records in the order they are written. With a NULL stream it only
+// counts.
+static int save_dir(snap_stream_t* s, const FsNode* dir, uint32_t dir_index,
+                    uint32_t* index, uint32_t* body_bytes, int depth) {
+    if (depth >= SNAP_MAX_DEPTH) return -1;
+    for (const FsNode* f = dir->files; f; f = f->next) {
+        if (f->flags & FS_NODE_VIRTUAL) continue;
+        if (s) {
+            put_record(s, dir_index, f);
+            put_file_data(s, f);
+        }
+        *body_bytes += SNAP_RECORD_FIXED + (uint32_t)strlen(f->name) + (uint32_t)f->size;
+        (*index)++;
+    }
+    for (const FsNode* d = dir->children; d; d = d->next) {
+        if (d->flags & FS_NODE_VIRTUAL) continue;
+        uint32_t my_index = (*index)++;
+        if (s) put_record(s, dir_index, d);
+        *body_bytes += SNAP_RECORD_FIXED + (uint32_t)strlen(d->name);
+        if (save_dir(s, d, my_index, index, body_bytes, depth + 1) != 0) return -1;
+    }
+    return 0;
+}
+
+static const bios_drive_info_t* find_drive(uint8_t drive) {
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present && d->drive == drive) return d;
+    }
+    return 0;
+}
+
+static int overlaps(uint64_t a, uint64_t a_len, uint64_t b, uint64_t b_len) {
+    return a < b + b_len && b < a + a_len;
+}
+
+// Checks that [lba, lba + sectors) on `drive` belongs to nobody else: it
+// must lie in a snapshot partition, or on a whole disk clear of every
+// partition, the boot sector and any ISO9660 image written by install.
+static int target_ok(uint8_t drive, uint32_t lba, uint32_t sectors) {
+    const bios_drive_info_t* d = find_drive(drive);
+    if (!d || d->sector_size != SNAP_SECTOR) return 0;
+    if ((uint64_t)lba + sectors > d->sectors) return 0;
+    if (d->parent) return d->part_type == PARTITION_TYPE_SNAPSHOT;
+    if (lba == 0) return 0;
+
+    partition_t parts[PARTITION_MAX];
+    int found = partition_parse(d, parts, PARTITION_MAX);
+    for (int i = 0; i < found; i++) {
+        if (overlaps(lba, sectors, parts[i].start, parts[i].sectors)) return 0;
+    }
+    if (bcache_read(drive, ISO_DESCRIPTOR_LBA, 1, snap_buf) != 0) return 0;
+    if (memcmp(snap_buf + 1, "CD001", 5) == 0) {
+        uint32_t blocks;
+        memcpy(&blocks, snap_buf + 80, 4);
+        if (overlaps(lba, sectors, 0, (uint64_t)blocks * 4)) return 0;
+    }
+    return 1;
+}
+
+// Where a snapshot goes on `drive`: the start of a snapshot partition, or
+// FS_SNAPSHOT_LBA on a whole disk. Other partitions cannot hold one.
+int fs_snapshot_location(uint8_t drive, uint32_t* lba) {
+    const bios_drive_info_t* d = find_drive(drive);
+    if (!d) return -1;
+    if (d->parent && d->part_type != PARTITION_TYPE_SNAPSHOT) return -1;
+    *lba = d->parent ? 0 : FS_SNAPSHOT_LBA;
+    return 0;
+}
+
+// The first snapshot partition on any disk.
+int fs_snapshot_find(uint8_t* drive, uint32_t* lba) {
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present && d->parent && d->part_type == PARTITION_TYPE_SNAPSHOT) {
+            *drive = d->drive;
+            *lba = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int fs_snapshot_save(uint8_t drive, uint32_t lba) {
+    FsNode* root = fs_get_root();
+    if (!root) return -1;
+
+    uint32_t count = 0, body_bytes = 0;
+    if (save_dir(NULL, root, SNAP_ROOT, &count, &body_bytes, 0) != 0) return -1;
+    if (!target_ok(drive, lba, 1 + (body_bytes + SNAP_SECTOR - 1) / SNAP_SECTOR)) {
+        print("snapshot: refusing to overwrite a partition or boot image\n");
+        return -1;
+    }
+
+    snap_stream_t s;
+    memset(&s, 0, sizeof(s));
+    s.drive = drive;
+    s.next_lba = lba + 1;
+    uint32_t index = 0, written = 0;
+    save_dir(&s, root, SNAP_ROOT, &index, &written, 0);
+    stream_flush(&s);
+    if (s.error || bcache_sync(drive) != 0) return -1;
+
+    // The header goes last, after the body is on disk, so an interrupted
+    // save never looks complete.
+    snapshot_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SNAP_MAGIC;
+    hdr.version = SNAP_VERSION;
+    hdr.node_count = count;
+    hdr.body_bytes = body_bytes;
+    hdr.body_crc = s.crc;
+    hdr.header_crc = crc32c(0, &hdr, sizeof(hdr) - sizeof(hdr.header_crc));
+    memset(snap_buf, 0, SNAP_SECTOR);
+    memcpy(snap_buf, &hdr, sizeof(hdr));
+    if (bcache_write(drive, lba, 1, snap_buf) != 0) return -1;
+    return bcache_sync(drive);
+}
+
+int fs_snapshot_load(uint8_t drive, uint32_t lba) {
+    snapshot_header_t hdr;
+    if (bcache_read(drive, lba, 1, snap_buf) != 0) return -1;
+    memcpy(&hdr, snap_buf, sizeof(hdr));
+    if (hdr.magic != SNAP_MAGIC || hdr.version != SNAP_VERSION) return -1;
+    if (hdr.header_crc != crc32c(0, &hdr, sizeof(hdr) - sizeof(hdr.header_crc))) return -1;
+
+    FsNode* root = fs_node_create(NULL, "/", FS_NODE_DIR);
+    if (!root) return -1;
+
+    // Directories on the path being rebuilt, with their record indices.
+    FsNode* stack_node[SNAP_MAX_DEPTH + 1];
+    uint32_t stack_index[SNAP_MAX_DEPTH + 1];
+    int depth = 0;
+    stack_node[0] = root;
+    stack_index[0] = SNAP_ROOT;
+
+    snap_stream_t s;
+    memset(&s, 0, sizeof(s));
+    s.drive = drive;
+    s.next_lba = lba + 1;
+    s.remaining = hdr.body_bytes;
+
+    int ok = 1;
+    for (uint32_t i = 0; i < hdr.node_count && ok; i++) {
+        uint8_t rec[SNAP_RECORD_FIXED];
+        char name[MAX_NAME_LEN];
+        uint32_t parent, size;
+        if (stream_get(&s, rec, sizeof(rec)) != 0) { ok = 0; break; }
+        memcpy(&parent, rec, 4);
+        memcpy(&size, rec + 4, 4);
+        if (rec[8] != FS_NODE_FILE && rec[8] != FS_NODE_DIR) { ok = 0; break; }
+        if (rec[9] == 0 || rec[9] >= MAX_NAME_LEN || stream_get(&s, name, rec[9]) != 0) { ok = 0; break; }
+        name[rec[9]] = '\0';
+
+        while (depth > 0 && stack_index[depth] != parent) depth--;
+        if (stack_index[depth] != parent) { ok = 0; break; }
+
+        FsNode* node = fs_node_create(stack_node[depth], name, (fs_node_type_t)rec[8]);
+        if (!node) { ok = 0; break; }
+        if (rec[8] == FS_NODE_DIR) {
+            if (depth == SNAP_MAX_DEPTH) { ok = 0; break; }
+            depth++;
+            stack_node[depth] = node;
+            stack_index[depth] = i;
+            continue;
+        }
+        if (stream_get_file(&s, node, size) != 0) ok = 0;
+    }
+    if (!ok || s.crc != hdr.body_crc) {
+        fs_node_destroy_tree(root);
+        return -1;
+    }
+    fs_replace_root(root);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+// Snapshots belong at the start of a partition of type
+// PARTITION_TYPE_SNAPSHOT. A whole disk can hold one FS_SNAPSHOT_LBA
+// sectors in, but only while no partition or boot image covers that range;
+// saves anywhere else are refused.
+#define FS_SNAPSHOT_LBA 2048
+
+int fs_snapshot_find(uint8_t* drive, uint32_t* lba);
+int fs_snapshot_location(uint8_t drive, uint32_t* lba);
+int fs_snapshot_save(uint8_t drive, uint32_t lba);
+int fs_snapshot_load(uint8_t drive, uint32_t lba);
+
+#endif
@@ -4,9 +4,12 @@
 #include "../drivers/input/input.h"
 #include "../drivers/timer/timer.h"
 #include "../fs/filesystem.h"
+#include "../fs/compress.h"
 #include "../lib/memory.h"
 #include "../lib/string.h"
 #include "../shell/shell.h"
+#include "../drivers/storage/ioring.h"
+#include "../drivers/storage/bcache.h"
 
 typedef struct {
     int tick_count;
@@ -63,6 +66,7 @@ typedef struct {
 
 typedef struct {
     int selected;
+    int top;
 } app_explorer_state_t;
 
 typedef enum {
@@ -399,9 +403,8 @@ static void notepad_backspace_at_cursor(app_notepad_state_t* note) {
 }
 
 static void notepad_load_file(app_notepad_state_t* note, const char* filename) {
-    FileHandle* fh;
-    uint8_t buf[128];
-    size_t n;
+    fs_handle_t fh;
+    FsSpan span;
     note->len = 0;
     note->cursor = 0;
     note->preferred_col = -1;
@@ -411,8 +414,8 @@ static void notepad_load_file(app_notepad_state_t* note, const char* filename) {
     note->filename[31] = '\0';
     fh = fs_open(filename);
     if (!fh) return;
-    while ((n = fs_read(fh, buf, sizeof(buf))) > 0 && note->len < NOTE_MAX_TEXT - 1) {
-        for (size_t i = 0; i < n && note->len < NOTE_MAX_TEXT - 1; i++) note->text[note->len++] = (char)buf[i];
+    while (fs_view(fh, &span) > 0 && note->len < NOTE_MAX_TEXT - 1) {
+        for (size_t i = 0; i < span.len && note->len < NOTE_MAX_TEXT - 1; i++) note->text[note->len++] = (char)span.data[i];
     }
     note->text[note->len] = '\0';
     note->cursor = note->len;
@@ -622,47 +625,44 @@ static void app_cubedip_key(Window* win, char key) {
     if (key == 's' || key == 'S') s->last_fall_tick = 0;
 }
 
-static int explorer_total_entries(const Directory* dir) {
-    if (!dir) return 0;
-    return (int)dir->child_count + (int)dir->file_count;
-}
-
-static int explorer_is_dir_entry(const Directory* dir, int idx) {
-    return dir && idx >= 0 && idx < (int)dir->child_count;
-}
-
-static const char* explorer_entry_name(const Directory* dir, int idx) {
-    if (!dir || idx < 0) return "";
-    if (idx < (int)dir->child_count) return dir->children[idx].name;
-    idx -= (int)dir->child_count;
-    if (idx < (int)dir->file_count) return dir->files[idx].name;
-    return "";
+static int explorer_entry_at(int idx, FsDirEntry* out) {
+    FsDirCursor cur;
+    int found = 0;
+    if (idx < 0 || fs_opendir(NULL, &cur) != 0) return 0;
+    if (fs_skipdir(&cur, (size_t)idx) == (size_t)idx) found = fs_readdir(&cur, out) == 1;
+    fs_closedir(&cur);
+    return found;
 }
 
 static void app_explorer_tick(Window* win, uint32_t ticks) {
-    const Directory* dir = fs_get_current_dir();
     app_explorer_state_t* state = (app_explorer_state_t*)win->app_state;
+    FsDirCursor cur;
+    FsDirEntry entry;
     int total;
+    int visible = win->height - 1;
     int row = 1;
     (void)ticks;
-    if (!state || !dir) return;
+    if (!state || visible <= 0 || fs_opendir(NULL, &cur) != 0) return;
 
-    total = explorer_total_entries(dir);
+    total = (int)fs_dir_count(&cur);
+    if (state->selected >= total) state->selected = total - 1;
     if (state->selected < 0) state->selected = 0;
-    if (state->selected >= total && total > 0) state->selected = total - 1;
+    if (state->selected < state->top) state->top = state->selected;
+    if (state->selected >= state->top + visible) state->top = state->selected - visible + 1;
 
     // TempleOS-inspired compact contrast: dark blue background + bright text.
     gui_clear_window(win, VGA_COLOR_WHITE | (VGA_COLOR_BLUE << 4));
     gui_draw_text(win, 0, 0, "DIR ", VGA_COLOR_LIGHT_CYAN | (VGA_COLOR_BLUE << 4));
     gui_draw_text(win, 4, 0, fs_get_cwd(), VGA_COLOR_WHITE | (VGA_COLOR_BLUE << 4));
 
-    for (int i = 0; i < total && row < win->height; i++, row++) {
+    // Only the visible slice of the directory is read.
+    int i = state->top + (int)fs_skipdir(&cur, (size_t)state->top);
+    for (; row < win->height && fs_readdir(&cur, &entry) == 1; i++, row++) {
         char line[64];
-        const char* name = explorer_entry_name(dir, i);
-        int is_dir = explorer_is_dir_entry(dir, i);
+        int is_dir = entry.type == FS_NODE_DIR;
         line[0] = '\0';
         append_limited(line, is_dir ? "[D] " : "[F] ", sizeof(line));
-        append_limited(line, name, sizeof(line));
+        append_limited(line, entry.name, sizeof(line));
         gui_draw_text(
             win,
             0,
@@ -673,6 +673,7 @@ static void app_explorer_tick(Window* win, uint32_t ticks) {
                 : (is_dir ? (VGA_COLOR_LIGHT_GREEN | (VGA_COLOR_BLUE << 4))
                           : (VGA_COLOR_WHITE | (VGA_COLOR_BLUE << 4))));
     }
+    fs_closedir(&cur);
 
     if (row < win->height) {
         gui_draw_text(win, 0, row, "Enter=open  Backspace=up  F2=edit", VGA_COLOR_LIGHT_CYAN | (VGA_COLOR_BLUE << 4));
@@ -680,11 +681,13 @@ static void app_explorer_tick(Window* win, uint32_t ticks) {
 }
 
 static void app_explorer_key(Window* win, char key) {
-    const Directory* dir = fs_get_current_dir();
     app_explorer_state_t* state = (app_explorer_state_t*)win->app_state;
+    FsDirCursor cur;
+    FsDirEntry entry;
     int total;
-    if (!state || !dir) return;
-    total = explorer_total_entries(dir);
+    if (!state || fs_opendir(NULL, &cur) != 0) return;
+    total = (int)fs_dir_count(&cur);
+    fs_closedir(&cur);
     if (total <= 0) return;
 
     if ((unsigned char)key == KEY_UP) {
@@ -696,15 +699,15 @@ static void app_explorer_key(Window* win, char key) {
         return;
     }
     if ((unsigned char)key == KEY_BACKSPACE) {
-        if (fs_cd_up() == 0) state->selected = 0;
+        if (fs_cd_up() == 0) state->selected = state->top = 0;
         return;
     }
     if (key == '\r' || key == '\n' || (unsigned char)key == KEY_F2) {
-        const char* name = explorer_entry_name(dir, state->selected);
-        if (explorer_is_dir_entry(dir, state->selected)) {
-            if (fs_change_dir(name) == 0) state->selected = 0;
+        if (!explorer_entry_at(state->selected, &entry)) return;
+        if (entry.type == FS_NODE_DIR) {
+            if (fs_change_dir(entry.name) == 0) state->selected = state->top = 0;
         } else {
-            launch_app(LAUNCH_NOTEPAD, name);
+            launch_app(LAUNCH_NOTEPAD, entry.name);
         }
         return;
     }
@@ -1280,6 +1283,7 @@ static Window* launch_app(launcher_item_t item, const char* arg) {
             app_explorer_state_t* s = (app_explorer_state_t*)kmalloc(sizeof(app_explorer_state_t));
             if (s) {
                 s->selected = 0;
+                s->top = 0;
                 win->app_state = s;
                 win->app_type = GUI_APP_EXPLORER;
                 win->on_tick = app_explorer_tick;
@@ -1363,6 +1367,12 @@ void gui_run(void) {
             if (windows[i].active && windows[i].on_tick) windows[i].on_tick(&windows[i], ticks);
         }
 
+        // Background work of the kernel loop keeps going while the
+        // desktop is up: idle files are packed, dirty sectors written back
+        // and queued disk I/O moved.
+        fs_compress_poll();
+        bcache_poll();
+        ioring_poll();
         gui_update();
         timer_sleep(16);
     }
@@ -1,5 +1,5 @@
 global irq12_handler_asm
-extern mouse_handler_main
+extern irq12_handler_main
 
 section .text
 irq12_handler_asm:
@@ -16,7 +16,7 @@ irq12_handler_asm:
     mov fs, ax
     mov gs, ax
 
-    call mouse_handler_main
+    call irq12_handler_main
 
     mov al, 0x20
     out 0xA0, al         ; EOI to Slave PIC
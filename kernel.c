@@ -11,6 +11,17 @@
 #include "drivers/usb/usb.h"
 #include "taskmgr/process.h"
 #include "lib/memory.h"
+#include "lib/string.h"
+#include "multiboot.h"
+#include "fs/initrd.h"
+#include "fs/snapshot.h"
+#include "fs/compress.h"
+#include "fs/procfs.h"
+#include "fs/iso9660.h"
+#include "drivers/storage/bios_disk.h"
+#include "drivers/storage/ata.h"
+#include "drivers/storage/bcache.h"
+#include "drivers/storage/ioring.h"
 
 #define IRQ0 32
 #define IRQ1 33
@@ -53,9 +64,12 @@ static struct IDTPointer idt_ptr;
 extern void load_idt(struct IDTPointer*);
 extern void irq1_handler_asm();
 extern void irq12_handler_asm();
+extern void irq14_handler_asm();
+extern void irq15_handler_asm();
 extern void isr32_stub();
 
 static unsigned int update_counter = 0;
+static volatile uint32_t irq_counts[16];
 static kernel_print_sink_t print_sink = NULL;
 static void* print_sink_ctx = NULL;
 
@@ -88,6 +102,7 @@ void set_idt_entry(int index, uint32_t base, uint16_t selector, uint8_t type_att
 }
 
 void irq0_handler_main() {
+    irq_counts[0]++;
     // Increment counter and update kernel process memory every ~2 seconds
     update_counter++;
     if (update_counter >= 200) {
@@ -108,14 +123,40 @@ __attribute__((naked)) void irq0_handler_asm() {
 }
 
 void irq1_handler_main() {
+    irq_counts[1]++;
     keyboard_interrupt_handler();
 }
 
+void irq12_handler_main() {
+    irq_counts[12]++;
+    mouse_handler_main();
+}
+
+void irq14_handler_main() {
+    irq_counts[14]++;
+    ata_irq(0);
+}
+
+void irq15_handler_main() {
+    irq_counts[15]++;
+    ata_irq(1);
+}
+
+uint32_t kernel_irq_count(int irq) {
+    if (irq < 0 || irq >= 16) return 0;
+    return irq_counts[irq];
+}
+
 void idt_init() {
     pic_remap();
     set_idt_entry(IRQ0, (uint32_t)irq0_handler_asm, 0x08, 0x8E);
     set_idt_entry(IRQ1, (uint32_t)irq1_handler_asm, 0x08, 0x8E);
     set_idt_entry(44, (uint32_t)irq12_handler_asm, 0x08, 0x8E);
+    set_idt_entry(46, (uint32_t)irq14_handler_asm, 0x08, 0x8E);
+    set_idt_entry(47, (uint32_t)irq15_handler_asm, 0x08, 0x8E);
+    // IDE completion interrupts arrive on IRQ14/15 behind the cascade.
+    outb(0x21, inb(0x21) & ~0x04);
+    outb(0xA1, inb(0xA1) & ~0xC0);
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base  = (uint32_t)&idt;
     load_idt(&idt_ptr);
@@ -144,6 +185,24 @@ void print(const char* str) {
         print_char(str[i]);
 }
 
+void print_n(const char* str, size_t len) {
+    if (print_sink) {
+        // Sinks expect NUL-terminated text, so stage it in small pieces.
+        char piece[128];
+        while (len > 0) {
+            size_t n = len < sizeof(piece) - 1 ? len : sizeof(piece) - 1;
+            for (size_t i = 0; i < n; i++) piece[i] = str[i];
+            piece[n] = '\0';
+            print_sink(piece, print_sink_ctx);
+            str += n;
+            len -= n;
+        }
+        return;
+    }
+    for (size_t i = 0; i < len; i++)
+        print_char(str[i]);
+}
+
 extern void fs_init();
 extern void shell_init();
 extern void shell_run();
@@ -163,7 +222,36 @@ static void update_kernel_process_memory() {
     }
 }
 
-void kernel_main() {
+// GRUB places modules right after the kernel image, so the heap starts
+// past whichever ends last.
+static uintptr_t heap_start_address(uint32_t magic, const multiboot_info_t* mbi) {
+    uintptr_t start = (uintptr_t)&_kernel_end;
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC && (mbi->flags & MULTIBOOT_INFO_MODS)) {
+        const multiboot_module_t* mods = (const multiboot_module_t*)(uintptr_t)mbi->mods_addr;
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            if (mods[i].mod_end > start) start = mods[i].mod_end;
+        }
+    }
+    return (start + 0xFFF) & ~(uintptr_t)0xFFF;
+}
+
+static void load_initrd_modules(uint32_t magic, const multiboot_info_t* mbi) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_MODS)) return;
+    const multiboot_module_t* mods = (const multiboot_module_t*)(uintptr_t)mbi->mods_addr;
+    for (uint32_t i = 0; i < mbi->mods_count; i++) {
+        const uint8_t* base = (const uint8_t*)(uintptr_t)mods[i].mod_start;
+        size_t size = mods[i].mod_end - mods[i].mod_start;
+        if (!initrd_is_archive(base, size)) continue;
+        int files = initrd_load(base, size);
+        char buf[16];
+        print("initrd: ");
+        itoa(files, buf, 10);
+        print(buf);
+        print(" files loaded\n");
+    }
+}
+
+void kernel_main(uint32_t multiboot_magic, const multiboot_info_t* mbi) {
     vga_set_text_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     clear_screen();
     print("GooberOS -- x86 Kernel\n");
@@ -176,12 +264,27 @@ void kernel_main() {
     mouse_init();
     pci_init();
     usb_init();
-    fs_init();
 
     // Initialize heap allocator
-    void* heap_start = (void*)(&_kernel_end);
+    void* heap_start = (void*)heap_start_address(multiboot_magic, mbi);
     memory_init(heap_start, KERNEL_HEAP_SIZE);
 
+    // The filesystem allocates its inodes from the heap.
+    fs_init();
+    load_initrd_modules(multiboot_magic, mbi);
+    procfs_init();
+
+    // A saved snapshot replaces the built-in tree when one is present.
+    bios_disk_scan();
+    uint8_t snap_drive;
+    uint32_t snap_lba;
+    if (fs_snapshot_find(&snap_drive, &snap_lba) == 0 && fs_snapshot_load(snap_drive, snap_lba) == 0) {
+        print("Filesystem snapshot restored.\n");
+    }
+    if (iso9660_mount_media("/cdrom") == 0) {
+        print("Boot medium mounted at /cdrom.\n");
+    }
+
     kernel_pid = create_process("kernel.bin", 0);
     update_kernel_process_memory();
 
@@ -191,6 +294,9 @@ void kernel_main() {
 
     while (1) {
         usb_poll();
+        fs_compress_poll();
+        bcache_poll();
+        ioring_poll();
         shell_run();
         __asm__("hlt");
     }
@@ -1,6 +1,7 @@
 #ifndef KERNEL_H
 #define KERNEL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef void (*kernel_print_sink_t)(const char* str, void* ctx);
@@ -10,9 +11,11 @@ extern uint8_t cursor_row;
 extern uint8_t cursor_col;
 void update_cursor_visual();
 void print(const char* str);
+void print_n(const char* str, size_t len);
 void kernel_set_print_sink(kernel_print_sink_t sink, void* ctx);
 void kernel_clear_print_sink(void);
 void clear_screen(void);
+uint32_t kernel_irq_count(int irq);
 
 
 
@@ -0,0 +1,85 @@
+#include "crc32c.h"
+
+// Two implementations chosen on first use: the SSE4.2 crc32 instruction
+// when CPUID reports it, otherwise slice-by-8 tables that fold eight input
+// bytes per step. The instruction only touches general registers, so it
+// needs no FPU/SSE state set up.
+
+#define CRC32C_POLY 0x82F63B78u
+#define CPUID_ECX_SSE42 (1u << 20)
+
+static uint32_t crc_tables[8][256];
+static uint32_t (*crc_impl)(uint32_t crc, const uint8_t* p, size_t len) = 0;
+
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void crc32c_init_tables(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_tables[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t prev = crc_tables[t - 1][i];
+            crc_tables[t][i] = crc_tables[0][prev & 0xFF] ^ (prev >> 8);
+        }
+    }
+}
+
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len >= 8) {
+        uint32_t lo = read_u32(p) ^ crc;
+        uint32_t hi = read_u32(p + 4);
+        crc = crc_tables[7][lo & 0xFF] ^ crc_tables[6][(lo >> 8) & 0xFF] ^
+              crc_tables[5][(lo >> 16) & 0xFF] ^ crc_tables[4][lo >> 24] ^
+              crc_tables[3][hi & 0xFF] ^ crc_tables[2][(hi >> 8) & 0xFF] ^
+              crc_tables[1][(hi >> 16) & 0xFF] ^ crc_tables[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = crc_tables[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len >= 4) {
+        __asm__ ("crc32l %1, %0" : "+r"(crc) : "rm"(read_u32(p)));
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        p++;
+    }
+    return crc;
+}
+
+static int cpu_has_sse42(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (ecx & CPUID_ECX_SSE42) != 0;
+}
+
+static void crc32c_select(void) {
+    crc32c_init_tables();
+    crc_impl = cpu_has_sse42() ? crc32c_sse42 : crc32c_slice8;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+    if (!crc_impl) crc32c_select();
+    return ~crc_impl(~crc, (const uint8_t*)data, len);
+}
+
+int crc32c_set_hardware(int enable) {
+    if (!crc_impl) crc32c_select();
+    crc_impl = enable && cpu_has_sse42() ? crc32c_sse42 : crc32c_slice8;
+    return crc_impl == crc32c_sse42;
+}
+
+const char* crc32c_backend(void) {
+    if (!crc_impl) crc32c_select();
+    return crc_impl == crc32c_sse42 ? "sse4.2" : "slice-by-8";
+}
@@ -0,0 +1,16 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli). Pass 0 to start a new checksum and feed the result
+// back in to continue it over more data.
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+// Selects the SSE4.2 path (if the CPU has it) or the table path; returns 1
+// when the hardware path is now in use. Mainly for benchmarks.
+int crc32c_set_hardware(int enable);
+const char* crc32c_backend(void);
+
+#endif
@@ -0,0 +1,110 @@
+#include "lz.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+// The format requires the last match to start at least 12 bytes before the
+// end and the final 5 bytes to be literals.
+#define LZ_MATCH_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+// Positions from earlier calls may linger; every candidate is bounds
+// checked and compared, so the table never needs clearing.
+static uint32_t lz_table[1 << LZ_HASH_BITS];
+
+static uint32_t read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t lz_hash(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static size_t put_length(uint8_t* dst, size_t op, size_t len) {
+    while (len >= 255) {
+        dst[op++] = 255;
+        len -= 255;
+    }
+    dst[op++] = (uint8_t)len;
+    return op;
+}
+
+// Emits one sequence; `match_len` 0 means the trailing literal-only run.
+static size_t emit(uint8_t* dst, size_t cap, size_t op, const uint8_t* lit, size_t lit_len,
+                   size_t offset, size_t match_len) {
+    size_t worst = 1 + lit_len + lit_len / 255 + 1 + 2 + match_len / 255 + 1;
+    if (worst > cap - op) return 0;
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    dst[op++] = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+    if (lit_len >= 15) op = put_length(dst, op, lit_len - 15);
+    for (size_t i = 0; i < lit_len; i++) dst[op++] = lit[i];
+    if (!match_len) return op;
+    dst[op++] = (uint8_t)offset;
+    dst[op++] = (uint8_t)(offset >> 8);
+    if (ml >= 15) op = put_length(dst, op, ml - 15);
+    return op;
+}
+
+size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    size_t ip = 0, anchor = 0, op = 0;
+    if (len > LZ_MATCH_LIMIT) {
+        size_t limit = len - LZ_MATCH_LIMIT;
+        size_t match_end = len - LZ_LAST_LITERALS;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = lz_hash(seq);
+            size_t ref = lz_table[h];
+            lz_table[h] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != seq) {
+                ip++;
+                continue;
+            }
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < match_end && src[ip + mlen] == src[ref + mlen]) mlen++;
+            op = emit(dst, cap, op, src + anchor, ip - anchor, ip - ref, mlen);
+            if (!op) return 0;
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+    op = emit(dst, cap, op, src + anchor, len - anchor, 0, 0);
+    return op;
+}
+
+static int get_length(const uint8_t* src, size_t len, size_t* ip, size_t* out) {
+    uint8_t b;
+    do {
+        if (*ip >= len) return -1;
+        b = src[(*ip)++];
+        *out += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    size_t ip = 0, op = 0;
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15 && get_length(src, len, &ip, &lit) != 0) return -1;
+        if (lit > len - ip || lit > cap - op) return -1;
+        for (size_t i = 0; i < lit; i++) dst[op++] = src[ip++];
+        if (ip == len) break;
+
+        if (len - ip < 2) return -1;
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_length(src, len, &ip, &mlen) != 0) return -1;
+        mlen += LZ_MIN_MATCH;
+        if (mlen > cap - op) return -1;
+        // Byte by byte: the source may overlap the bytes being written.
+        for (size_t i = 0; i < mlen; i++, op++) dst[op] = dst[op - offset];
+    }
+    return (int)op;
+}
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte-oriented LZ77 codec using the LZ4 block format: each sequence is a
+// token, literals, a 16-bit back offset and a match length. It favours
+// speed over ratio and needs no memory beyond a static hash table.
+// Depends only on stddef/stdint so host tools can build it as well.
+
+// Worst-case compressed size of `n` input bytes.
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+// Returns the compressed size, or 0 if the output would not fit in `cap`.
+size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+// Returns the number of bytes written to `dst`, or -1 on malformed input or
+// when the output would exceed `cap`.
+int lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+#endif
@@ -0,0 +1,58 @@
+#include "lzimage.h"
+#include "lz.h"
+
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Returns 0 when `data` holds a well-formed image header and frame table.
+int lzimage_open(lzimage_t* img, const uint8_t* data, size_t len) {
+    if (len < sizeof(lzimage_header_t)) return -1;
+    if (read_u32(data) != LZIMAGE_MAGIC) return -1;
+    img->base = data;
+    img->len = len;
+    img->frame_size = read_u32(data + 4);
+    img->frame_count = read_u32(data + 8);
+    img->original_size = read_u32(data + 12);
+    if (img->frame_size == 0 || img->frame_size > LZIMAGE_FRAME_SIZE) return -1;
+    size_t table = sizeof(lzimage_header_t) + (size_t)img->frame_count * 4;
+    if (img->frame_count > (len - sizeof(lzimage_header_t)) / 4) return -1;
+    if ((img->original_size + img->frame_size - 1) / img->frame_size != img->frame_count) return -1;
+    img->lengths = data + sizeof(lzimage_header_t);
+    img->cursor_index = 0;
+    img->cursor_offset = table;
+    return 0;
+}
+
+// Unpacks frame `index` into `out` and returns its length, or -1.
+int lzimage_frame(lzimage_t* img, uint32_t index, uint8_t* out, size_t cap) {
+    if (index >= img->frame_count) return -1;
+    if (index != img->cursor_index) {
+        img->cursor_index = 0;
+        img->cursor_offset = sizeof(lzimage_header_t) + (size_t)img->frame_count * 4;
+        while (img->cursor_index < index) {
+            img->cursor_offset += read_u32(img->lengths + img->cursor_index * 4) & ~LZIMAGE_STORED;
+            img->cursor_index++;
+        }
+    }
+    uint32_t stored = read_u32(img->lengths + index * 4);
+    uint32_t size = stored & ~LZIMAGE_STORED;
+    if (size > img->len - img->cursor_offset) return -1;
+    uint32_t expect = img->frame_size;
+    if (index == img->frame_count - 1) expect = img->original_size - index * img->frame_size;
+    if (expect > cap) return -1;
+
+    const uint8_t* src = img->base + img->cursor_offset;
+    int got;
+    if (stored & LZIMAGE_STORED) {
+        if (size != expect) return -1;
+        for (uint32_t i = 0; i < size; i++) out[i] = src[i];
+        got = (int)size;
+    } else {
+        got = lz_decompress(src, size, out, cap);
+    }
+    if (got != (int)expect) return -1;
+    img->cursor_index = index + 1;
+    img->cursor_offset += size;
+    return got;
+}
@@ -0,0 +1,39 @@
+#ifndef LZIMAGE_H
+#define LZIMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Large image compressed as independent LZ frames so it can be unpacked one
+// frame at a time. Layout: lzimage_header_t, then `frame_count` u32 frame
+// lengths, then the frames back to back. A length with LZIMAGE_STORED set
+// marks a frame kept as is because it did not compress. All fields are
+// little endian. tools/lzpack.c builds these at compile time.
+
+#define LZIMAGE_MAGIC 0x315A4C47u  // "GLZ1"
+#define LZIMAGE_FRAME_SIZE 65536
+#define LZIMAGE_STORED 0x80000000u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t frame_size;
+    uint32_t frame_count;
+    uint32_t original_size;
+} lzimage_header_t;
+
+typedef struct {
+    const uint8_t* base;
+    size_t len;
+    const uint8_t* lengths;
+    uint32_t frame_size;
+    uint32_t frame_count;
+    uint32_t original_size;
+    // Where the next frame in sequence starts, so streaming needs no scan.
+    uint32_t cursor_index;
+    size_t cursor_offset;
+} lzimage_t;
+
+int lzimage_open(lzimage_t* img, const uint8_t* data, size_t len);
+int lzimage_frame(lzimage_t* img, uint32_t index, uint8_t* out, size_t cap);
+
+#endif
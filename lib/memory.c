@@ -1,31 +1,130 @@
 #include "memory.h"
 
+// First-fit allocator over one contiguous heap. Every block starts with a
+// header holding its own size and the size of the block before it, so a
+// freed block can merge with both neighbours. Free blocks are also kept on
+// a doubly linked list threaded through their payload.
+typedef struct heap_block {
+    size_t size;        // whole block including header; bit 0 set when in use
+    size_t prev_size;   // size of the physically preceding block, 0 for the first
+} heap_block_t;
+
+typedef struct free_links {
+    heap_block_t* next;
+    heap_block_t* prev;
+} free_links_t;
+
+#define HEAP_ALIGN 8
+#define HEAP_USED 1u
+#define HEAP_MIN_BLOCK (sizeof(heap_block_t) + sizeof(free_links_t))
+
 static uint8_t* heap_base = 0;
 static size_t heap_capacity = 0;
-static size_t heap_offset = 0;
+static size_t heap_used = 0;
+static heap_block_t* free_head = 0;
+
+static size_t block_size(const heap_block_t* b) {
+    return b->size & ~(size_t)HEAP_USED;
+}
+
+static free_links_t* links(heap_block_t* b) {
+    return (free_links_t*)(b + 1);
+}
+
+static heap_block_t* next_block(heap_block_t* b) {
+    uint8_t* next = (uint8_t*)b + block_size(b);
+    return next < heap_base + heap_capacity ? (heap_block_t*)next : 0;
+}
+
+static void free_list_push(heap_block_t* b) {
+    links(b)->prev = 0;
+    links(b)->next = free_head;
+    if (free_head) links(free_head)->prev = b;
+    free_head = b;
+}
+
+static void free_list_remove(heap_block_t* b) {
+    free_links_t* l = links(b);
+    if (l->prev) links(l->prev)->next = l->next;
+    else free_head = l->next;
+    if (l->next) links(l->next)->prev = l->prev;
+}
+
+static void set_size(heap_block_t* b, size_t size, size_t used) {
+    b->size = size | used;
+    heap_block_t* next = next_block(b);
+    if (next) next->prev_size = size;
+}
 
 void memory_init(void* heap_start, size_t heap_size) {
-    heap_base = (uint8_t*)heap_start;
-    heap_capacity = heap_size;
-    heap_offset = 0;
+    uintptr_t start = ((uintptr_t)heap_start + HEAP_ALIGN - 1) & ~(uintptr_t)(HEAP_ALIGN - 1);
+    heap_size -= start - (uintptr_t)heap_start;
+    heap_base = (uint8_t*)start;
+    heap_capacity = heap_size & ~(size_t)(HEAP_ALIGN - 1);
+    memory_reset();
 }
 
 void* kmalloc(size_t size) {
-    if (heap_offset + size > heap_capacity) {
-        return 0; // out of memory
-    }
+    if (size == 0 || size > heap_capacity) return 0;
+    size_t needed = (size + sizeof(heap_block_t) + HEAP_ALIGN - 1) & ~(size_t)(HEAP_ALIGN - 1);
+    if (needed < HEAP_MIN_BLOCK) needed = HEAP_MIN_BLOCK;
 
-    void* ptr = heap_base + heap_offset;
-    heap_offset += size;
-
-    return ptr;
+    for (heap_block_t* b = free_head; b; b = links(b)->next) {
+        size_t have = block_size(b);
+        if (have < needed) continue;
+        free_list_remove(b);
+        if (have - needed >= HEAP_MIN_BLOCK) {
+            heap_block_t* rest = (heap_block_t*)((uint8_t*)b + needed);
+            rest->prev_size = needed;
+            set_size(rest, have - needed, 0);
+            free_list_push(rest);
+            have = needed;
+        }
+        set_size(b, have, HEAP_USED);
+        heap_used += have;
+        return b + 1;
+    }
+    return 0; // out of memory
 }
 
 void kfree(void* ptr) {
-    // no-op for now; no freeing individual blocks in bump allocator
-    (void)ptr;
+    if (!ptr) return;
+    heap_block_t* b = (heap_block_t*)ptr - 1;
+    if (!(b->size & HEAP_USED)) return;
+    size_t size = block_size(b);
+    heap_used -= size;
+
+    heap_block_t* next = next_block(b);
+    if (next && !(next->size & HEAP_USED)) {
+        free_list_remove(next);
+        size += block_size(next);
+    }
+    if (b->prev_size) {
+        heap_block_t* prev = (heap_block_t*)((uint8_t*)b - b->prev_size);
+        if (!(prev->size & HEAP_USED)) {
+            free_list_remove(prev);
+            size += block_size(prev);
+            b = prev;
+        }
+    }
+    set_size(b, size, 0);
+    free_list_push(b);
 }
 
 void memory_reset(void) {
-    heap_offset = 0;
+    free_head = 0;
+    heap_used = 0;
+    if (heap_capacity < HEAP_MIN_BLOCK) return;
+    heap_block_t* b = (heap_block_t*)heap_base;
+    b->prev_size = 0;
+    b->size = heap_capacity;
+    free_list_push(b);
+}
+
+size_t memory_used(void) {
+    return heap_used;
+}
+
+size_t memory_capacity(void) {
+    return heap_capacity;
 }
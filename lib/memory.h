@@ -6,7 +6,9 @@
 
 void memory_init(void* heap_start, size_t heap_size);
 void* kmalloc(size_t size);
-void kfree(void* ptr);  // We'll implement a no-op for now or a reset function instead
+void kfree(void* ptr);
 void memory_reset(void);
+size_t memory_used(void);
+size_t memory_capacity(void);
 
 #endif
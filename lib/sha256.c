@@ -0,0 +1,146 @@
+#include "sha256.h"
+
+// Full blocks are compressed straight from the caller's buffer; only a
+// partial tail is copied into the context. The 64 rounds are unrolled in
+// groups of eight with the working variables rotated by macro arguments
+// instead of shuffled, and the message schedule is expanded in place in a
+// 16-word ring.
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define S0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define s1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+// Message word i (i >= 16) expanded in place in the 16-word ring.
+#define W(i) (w[(i) & 15] += s1(w[((i) - 2) & 15]) + w[((i) - 7) & 15] + s0(w[((i) - 15) & 15]))
+
+#define ROUND(a, b, c, d, e, f, g, h, i, wi) do {               \
+        uint32_t t1 = (h) + S1(e) + CH(e, f, g) + K[i] + (wi);  \
+        (d) += t1;                                              \
+        (h) = t1 + S0(a) + MAJ(a, b, c);                        \
+    } while (0)
+
+#define ROUNDS8(i, WORD) do {                                   \
+        ROUND(a, b, c, d, e, f, g, h, (i) + 0, WORD((i) + 0));  \
+        ROUND(h, a, b, c, d, e, f, g, (i) + 1, WORD((i) + 1));  \
+        ROUND(g, h, a, b, c, d, e, f, (i) + 2, WORD((i) + 2));  \
+        ROUND(f, g, h, a, b, c, d, e, (i) + 3, WORD((i) + 3));  \
+        ROUND(e, f, g, h, a, b, c, d, (i) + 4, WORD((i) + 4));  \
+        ROUND(d, e, f, g, h, a, b, c, (i) + 5, WORD((i) + 5));  \
+        ROUND(c, d, e, f, g, h, a, b, (i) + 6, WORD((i) + 6));  \
+        ROUND(b, c, d, e, f, g, h, a, (i) + 7, WORD((i) + 7));  \
+    } while (0)
+
+#define W0(i) (w[i])
+
+static uint32_t load_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void compress_blocks(uint32_t state[8], const uint8_t* p, size_t blocks) {
+    uint32_t w[16];
+    while (blocks--) {
+        for (int i = 0; i < 16; i++) w[i] = load_be32(p + i * 4);
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        ROUNDS8(0, W0);
+        ROUNDS8(8, W0);
+        ROUNDS8(16, W);
+        ROUNDS8(24, W);
+        ROUNDS8(32, W);
+        ROUNDS8(40, W);
+        ROUNDS8(48, W);
+        ROUNDS8(56, W);
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        p += SHA256_BLOCK_SIZE;
+    }
+}
+
+void sha256_init(sha256_ctx_t* ctx) {
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->total_lo = 0;
+    ctx->total_hi = 0;
+    ctx->fill = 0;
+}
+
+void sha256_update(sha256_ctx_t* ctx, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t before = ctx->total_lo;
+    ctx->total_lo += (uint32_t)len;
+    if (ctx->total_lo < before) ctx->total_hi++;
+
+    if (ctx->fill) {
+        while (len > 0 && ctx->fill < SHA256_BLOCK_SIZE) {
+            ctx->block[ctx->fill++] = *p++;
+            len--;
+        }
+        if (ctx->fill < SHA256_BLOCK_SIZE) return;
+        compress_blocks(ctx->state, ctx->block, 1);
+        ctx->fill = 0;
+    }
+    size_t blocks = len / SHA256_BLOCK_SIZE;
+    if (blocks) {
+        compress_blocks(ctx->state, p, blocks);
+        p += blocks * SHA256_BLOCK_SIZE;
+        len -= blocks * SHA256_BLOCK_SIZE;
+    }
+    while (len--) ctx->block[ctx->fill++] = *p++;
+}
+
+void sha256_final(sha256_ctx_t* ctx, uint8_t out[SHA256_DIGEST_SIZE]) {
+    uint32_t bits_hi = (ctx->total_hi << 3) | (ctx->total_lo >> 29);
+    uint32_t bits_lo = ctx->total_lo << 3;
+    ctx->block[ctx->fill++] = 0x80;
+    if (ctx->fill > SHA256_BLOCK_SIZE - 8) {
+        while (ctx->fill < SHA256_BLOCK_SIZE) ctx->block[ctx->fill++] = 0;
+        compress_blocks(ctx->state, ctx->block, 1);
+        ctx->fill = 0;
+    }
+    while (ctx->fill < SHA256_BLOCK_SIZE - 8) ctx->block[ctx->fill++] = 0;
+    store_be32(ctx->block + 56, bits_hi);
+    store_be32(ctx->block + 60, bits_lo);
+    compress_blocks(ctx->state, ctx->block, 1);
+    for (int i = 0; i < 8; i++) store_be32(out + i * 4, ctx->state[i]);
+}
+
+void sha256(const void* data, size_t len, uint8_t out[SHA256_DIGEST_SIZE]) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
@@ -0,0 +1,24 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+// Streaming SHA-256: init, update any number of times, then final.
+typedef struct {
+    uint32_t state[8];
+    uint32_t total_lo;      // message length in bytes, split so no 64-bit
+    uint32_t total_hi;      // arithmetic is needed on 32-bit builds
+    uint32_t fill;
+    uint8_t block[SHA256_BLOCK_SIZE];
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t* ctx);
+void sha256_update(sha256_ctx_t* ctx, const void* data, size_t len);
+void sha256_final(sha256_ctx_t* ctx, uint8_t out[SHA256_DIGEST_SIZE]);
+void sha256(const void* data, size_t len, uint8_t out[SHA256_DIGEST_SIZE]);
+
+#endif
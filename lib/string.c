@@ -111,3 +111,12 @@ void* memset(void* s, int c, size_t n) {
     for (size_t i = 0; i < n; i++) p[i] = (unsigned char)c;
     return s;
 }
+
+int memcmp(const void* a, const void* b, size_t n) {
+    const unsigned char* p = (const unsigned char*)a;
+    const unsigned char* q = (const unsigned char*)b;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) return p[i] - q[i];
+    }
+    return 0;
+}
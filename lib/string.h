@@ -17,5 +17,6 @@ int atoi(const char* str);
 char* itoa(int value, char* str, int base);
 void* memcpy(void* dest, const void* src, size_t n);
 void* memset(void* s, int c, size_t n);
+int memcmp(const void* a, const void* b, size_t n);
 
 #endif
@@ -1,3 +1,15 @@
 #!/bin/bash
 
-qemu-system-i386 -cdrom GooberOSx86.iso
+# Set DISK_IMAGE to attach a raw disk (e.g. one made with
+# `qemu-img create -f raw disk.img 64M`) for snapshots and installs.
+# Set DATA_IMAGE to attach a second disk, e.g. an ext2 image made with
+# `mke2fs -t ext2 -d some/tree data.img 64M`; with both set it is drive
+# 0x81, so `mount 81 /data` then `treebench /data` reads it back.
+args=(-cdrom GooberOSx86.iso)
+if [ -n "${DISK_IMAGE:-}" ]; then
+  args+=(-drive file="${DISK_IMAGE}",format=raw,if=ide,index=0 -boot d)
+fi
+if [ -n "${DATA_IMAGE:-}" ]; then
+  args+=(-drive file="${DATA_IMAGE}",format=raw,if=ide,index=1)
+fi
+qemu-system-i386 "${args[@]}"
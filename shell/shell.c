@@ -14,6 +14,21 @@
 #include "../drivers/timer/timer.h"
 #include "../gui/window.h"
 #include "../drivers/storage/bios_disk.h"
+#include "../drivers/storage/partition.h"
+#include "../drivers/storage/bcache.h"
+#include "../drivers/storage/blkdev.h"
+#include "../drivers/storage/ioring.h"
+#include "../fs/snapshot.h"
+#include "../fs/blockstore.h"
+#include "../fs/compress.h"
+#include "../fs/fat32.h"
+#include "../fs/iso9660.h"
+#include "../fs/ext2.h"
+#include "../lib/lz.h"
+#include "../lib/crc32c.h"
+#include "../lib/lzimage.h"
+#include "../lib/sha256.h"
+#include "../lib/memory.h"
 
 #define PROMPT_COLOR VGA_COLOR_BLUE
 static uint8_t current_color = VGA_COLOR_LIGHT_GREEN;
@@ -29,18 +44,22 @@ extern uint8_t cursor_col;
 #endif
 
 #if EMBED_INSTALL_ISO
-extern unsigned char _binary_GooberOSx86_iso_start;
-extern unsigned char _binary_GooberOSx86_iso_end;
+// The ISO is embedded in lzimage form (see tools/lzpack.c).
+extern unsigned char _binary_GooberOSx86_iso_lz_start;
+extern unsigned char _binary_GooberOSx86_iso_lz_end;
 #endif
 
-extern FileHandle* fs_open(const char* filename);
-extern size_t fs_read(FileHandle* fh, uint8_t* buffer, size_t bytes);
-extern void fs_close(FileHandle* fh);
+extern fs_handle_t fs_open(const char* filename);
+extern size_t fs_read(fs_handle_t handle, uint8_t* buffer, size_t bytes);
+extern size_t fs_view(fs_handle_t handle, FsSpan* span);
+extern void fs_close(fs_handle_t handle);
 extern int fs_create(const char* filename);
 extern int fs_delete(const char* filename);
 extern int fs_delete_dir(const char* dirname);
 extern int fs_create_dir(const char* dirname);
 extern int fs_write(const char* filename, const uint8_t* data, size_t size);
+extern int fs_append(const char* filename, const uint8_t* data, size_t size);
+extern int fs_copy(const char* src, const char* dst);
 extern int fs_list(void);
 extern int fs_change_dir(const char* path);
 extern int fs_cd_up(void);
@@ -286,14 +305,437 @@ static int parse_hex(const char* s, uint32_t* out) {
     return 0;
 }
 
+static void print_dedup_stats(void) {
+    fs_block_stats_t st;
+    fs_block_get_stats(&st);
+    char buf[16];
+    print("Logical data:  ");
+    itoa((int)(st.block_refs * FS_CHUNK_SIZE / 1024), buf, 10);
+    print(buf);
+    print(" KB\nPhysical data: ");
+    itoa((int)(st.physical_blocks * FS_CHUNK_SIZE / 1024), buf, 10);
+    print(buf);
+    print(" KB\nShared blocks: ");
+    itoa((int)st.sealed_blocks, buf, 10);
+    print(buf);
+    print("\nDedup hits:    ");
+    itoa((int)st.dedup_hits, buf, 10);
+    print(buf);
+    print("\nDedup ratio:   ");
+    uint32_t ratio = st.physical_blocks ? st.block_refs * 100 / st.physical_blocks : 100;
+    itoa((int)(ratio / 100), buf, 10);
+    print(buf);
+    print(".");
+    if (ratio % 100 < 10) print("0");
+    itoa((int)(ratio % 100), buf, 10);
+    print(buf);
+    print("x\n");
+}
+
+static void print_uint_line(const char* label, uint32_t value, const char* unit) {
+    char buf[16];
+    print(label);
+    itoa((int)value, buf, 10);
+    print(buf);
+    print(unit);
+}
+
+static void print_compress_stats(void) {
+    fs_compress_stats_t st;
+    fs_compress_get_stats(&st);
+    print(fs_compress_enabled() ? "Compression:    on\n" : "Compression:    off\n");
+    print_uint_line("Packed files:   ", st.packed_files, "\n");
+    print_uint_line("Logical bytes:  ", st.logical_bytes, "\n");
+    print_uint_line("Packed bytes:   ", st.packed_bytes, "\n");
+    uint32_t pct = st.logical_bytes ? st.packed_bytes * 100 / st.logical_bytes : 100;
+    print_uint_line("Ratio:          ", pct, "% of original\n");
+    print_uint_line("Decompressions: ", st.decompressions, "\n");
+    print_uint_line("Decompress time:", st.decompress_ticks * 10, " ms total\n");
+    print_uint_line("Cache hits:     ", st.cache_hits, "");
+    print_uint_line(" / misses ", st.cache_misses, "\n");
+    print_uint_line("Heap used:      ", (uint32_t)memory_used(), "");
+    print_uint_line(" of ", (uint32_t)memory_capacity(), " bytes\n");
+}
+
+// Times the LZ codec on 4 KiB of shell-like text for about half a second
+// each way.
+#define LZBENCH_SIZE 4096
+#define LZBENCH_TICKS 50
+
+static void lz_benchmark(void) {
+    static const char* words[] = { "GooberOS ", "file ", "directory ", "read ", "write ",
+                                   "the ", "kernel ", "0x80 ", "snapshot\n", "block " };
+    uint8_t* src = (uint8_t*)kmalloc(LZBENCH_SIZE);
+    uint8_t* packed = (uint8_t*)kmalloc(LZ_BOUND(LZBENCH_SIZE));
+    uint8_t* out = (uint8_t*)kmalloc(LZBENCH_SIZE);
+    if (!src || !packed || !out) {
+        print("lzbench: out of memory\n");
+        kfree(src);
+        kfree(packed);
+        kfree(out);
+        return;
+    }
+    uint32_t seed = 12345;
+    size_t pos = 0;
+    while (pos < LZBENCH_SIZE) {
+        seed = seed * 1103515245u + 12345u;
+        const char* w = words[(seed >> 16) % 10];
+        while (*w && pos < LZBENCH_SIZE) src[pos++] = (uint8_t)*w++;
+    }
+
+    size_t packed_len = 0;
+    uint32_t runs = 0;
+    uint32_t start = timer_ticks();
+    while (timer_ticks() - start < LZBENCH_TICKS) {
+        packed_len = lz_compress(src, LZBENCH_SIZE, packed, LZ_BOUND(LZBENCH_SIZE));
+        runs++;
+    }
+    uint32_t comp_ticks = timer_ticks() - start;
+    uint32_t comp_runs = runs;
+
+    int ok = 1;
+    runs = 0;
+    start = timer_ticks();
+    while (timer_ticks() - start < LZBENCH_TICKS) {
+        if (lz_decompress(packed, packed_len, out, LZBENCH_SIZE) != LZBENCH_SIZE) ok = 0;
+        runs++;
+    }
+    uint32_t decomp_ticks = timer_ticks() - start;
+    if (memcmp(src, out, LZBENCH_SIZE) != 0) ok = 0;
+
+    print_uint_line("Input:      ", LZBENCH_SIZE, " bytes\n");
+    print_uint_line("Compressed: ", (uint32_t)packed_len, " bytes\n");
+    print_uint_line("Compress:   ", comp_runs * (LZBENCH_SIZE / 1024) * 100 / comp_ticks, " KB/s\n");
+    print_uint_line("Decompress: ", runs * (LZBENCH_SIZE / 1024) * 100 / decomp_ticks, " KB/s\n");
+    print(ok ? "Round trip OK\n" : "lzbench: round trip MISMATCH\n");
+    kfree(src);
+    kfree(packed);
+    kfree(out);
+}
+
+static void print_hex_bytes(const uint8_t* p, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[2];
+    for (size_t i = 0; i < len; i++) {
+        buf[0] = digits[p[i] >> 4];
+        buf[1] = digits[p[i] & 15];
+        print_n(buf, 2);
+    }
+}
+
+// Streams a file through CRC32C or SHA-256 straight from its storage
+// spans, so files of any size are hashed without a copy.
+static void checksum_file(const char* filename, int use_sha) {
+    const char* tool = use_sha ? "sha256sum" : "crc32";
+    if (filename[0] == '\0') {
+        print("Usage: ");
+        print(tool);
+        print(" <file>\n");
+        return;
+    }
+    fs_handle_t fh = fs_open(filename);
+    if (!fh) {
+        print(tool);
+        print(": File not found: ");
+        print(filename);
+        print("\n");
+        return;
+    }
+    sha256_ctx_t ctx;
+    uint32_t crc = 0;
+    if (use_sha) sha256_init(&ctx);
+    FsSpan span;
+    while (fs_view(fh, &span) > 0) {
+        if (use_sha) sha256_update(&ctx, span.data, span.len);
+        else crc = crc32c(crc, span.data, span.len);
+    }
+    fs_close(fh);
+    if (use_sha) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_final(&ctx, digest);
+        print_hex_bytes(digest, SHA256_DIGEST_SIZE);
+    } else {
+        uint8_t be[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+        print_hex_bytes(be, 4);
+    }
+    print("  ");
+    print(filename);
+    print("\n");
+}
+
+// Times CRC32C with each available backend and SHA-256 over 4 KiB for
+// about half a second each.
+#define CKSUMBENCH_SIZE 4096
+#define CKSUMBENCH_TICKS 50
+
+static uint32_t cksum_rate(uint8_t* buf, int use_sha) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t runs = 0;
+    uint32_t start = timer_ticks();
+    while (timer_ticks() - start < CKSUMBENCH_TICKS) {
+        if (use_sha) sha256(buf, CKSUMBENCH_SIZE, digest);
+        else buf[0] ^= (uint8_t)crc32c(0, buf, CKSUMBENCH_SIZE);
+        runs++;
+    }
+    return runs * (CKSUMBENCH_SIZE / 1024) * 100 / (timer_ticks() - start);
+}
+
+static void checksum_benchmark(void) {
+    uint8_t* buf = (uint8_t*)kmalloc(CKSUMBENCH_SIZE);
+    if (!buf) {
+        print("cksumbench: out of memory\n");
+        return;
+    }
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < CKSUMBENCH_SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+    int has_hw = crc32c_set_hardware(1);
+    if (has_hw) {
+        print_uint_line("CRC32C sse4.2: ", cksum_rate(buf, 0), " KB/s\n");
+        crc32c_set_hardware(0);
+    }
+    print_uint_line("CRC32C slice8: ", cksum_rate(buf, 0), " KB/s\n");
+    crc32c_set_hardware(has_hw);
+    print_uint_line("SHA-256:       ", cksum_rate(buf, 1), " KB/s\n");
+    print("CRC32C backend: ");
+    print(crc32c_backend());
+    print("\n");
+    kfree(buf);
+}
+
+// Read-only benchmark of every detected drive: sequential throughput in
+// 64 KB transfers, 4 KB random reads for IOPS, then the sequential pass
+// again through an I/O ring. Nothing is written, so it is safe on the
+// boot disk.
+#define BLKBENCH_CHUNK_SECTORS 128
+#define BLKBENCH_SEQ_SECTORS 8192
+#define BLKBENCH_TICKS 100
+
+// Larger than the whole kernel heap, so it cannot come from kmalloc.
+static uint8_t blkbench_buf[BLKBENCH_CHUNK_SECTORS * 512];
+// About 1 KB; kept off the 4 KB kernel stack.
+static io_ring_t blkbench_ring;
+
+static void block_benchmark(void) {
+    bios_disk_scan();
+    int count = bios_disk_count();
+    if (count <= 0) {
+        print("No disk drives detected.\n");
+        return;
+    }
+    uint8_t* buf = blkbench_buf;
+    for (int i = 0; i < count; i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        // Partitions would only measure their disk again.
+        if (!d || !d->present || d->parent || d->sectors < BLKBENCH_CHUNK_SECTORS) continue;
+        char num[16];
+        print("Drive 0x");
+        itoa(d->drive, num, 16);
+        print(num);
+        print(" (");
+        print(d->ops->name);
+        print(")\n");
+
+        uint32_t seq = BLKBENCH_SEQ_SECTORS;
+        if (d->sectors < seq) seq = (uint32_t)d->sectors & ~(uint32_t)(BLKBENCH_CHUNK_SECTORS - 1);
+        int ok = 1;
+        uint32_t start = timer_ticks();
+        for (uint32_t lba = 0; lba < seq && ok; lba += BLKBENCH_CHUNK_SECTORS) {
+            if (bios_read_lba(d->drive, lba, BLKBENCH_CHUNK_SECTORS, buf) != 0) ok = 0;
+        }
+        uint32_t ticks = timer_ticks() - start;
+        if (!ok) {
+            print("  read error\n");
+            continue;
+        }
+        if (ticks == 0) ticks = 1;
+        print_uint_line("  Sequential: ", (seq / 2) * 100 / ticks, " KB/s\n");
+
+        uint32_t span = d->sectors > 0xFFFFFFFFull ? 0xFFFFFFFFu : (uint32_t)d->sectors;
+        uint32_t seed = 12345;
+        uint32_t ops = 0;
+        start = timer_ticks();
+        while (ok && timer_ticks() - start < BLKBENCH_TICKS) {
+            seed = seed * 1103515245u + 12345u;
+            uint32_t lba = (seed % (span / 8)) * 8;
+            if (bios_read_lba(d->drive, lba, 8, buf) != 0) ok = 0;
+            ops++;
+        }
+        ticks = timer_ticks() - start;
+        if (!ok) {
+            print("  read error\n");
+            continue;
+        }
+        print_uint_line("  Random 4K:  ", ops * 100 / ticks, " IOPS\n");
+
+        // The sequential span again, queued through an I/O ring.
+        io_ring_t* ring = &blkbench_ring;
+        ioring_init(ring);
+        uint32_t next = 0;
+        uint32_t inflight = 0;
+        start = timer_ticks();
+        while (ok && (next < seq || inflight > 0)) {
+            io_sqe_t* e;
+            while (next < seq && (e = ioring_get_sqe(ring)) != 0) {
+                e->opcode = IORING_OP_READ;
+                e->drive = d->drive;
+                e->lba = next;
+                e->count = BLKBENCH_CHUNK_SECTORS;
+                e->buf = buf;
+                next += BLKBENCH_CHUNK_SECTORS;
+                inflight++;
+            }
+            ioring_submit(ring);
+            io_cqe_t cqe;
+            if (!ioring_wait_cqe(ring, &cqe) || cqe.result < 0) ok = 0;
+            inflight--;
+        }
+        ioring_exit(ring);
+        ticks = timer_ticks() - start;
+        if (!ok) {
+            print("  read error\n");
+            continue;
+        }
+        if (ticks == 0) ticks = 1;
+        print_uint_line("  Ring reads: ", (seq / 2) * 100 / ticks, " KB/s\n");
+    }
+}
+
+// Reads every file below a directory, typically a volume mounted from a
+// disk image, and reports the throughput and the block-layer commands it
+// took. The buffer cache is written back and emptied first so the pass
+// starts cold. Directories are walked with a fixed stack of cursors since
+// the kernel stack is too small to recurse.
+#define TREEBENCH_DEPTH 8
+
+static FsDirCursor treebench_dirs[TREEBENCH_DEPTH];
+static size_t treebench_len[TREEBENCH_DEPTH];
+static char treebench_path[FS_PATH_MAX];
+
+static void tree_benchmark(const char* root) {
+    size_t len = strlen(root);
+    if (len == 0 || len >= FS_PATH_MAX) {
+        print("Usage: treebench <dir>\n");
+        return;
+    }
+    memcpy(treebench_path, root, len + 1);
+    if (fs_opendir(treebench_path, &treebench_dirs[0]) != 0) {
+        print("treebench: not a directory\n");
+        return;
+    }
+    bcache_sync_all();
+    for (int i = 0; i < bios_disk_count(); i++) {
+        const bios_drive_info_t* d = bios_disk_get(i);
+        if (d && d->present) bcache_invalidate(d->drive);
+    }
+
+    blkdev_stats_t before;
+    blkdev_stats_t after;
+    blkdev_get_stats(&before);
+    uint32_t files = 0;
+    uint32_t dirs = 0;
+    uint32_t skipped = 0;
+    uint32_t bytes = 0;
+    int depth = 0;
+    treebench_len[0] = len;
+    uint32_t start = timer_ticks();
+    while (depth >= 0) {
+        FsDirEntry e;
+        if (fs_readdir(&treebench_dirs[depth], &e) != 1) {
+            fs_closedir(&treebench_dirs[depth]);
+            depth--;
+            if (depth >= 0) treebench_path[treebench_len[depth]] = '\0';
+            continue;
+        }
+        size_t base = treebench_len[depth];
+        size_t sep = treebench_path[base - 1] == '/' ? 0 : 1;
+        size_t name_len = strlen(e.name);
+        if (base + sep + name_len >= FS_PATH_MAX) {
+            skipped++;
+            continue;
+        }
+        treebench_path[base] = '/';
+        memcpy(treebench_path + base + sep, e.name, name_len + 1);
+        if (e.type == FS_NODE_DIR) {
+            if (depth + 1 < TREEBENCH_DEPTH && fs_opendir(treebench_path, &treebench_dirs[depth + 1]) == 0) {
+                depth++;
+                treebench_len[depth] = base + sep + name_len;
+                dirs++;
+                continue;
+            }
+            skipped++;
+        } else {
+            fs_handle_t fh = fs_open(treebench_path);
+            if (fh) {
+                FsSpan span;
+                size_t n;
+                while ((n = fs_view(fh, &span)) > 0) bytes += (uint32_t)n;
+                fs_close(fh);
+                files++;
+            } else {
+                // Names cut short by the listing cannot be opened.
+                skipped++;
+            }
+        }
+        treebench_path[base] = '\0';
+    }
+    uint32_t ticks = timer_ticks() - start;
+    blkdev_get_stats(&after);
+    if (ticks == 0) ticks = 1;
+
+    print_uint_line("Files:          ", files, "");
+    print_uint_line(" in ", dirs + 1, " directories\n");
+    print_uint_line("Read:           ", bytes / 1024, " KB");
+    print_uint_line(" in ", ticks * 10, " ms\n");
+    print_uint_line("Throughput:     ", bytes / 1024 * 100 / ticks, " KB/s\n");
+    print_uint_line("Block commands: ", after.dispatched - before.dispatched, "");
+    print_uint_line(" for ", after.sectors - before.sectors, " sectors\n");
+    if (skipped) print_uint_line("Skipped:        ", skipped, " entries\n");
+}
+
+static void list_mounts(void) {
+    const char* path;
+    const char* type;
+    int i = 0;
+    while (fs_mount_get(i, &path, &type) == 0) {
+        print(path);
+        print(" (");
+        print(type);
+        print(")\n");
+        i++;
+    }
+    if (i == 0) print("No volumes mounted\n");
+}
+
+static void print_cache_stats(void) {
+    bcache_stats_t st;
+    bcache_get_stats(&st);
+    print_uint_line("Hits:            ", st.hits, "\n");
+    print_uint_line("Misses:          ", st.misses, "\n");
+    print_uint_line("Hit rate:        ", bcache_hit_percent(), "%\n");
+    print_uint_line("Read-ahead:      ", st.readahead, " sectors\n");
+    print_uint_line("Read-ahead hits: ", st.readahead_hits, " sectors\n");
+    print_uint_line("Written back:    ", st.writebacks, " sectors\n");
+    print_uint_line("Evictions:       ", st.evictions, "\n");
+    print_uint_line("Cached:          ", st.cached, " of ");
+    char buf[16];
+    itoa(BCACHE_BUFFERS, buf, 10);
+    print(buf);
+    print(" buffers\n");
+    print_uint_line("Dirty:           ", st.dirty, " buffers\n");
+    if (st.errors) print_uint_line("I/O errors:      ", st.errors, "\n");
+}
+
 static void list_devices() {
     bios_disk_scan();
     int count = bios_disk_count();
     if (count <= 0) {
-        print("No BIOS drives detected.\n");
+        print("No disk drives detected.\n");
         return;
     }
-    print("BIOS drives:\n");
+    print("Disk drives:\n");
     for (int i = 0; i < count; i++) {
         const bios_drive_info_t* d = bios_disk_get(i);
         if (!d || !d->present) continue;
@@ -301,37 +743,221 @@ static void list_devices() {
         char buf[16];
         itoa(d->drive, buf, 16);
         print(buf);
-        print(" (sector size ");
+        print(": ");
+        itoa((int)(d->sectors >> 11), buf, 10);
+        print(buf);
+        print(" MB (sector size ");
         itoa((int)d->sector_size, buf, 10);
         print(buf);
+        if (d->parent) {
+            print(", partition ");
+            itoa(d->part_number, buf, 10);
+            print(buf);
+            print(" of 0x");
+            itoa(d->parent, buf, 16);
+            print(buf);
+            if (d->part_type == PARTITION_TYPE_GPT) {
+                print(", GPT");
+            } else {
+                print(", type 0x");
+                itoa(d->part_type, buf, 16);
+                print(buf);
+            }
+        } else {
+            print(", ");
+            print(d->ops->name);
+        }
         print(")\n");
     }
 }
 
+// install streams the image through an I/O ring as alternating write and
+// read-back entries, two batches deep. One batch is one frame of the
+// compressed image: while a batch is on its way to the disk, the previous
+// one's read-back is checked against its CRC and the next frame is
+// unpacked. Everything below `verified` is known good; after a failure the
+// pipeline restarts there, and if it gives up, the next install of the same
+// image to the same drive resumes from that point.
+#define INSTALL_BATCH_SECTORS (LZIMAGE_FRAME_SIZE / 512)
+#define INSTALL_RETRIES 3
+#define INSTALL_PROGRESS_TICKS 100
+
+#if EMBED_INSTALL_ISO
+static uint8_t install_data[2][INSTALL_BATCH_SECTORS * 512];
+static uint8_t install_readback[2][INSTALL_BATCH_SECTORS * 512];
+static uint32_t install_crc[2];
+// About 1 KB; kept off the 4 KB kernel stack.
+static io_ring_t install_ring;
+static uint8_t install_resume_drive = 0;
+static uint32_t install_resume_sectors = 0;
+static uint32_t install_resume_lba = 0;
+
+static void print_install_progress(uint32_t done, uint32_t total, uint32_t sectors, uint32_t ticks) {
+    char buf[16];
+    print("  ");
+    itoa((int)(done >> 11), buf, 10);
+    print(buf);
+    print(" of ");
+    itoa((int)(total >> 11), buf, 10);
+    print(buf);
+    print(" MB, ");
+    if (ticks == 0) ticks = 1;
+    uint32_t kbps = (sectors / 2) * 100 / ticks;
+    itoa((int)(kbps / 1024), buf, 10);
+    print(buf);
+    print(".");
+    itoa((int)((kbps % 1024) * 10 / 1024), buf, 10);
+    print(buf);
+    print(" MB/s\n");
+}
+
+// Unpacks the frame for `lba` into the batch's slot and queues its write
+// and read-back. Returns -1 if the embedded image is damaged.
+static int queue_install_batch(io_ring_t* ring, uint8_t drive, lzimage_t* image,
+                               uint32_t lba, uint32_t n, uint32_t batch) {
+    uint8_t* data = install_data[batch & 1];
+    int got = lzimage_frame(image, lba / INSTALL_BATCH_SECTORS, data, sizeof(install_data[0]));
+    if (got < 0) return -1;
+    memset(data + got, 0, (size_t)n * 512 - (size_t)got);
+    install_crc[batch & 1] = crc32c(0, data, (size_t)n * 512);
+
+    io_sqe_t* w = ioring_get_sqe(ring);
+    w->opcode = IORING_OP_WRITE;
+    w->drive = drive;
+    w->lba = lba;
+    w->count = n;
+    w->buf = data;
+    w->user_data = batch << 1;
+    io_sqe_t* r = ioring_get_sqe(ring);
+    r->opcode = IORING_OP_READ;
+    r->drive = drive;
+    r->lba = lba;
+    r->count = n;
+    r->buf = install_readback[batch & 1];
+    r->user_data = (batch << 1) | 1;
+    ioring_submit(ring);
+    return 0;
+}
+#endif
+
 static void install_iso_to_drive(uint8_t drive) {
 #if EMBED_INSTALL_ISO
-    unsigned char* iso_start = &_binary_GooberOSx86_iso_start;
-    unsigned char* iso_end = &_binary_GooberOSx86_iso_end;
-    size_t iso_size = (size_t)(iso_end - iso_start);
-    size_t total_sectors = (iso_size + 511) / 512;
+    const uint8_t* packed = &_binary_GooberOSx86_iso_lz_start;
+    size_t packed_size = (size_t)(&_binary_GooberOSx86_iso_lz_end - packed);
+    lzimage_t image;
+    if (lzimage_open(&image, packed, packed_size) != 0 || image.frame_size != LZIMAGE_FRAME_SIZE) {
+        print("install: embedded image is damaged\n");
+        return;
+    }
+    uint32_t total = (image.original_size + 511) / 512;
+    char buf[16];
 
+    uint32_t start = 0;
+    if (install_resume_drive == drive && install_resume_sectors == total && install_resume_lba < total) {
+        start = install_resume_lba;
+    }
     print("Writing ISO to drive 0x");
-    char buf[16];
     itoa(drive, buf, 16);
     print(buf);
-    print("... ");
+    if (start) {
+        print(", resuming at LBA ");
+        itoa((int)start, buf, 10);
+        print(buf);
+    }
+    print("\n");
 
-    for (size_t i = 0; i < total_sectors; i++) {
-        const void* src = iso_start + (i * 512);
-        if (bios_write_lba(drive, (uint64_t)i, 1, src) != 0) {
-            print("\ninstall: write failed at LBA ");
-            itoa((int)i, buf, 10);
-            print(buf);
-            print("\n");
-            return;
+    uint32_t verified = start;
+    int retries = 0;
+    int ok = 1;
+    int damaged = 0;
+    uint32_t begin = timer_ticks();
+    uint32_t last_report = begin;
+    io_ring_t* ring = &install_ring;
+    ioring_init(ring);
+    while (verified < total) {
+        // Batches are numbered from `verified` each time the pipeline
+        // (re)starts, so batch 0 is always the first unverified one.
+        uint32_t base = verified;
+        uint32_t queued = 0;
+        uint32_t checked = 0;
+        int failed = 0;
+        while (!failed && base + checked * INSTALL_BATCH_SECTORS < total) {
+            while (queued < checked + 2 && base + queued * INSTALL_BATCH_SECTORS < total) {
+                uint32_t lba = base + queued * INSTALL_BATCH_SECTORS;
+                uint32_t n = total - lba < INSTALL_BATCH_SECTORS ? total - lba : INSTALL_BATCH_SECTORS;
+                if (queue_install_batch(ring, drive, &image, lba, n, queued) != 0) {
+                    damaged = 1;
+                    break;
+                }
+                queued++;
+            }
+            if (damaged) break;
+            io_cqe_t cqe;
+            if (!ioring_wait_cqe(ring, &cqe) || cqe.result < 0) {
+                failed = 1;
+                break;
+            }
+            if (!(cqe.user_data & 1)) continue;
+            // Read-back of batch `checked` is in; entries finish in order.
+            uint32_t lba = base + checked * INSTALL_BATCH_SECTORS;
+            size_t bytes = (size_t)cqe.result * 512;
+            if (crc32c(0, install_readback[checked & 1], bytes) != install_crc[checked & 1]) {
+                failed = 1;
+                break;
+            }
+            checked++;
+            verified = lba + (uint32_t)cqe.result;
+            install_resume_drive = drive;
+            install_resume_sectors = total;
+            install_resume_lba = verified;
+            if (timer_ticks() - last_report >= INSTALL_PROGRESS_TICKS) {
+                last_report = timer_ticks();
+                print_install_progress(verified, total, verified - start, last_report - begin);
+            }
+        }
+        if (!failed && !damaged) break;
+        // Stop the ring before restarting; the retry rewrites anything it
+        // left unrun.
+        ioring_exit(ring);
+        ioring_init(ring);
+        if (damaged || ++retries > INSTALL_RETRIES) {
+            ok = 0;
+            break;
         }
+        print("install: verify failed, retrying from LBA ");
+        itoa((int)verified, buf, 10);
+        print(buf);
+        print("\n");
+    }
+    if (ok) {
+        io_sqe_t* f = ioring_get_sqe(ring);
+        f->opcode = IORING_OP_FLUSH;
+        f->drive = drive;
+        ioring_submit(ring);
+        io_cqe_t cqe;
+        if (!ioring_wait_cqe(ring, &cqe) || cqe.result < 0) ok = 0;
+    }
+    ioring_exit(ring);
+
+    // Cached sectors of this drive (its partitions included) are now
+    // stale, and the partition table itself may have changed.
+    bcache_invalidate(drive);
+    bios_disk_scan();
+
+    if (damaged) {
+        print("install: embedded image is damaged\n");
+        return;
+    }
+    if (!ok) {
+        print("install: giving up; run install again to resume at LBA ");
+        itoa((int)verified, buf, 10);
+        print(buf);
+        print("\n");
+        return;
     }
-    print("done\n");
+    install_resume_sectors = 0;
+    print_install_progress(total, total, total - start, timer_ticks() - begin);
+    print("done, all sectors verified\n");
 #else
     (void)drive;
     print("install: embedded ISO not present in this build.\n");
@@ -370,7 +996,7 @@ void execute_command(const char* cmd) {
     }
 
     if (!strcmp_local(cmd, "help")) {
-        print("Available commands:\nhelp\ncls\necho\nls\ncd\nexit\ngames\ntaskview\ndevices\ninstall (optional embed)\nedit\nnew\nwrite\nmkdir\ndel\nrmdir\nread\ngui\ncolor\n");
+        print("Available commands:\nhelp\ncls\necho\nls\ncd\nexit\ngames\ntaskview\ndevices\ninstall (optional embed)\nedit\nnew\nwrite\nappend\ncopy\nmkdir\ndel\nrmdir\nread\nmount [drive path]\numount <path>\nsnapshot save|load [drive]\ndedup\ncompress [on|off|now]\nlzbench\ncksumbench\ncrc32 <file>\nsha256sum <file>\nblkbench\ntreebench <dir>\ncache [sync]\ngui\ncolor\n");
     } else if (!strcmp_local(cmd, "gui")) {
         if (redirected) {
             print("Already in GUI mode.\n");
@@ -452,6 +1078,90 @@ void execute_command(const char* cmd) {
                 print("\n");
             }
         }
+    } else if (!strncmp_local(cmd, "append ", 7)) {
+        const char* rest = cmd + 7;
+        size_t i = 0;
+        while (rest[i] && rest[i] != ' ') i++;
+        char filename[INPUT_BUFFER_SIZE] = {0};
+        size_t fn_len = i < INPUT_BUFFER_SIZE - 1 ? i : INPUT_BUFFER_SIZE - 1;
+        for (size_t j = 0; j < fn_len; j++) filename[j] = rest[j];
+        filename[fn_len] = '\0';
+        const char* content = rest + i;
+        while (*content == ' ') content++;
+        if (filename[0] == '\0') {
+            print("append: Filename required\n");
+        } else {
+            if (fs_append(filename, (const uint8_t*)content, strlen(content)) == 0) {
+                print("Appended to ");
+                print(filename);
+                print("\n");
+            } else {
+                print("append: Failed to write ");
+                print(filename);
+                print("\n");
+            }
+        }
+    } else if (!strncmp_local(cmd, "copy ", 5)) {
+        const char* rest = cmd + 5;
+        size_t i = 0;
+        while (rest[i] && rest[i] != ' ') i++;
+        char src[INPUT_BUFFER_SIZE] = {0};
+        size_t src_len = i < INPUT_BUFFER_SIZE - 1 ? i : INPUT_BUFFER_SIZE - 1;
+        for (size_t j = 0; j < src_len; j++) src[j] = rest[j];
+        src[src_len] = '\0';
+        const char* dst = rest + i;
+        while (*dst == ' ') dst++;
+        if (src[0] == '\0' || *dst == '\0') {
+            print("Usage: copy <src> <dst>\n");
+        } else if (fs_copy(src, dst) == 0) {
+            print("Copied ");
+            print(src);
+            print(" to ");
+            print(dst);
+            print("\n");
+        } else {
+            print("copy: Failed to copy ");
+            print(src);
+            print("\n");
+        }
+    } else if (!strcmp_local(cmd, "compress")) {
+        print_compress_stats();
+    } else if (!strncmp_local(cmd, "compress ", 9)) {
+        const char* arg = cmd + 9;
+        while (*arg == ' ') arg++;
+        if (!strcmp_local(arg, "on")) {
+            fs_compress_set_enabled(1);
+            print("Compression of idle files enabled\n");
+        } else if (!strcmp_local(arg, "off")) {
+            fs_compress_set_enabled(0);
+            print("Compression of idle files disabled\n");
+        } else if (!strcmp_local(arg, "now")) {
+            char buf[16];
+            itoa(fs_compress_all(), buf, 10);
+            print("Packed ");
+            print(buf);
+            print(" file(s)\n");
+        } else {
+            print("Usage: compress [on|off|now]\n");
+        }
+    } else if (!strcmp_local(cmd, "lzbench")) {
+        lz_benchmark();
+    } else if (!strcmp_local(cmd, "cksumbench")) {
+        checksum_benchmark();
+    } else if (!strcmp_local(cmd, "crc32") || !strncmp_local(cmd, "crc32 ", 6)) {
+        checksum_file(cmd[5] ? cmd + 6 : "", 0);
+    } else if (!strcmp_local(cmd, "sha256sum") || !strncmp_local(cmd, "sha256sum ", 10)) {
+        checksum_file(cmd[9] ? cmd + 10 : "", 1);
+    } else if (!strcmp_local(cmd, "blkbench")) {
+        block_benchmark();
+    } else if (!strncmp_local(cmd, "treebench ", 10)) {
+        tree_benchmark(cmd + 10);
+    } else if (!strcmp_local(cmd, "cache")) {
+        print_cache_stats();
+    } else if (!strcmp_local(cmd, "cache sync")) {
+        print(bcache_sync_all() == 0 ? "Disk cache written back\n" : "cache: write-back failed\n");
+    } else if (!strcmp_local(cmd, "dedup")) {
+        print_dedup_stats();
     } else if (!strncmp_local(cmd, "mkdir ", 6)) {
         const char* arg = cmd + 6;
         size_t len = 0;
@@ -526,22 +1236,95 @@ void execute_command(const char* cmd) {
         if (filename[0] == '\0') {
             print("read: Filename required\n");
         } else {
-            FileHandle* fh = fs_open(filename);
+            fs_handle_t fh = fs_open(filename);
             if (!fh) {
                 print("read: File not found: ");
                 print(filename);
                 print("\n");
             } else {
-                uint8_t buffer[128];
-                size_t n;
-                while ((n = fs_read(fh, buffer, sizeof(buffer) - 1)) > 0) {
-                    buffer[n] = 0;
-                    print((const char*)buffer);
+                FsSpan span;
+                while (fs_view(fh, &span) > 0) {
+                    print_n((const char*)span.data, span.len);
                 }
                 fs_close(fh);
                 print("\n");
             }
         }
+    } else if (!strcmp_local(cmd, "mount")) {
+        list_mounts();
+    } else if (!strncmp_local(cmd, "mount ", 6)) {
+        const char* args = cmd + 6;
+        while (*args == ' ') args++;
+        char drive_str[16] = {0};
+        size_t len = 0;
+        while (args[len] && args[len] != ' ' && len < sizeof(drive_str) - 1) {
+            drive_str[len] = args[len];
+            len++;
+        }
+        const char* path = args + len;
+        while (*path == ' ') path++;
+        uint32_t drive_val = 0;
+        if (len == 0 || *path != '/') {
+            print("Usage: mount <drive> </path>\n");
+        } else if (parse_hex(drive_str, &drive_val) != 0) {
+            print("mount: invalid drive\n");
+        } else {
+            bios_disk_scan();
+            if (fat32_mount((uint8_t)drive_val, path) == 0) {
+                print("Mounted FAT32 volume at ");
+                print(path);
+                print("\n");
+            } else if (iso9660_mount((uint8_t)drive_val, path) == 0) {
+                print("Mounted ISO9660 volume at ");
+                print(path);
+                print("\n");
+            } else if (ext2_mount((uint8_t)drive_val, path) == 0) {
+                print("Mounted ext2 volume at ");
+                print(path);
+                print("\n");
+            } else {
+                print("mount: no mountable filesystem on that drive\n");
+            }
+        }
+    } else if (!strncmp_local(cmd, "umount ", 7)) {
+        const char* path = cmd + 7;
+        while (*path == ' ') path++;
+        if (fs_unmount(path) == 0) {
+            print("Unmounted ");
+            print(path);
+            print("\n");
+        } else {
+            print("umount: not a mount point, or files on it are still open\n");
+        }
+    } else if (!strncmp_local(cmd, "snapshot ", 9)) {
+        const char* args = cmd + 9;
+        while (*args == ' ') args++;
+        int save = !strncmp_local(args, "save", 4) && (args[4] == '\0' || args[4] == ' ');
+        int load = !strncmp_local(args, "load", 4) && (args[4] == '\0' || args[4] == ' ');
+        uint32_t drive_val = 0;
+        uint32_t lba = 0;
+        const char* drive_str = args + 4;
+        while (*drive_str == ' ') drive_str++;
+        if (!save && !load) {
+            print("Usage: snapshot save|load [drive]\n");
+        } else if (*drive_str != '\0' && parse_hex(drive_str, &drive_val) != 0) {
+            print("snapshot: invalid drive\n");
+        } else {
+            bios_disk_scan();
+            uint8_t drive = (uint8_t)drive_val;
+            int located = *drive_str != '\0' ? fs_snapshot_location(drive, &lba) : fs_snapshot_find(&drive, &lba);
+            if (located != 0) {
+                print(*drive_str != '\0' ? "snapshot: no such drive, or not a snapshot partition (type 7F)\n"
+                                         : "snapshot: no snapshot partition (type 7F); name a drive\n");
+            } else {
+                int rc = save ? fs_snapshot_save(drive, lba) : fs_snapshot_load(drive, lba);
+                if (rc == 0) {
+                    print(save ? "Snapshot saved\n" : "Snapshot restored\n");
+                } else {
+                    print(save ? "snapshot: save failed\n" : "snapshot: no valid snapshot found\n");
+                }
+            }
+        }
     } else if (!strcmp_local(cmd, "devices")) {
         list_devices();
     } else if (!strncmp_local(cmd, "install ", 8)) {
@@ -2,6 +2,7 @@
 #include "../drivers/video/vga.h"
 #include "../drivers/timer/timer.h"
 #include "../kernel.h"
+#include "../drivers/storage/bcache.h"
 #include "process.h"
 
 #include <stdbool.h>
@@ -92,6 +93,28 @@ static void display_processes(int start_y, int x, int width, int height) {
     }
 }
 
+static int draw_text(int x, int y, const char* str) {
+    int i = 0;
+    for (; str[i]; i++) vga_putch(x + i, y, str[i]);
+    return i;
+}
+
+static void display_cache_stats(int x, int y) {
+    bcache_stats_t st;
+    bcache_get_stats(&st);
+    char num[16];
+    x += draw_text(x, y, "Disk cache: ");
+    itoa((int)bcache_hit_percent(), num);
+    x += draw_text(x, y, num);
+    x += draw_text(x, y, "% hits, ");
+    itoa((int)st.cached, num);
+    x += draw_text(x, y, num);
+    x += draw_text(x, y, " cached, ");
+    itoa((int)st.dirty, num);
+    x += draw_text(x, y, num);
+    draw_text(x, y, " dirty");
+}
+
 static bool handle_input() {
     bool should_exit = false;
     while (keyboard_has_char()) {
@@ -122,6 +145,7 @@ void run_task_manager() {
         draw_box(10, 5, 60, TASKMGR_WINDOW_HEIGHT);
         print_centered(5, "GooberOS Task Manager");
         display_processes(5, 10, 60, TASKMGR_WINDOW_HEIGHT);
+        display_cache_stats(11, 5 + TASKMGR_WINDOW_HEIGHT);
         if (handle_input()) break;
         timer_sleep(50);
     }
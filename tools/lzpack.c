@@ -0,0 +1,107 @@
+// Host tool: packs a file into the frame-compressed format in lib/lzimage.h
+// so the kernel can embed it small and unpack it one frame at a time.
+//
+//   lzpack <input> <output>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/lz.h"
+#include "../lib/lzimage.h"
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(size > 0 ? (size_t)size : 1);
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return data;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <input> <output>\n", argv[0]);
+        return 1;
+    }
+    size_t len = 0;
+    uint8_t* in = read_file(argv[1], &len);
+    if (!in) {
+        fprintf(stderr, "lzpack: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if (len == 0 || len > 0xFFFFFFFFu) {
+        fprintf(stderr, "lzpack: %s must be between 1 byte and 4 GB\n", argv[1]);
+        return 1;
+    }
+
+    uint32_t frames = (uint32_t)((len + LZIMAGE_FRAME_SIZE - 1) / LZIMAGE_FRAME_SIZE);
+    size_t table = sizeof(lzimage_header_t) + (size_t)frames * 4;
+    size_t cap = table + (size_t)frames * LZ_BOUND(LZIMAGE_FRAME_SIZE);
+    uint8_t* out = malloc(cap);
+    if (!out) {
+        fprintf(stderr, "lzpack: out of memory\n");
+        return 1;
+    }
+    put_u32(out, LZIMAGE_MAGIC);
+    put_u32(out + 4, LZIMAGE_FRAME_SIZE);
+    put_u32(out + 8, frames);
+    put_u32(out + 12, (uint32_t)len);
+
+    size_t pos = table;
+    for (uint32_t i = 0; i < frames; i++) {
+        size_t off = (size_t)i * LZIMAGE_FRAME_SIZE;
+        size_t n = len - off < LZIMAGE_FRAME_SIZE ? len - off : LZIMAGE_FRAME_SIZE;
+        size_t packed = lz_compress(in + off, n, out + pos, LZ_BOUND(LZIMAGE_FRAME_SIZE));
+        if (packed == 0 || packed >= n) {
+            memcpy(out + pos, in + off, n);
+            put_u32(out + sizeof(lzimage_header_t) + i * 4, (uint32_t)n | LZIMAGE_STORED);
+            pos += n;
+        } else {
+            put_u32(out + sizeof(lzimage_header_t) + i * 4, (uint32_t)packed);
+            pos += packed;
+        }
+    }
+
+    // Unpack everything again before trusting the output.
+    lzimage_t img;
+    uint8_t* check = malloc(LZIMAGE_FRAME_SIZE);
+    if (!check || lzimage_open(&img, out, pos) != 0) {
+        fprintf(stderr, "lzpack: self-check failed\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < frames; i++) {
+        size_t off = (size_t)i * LZIMAGE_FRAME_SIZE;
+        int got = lzimage_frame(&img, i, check, LZIMAGE_FRAME_SIZE);
+        if (got < 0 || memcmp(check, in + off, (size_t)got) != 0) {
+            fprintf(stderr, "lzpack: self-check failed at frame %u\n", i);
+            return 1;
+        }
+    }
+
+    FILE* f = fopen(argv[2], "wb");
+    if (!f || fwrite(out, 1, pos, f) != pos || fclose(f) != 0) {
+        fprintf(stderr, "lzpack: cannot write %s\n", argv[2]);
+        return 1;
+    }
+    printf("lzpack: %zu -> %zu bytes (%u frames)\n", len, pos, frames);
+    free(check);
+    free(out);
+    free(in);
+    return 0;
+}